@@ -5,23 +5,51 @@
 #include <stdlib.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <fcntl.h>
+#include <signal.h>
 
 #include "energy_monitor.h"
 #include "log.h"
 #include "json.h"
+#include "ingestor.h"
+#include "pipeline.h"
+#include "load_generator.h"
+#include "json_writer.h"
+
+// Fields of a usage_snapshot written as JSON
+#define SNAPSHOT_FIELD_COUNT 6
 
 pid_t create_child_process();
 void create_and_print_json_stub(char*, size_t);
-void write_to_buffer(char*, size_t, usage_snapshot);
+int write_snapshot(json_writer*, char*, size_t, usage_snapshot);
 usage_snapshot initialise_snapshot_stub(uint64_t, double, double, double, double, uint8_t);
+int ingest_files(int, char*[]);
+void close_input_files(const int*, int);
+int generate_files(int, char*[]);
+int replay_files(int, char*[]);
+void log_generator_stats(const generator_stats*);
+void count_meter_reading_batch(const meter_reading_batch*, void*);
 
-int main()
+int main(int argc, char* argv[])
 {
     set_log_level(INFO);   
-    const char* json_str = "{\"timestamp\": 1717379654, \"electric_usage\": 3.1234500000, \"electric_cost\": 0.0013230000, \"gas_cost\": 1.4335660000, \"gas_usage\": 0.0014424000, \"status_flags\": \"15\", \"switch\" : true, \"is_cancelled\" : false, \"updatedtimestamp\" : null, \"Path\" : \"Test\\\\\\\"\\\\\\\\\"\", \"exponent\" : 1.5e+10}";
+    // generate <target> [readings] [meters] [rate] [ndjson|binary]
+    if (2 < argc && 0 == strcmp("generate", argv[1]))
+        return generate_files(argc - 2, argv + 2);
+    // replay <capture> <target> [speed] [ndjson|binary]
+    if (3 < argc && 0 == strcmp("replay", argv[1]))
+        return replay_files(argc - 2, argv + 2);
+    // NDJSON files supplied, run them through the ingest pipeline
+    if (1 < argc)
+        return ingest_files(argc - 1, argv + 1);
+    const char* json_str = "{\"timestamp\": 1717379654, \"electric_usage\": 3.1234500000, \"electric_cost\": 0.0013230000, \"gas_cost\": 1.4335660000, \"gas_usage\": 0.0014424000, \"status_flags\": \"15\", \"switch\" : true, \"is_cancelled\" : false, \"updatedtimestamp\" : null, \"Path\" : \"Test\\\\\\\"\\\\\\\\\", \"unit\" : \"\\u00b0C \\ud83d\\udd0c\", \"exponent\" : 1.5e+10}";
 
     LOG(INFO, "%s\n", json_str);
     parse_json_string(json_str, strlen(json_str));
+    usage_snapshot snapshot;
+    ingest_error error = parse_usage_document(json_str, strlen(json_str), &snapshot);
+    LOG(INFO, "Ingest result %d, timestamp %lu, status %d.\n", error, snapshot.timestamp, 
+            snapshot.status);
     int status;
     pid_t child_pid = create_child_process();
 
@@ -61,28 +89,59 @@ void create_and_print_json_stub(char* buffer, size_t length)
         exit(EXIT_FAILURE);
     }
 
-    size_t BUFFER_SIZE = 256;
-    if (length < BUFFER_SIZE)
-         LOG(ERROR, "Requires a buffer of at least %zu, available %zu.\n", BUFFER_SIZE, length);
-     
     usage_snapshot stub = initialise_snapshot_stub((uint64_t) 1717379654, (double) 3.12345,(double) 0.001323, 
             (double) 1.433566, (double) 0.0014424, (uint8_t) 15);
 
-    write_to_buffer(buffer, length, stub);
-    //LOG(INFO, "JSON: %s.\n", buffer);
-    
+    json_writer* writer = malloc(sizeof(json_writer));
+    if (NULL == writer)
+    {
+        LOG(ERROR, "JSON writer allocation failed.\n");
+        exit(EXIT_FAILURE);
+    }
+    initialise_json_writer(writer, STDOUT_FILENO);
+    if (!write_snapshot(writer, buffer, length, stub) || !write_json_newline(writer) ||
+            !flush_json_writer(writer))
+        LOG(ERROR, "JSON stub not written.\n");
+    free(writer);
 }
 
-void write_to_buffer(char* buffer, size_t length, usage_snapshot snapshot)
+int write_snapshot(json_writer* writer, char* buffer, size_t length, usage_snapshot snapshot)
 {
-    size_t response = snprintf(buffer, length, "{\"timestamp\": %lu, \"electric_usage\": %.10lf, \"electric_cost\""
-            ": %0.10lf, \"gas_cost\": %0.10lf, \"gas_usage\": %0.10lf, \"status_flags\": %d}",
-            snapshot.timestamp, snapshot.electric_usage, snapshot.electric_cost, snapshot.gas_usage, 
-            snapshot.gas_cost, snapshot.status);
-
-    if (length <= response)
-        LOG(ERROR, "JSON payload truncated, required buffer size %ld, available %ld.\n", response, length);
-
+    // Number text is formatted into the buffer, the writer copies it without allocating
+    const char* values[SNAPSHOT_FIELD_COUNT];
+    size_t value_lengths[SNAPSHOT_FIELD_COUNT];
+    const double usage[] = {snapshot.electric_usage, snapshot.electric_cost, snapshot.gas_usage,
+            snapshot.gas_cost};
+    size_t used = 0;
+    for (size_t i = 0; i < SNAPSHOT_FIELD_COUNT; ++i)
+    {
+        int response = 0;
+        if (0 == i)
+            response = snprintf(buffer + used, length - used, "%lu", snapshot.timestamp);
+        else if (SNAPSHOT_FIELD_COUNT - 1 == i)
+            response = snprintf(buffer + used, length - used, "%d", snapshot.status);
+        else
+            response = snprintf(buffer + used, length - used, "%.10lf", usage[i - 1]);
+        if (0 > response || length - used <= (size_t) response)
+        {
+            LOG(ERROR, "Snapshot not written, number buffer of %zu bytes too small.\n", length);
+            return 0;
+        }
+        values[i] = buffer + used;
+        value_lengths[i] = (size_t) response;
+        used += (size_t) response + 1;
+    }
+    const json_item items[SNAPSHOT_FIELD_COUNT] = {
+        {"timestamp", 9, values[0], value_lengths[0], 0, INTEGER},
+        {"electric_usage", 14, values[1], value_lengths[1], 0, FLOAT},
+        {"electric_cost", 13, values[2], value_lengths[2], 0, FLOAT},
+        {"gas_usage", 9, values[3], value_lengths[3], 0, FLOAT},
+        {"gas_cost", 8, values[4], value_lengths[4], 0, FLOAT},
+        {"status_flags", 12, values[5], value_lengths[5], 0, INTEGER}
+    };
+    const json_object object = {NULL, ITEM, (void*) items, SNAPSHOT_FIELD_COUNT,
+            SNAPSHOT_FIELD_COUNT};
+    return write_json_object(writer, &object);
 }
 
 usage_snapshot initialise_snapshot_stub(uint64_t timestamp, double electric_consumption, 
@@ -91,3 +150,100 @@ usage_snapshot initialise_snapshot_stub(uint64_t timestamp, double electric_cons
     usage_snapshot stub = {timestamp, electric_consumption, electric_cost, gas_consumption, gas_cost, status_bits};
     return stub;
 }
+
+int ingest_files(int file_count, char* file_names[])
+{
+    if (MAX_STAGE_THREADS < file_count)
+    {
+        LOG(ERROR, "At most %d input files are supported.\n", MAX_STAGE_THREADS);
+        return EXIT_FAILURE;
+    }
+    int input_fds[MAX_STAGE_THREADS];
+    for (int i = 0; i < file_count; ++i)
+    {
+        input_fds[i] = (0 == strcmp("-", file_names[i])) ? STDIN_FILENO : open(file_names[i], O_RDONLY);
+        if (0 > input_fds[i])
+        {
+            LOG(ERROR, "Unable to open %s.\n", file_names[i]);
+            close_input_files(input_fds, i);
+            return EXIT_FAILURE;
+        }
+    }
+    uint64_t reading_count = 0;
+    const long processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+    const size_t parser_count = (2 < processor_count) ? (size_t) processor_count - 2 : 1;
+    pipeline_config config = {input_fds, (size_t) file_count, 
+        (MAX_STAGE_THREADS < parser_count) ? MAX_STAGE_THREADS : parser_count, 1, 
+        NULL, &reading_count, count_meter_reading_batch};
+    pipeline_stats stats;
+    const int is_successful = run_pipeline(&config, &stats);
+    log_pipeline_stats(&stats);
+    LOG(INFO, "Meter readings ingested: %lu.\n", reading_count);
+    close_input_files(input_fds, file_count);
+    return is_successful ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void close_input_files(const int* input_fds, int file_count)
+{
+    for (int i = 0; i < file_count; ++i)
+        if (STDIN_FILENO != input_fds[i])
+            close(input_fds[i]);
+}
+
+void count_meter_reading_batch(const meter_reading_batch* batch, void* context)
+{
+    uint64_t* reading_count = context;
+    for (size_t i = 0; i < batch->count; ++i)
+        *reading_count += (INGEST_OK == batch->errors[i]);
+}
+
+int generate_files(int argument_count, char* arguments[])
+{
+    generator_config config;
+    initialise_generator_config(&config);
+    if (1 < argument_count)
+        config.reading_count = strtoull(arguments[1], NULL, 10);
+    if (2 < argument_count)
+        config.meter_count = strtoull(arguments[2], NULL, 10);
+    if (3 < argument_count)
+        config.target_rate = strtod(arguments[3], NULL);
+    if (4 < argument_count && 0 == strcmp("binary", arguments[4]))
+        config.format = FORMAT_BINARY;
+    // A reader closing a pipe output fails the write, rather than killing the generator
+    signal(SIGPIPE, SIG_IGN);
+    const int output_fd = open_generator_output(arguments[0]);
+    if (0 > output_fd)
+        return EXIT_FAILURE;
+    generator_stats stats;
+    const int is_successful = generate_load(&config, output_fd, &stats);
+    log_generator_stats(&stats);
+    if (STDOUT_FILENO != output_fd)
+        close(output_fd);
+    return is_successful ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int replay_files(int argument_count, char* arguments[])
+{
+    const double speed = (2 < argument_count) ? strtod(arguments[2], NULL) : 1.0;
+    const stream_format format = (3 < argument_count && 0 == strcmp("binary", arguments[3])) ?
+            FORMAT_BINARY : FORMAT_NDJSON;
+    // A reader closing a pipe output fails the write, rather than killing the generator
+    signal(SIGPIPE, SIG_IGN);
+    const int output_fd = open_generator_output(arguments[1]);
+    if (0 > output_fd)
+        return EXIT_FAILURE;
+    generator_stats stats;
+    const int is_successful = replay_capture(arguments[0], format, speed, output_fd, &stats);
+    log_generator_stats(&stats);
+    if (STDOUT_FILENO != output_fd)
+        close(output_fd);
+    return is_successful ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void log_generator_stats(const generator_stats* stats)
+{
+    LOG(INFO, "Readings: %lu, out of order: %lu, malformed: %lu, bytes: %lu, seconds: %.3f, "
+            "readings per second: %.0f.\n", stats->readings, stats->out_of_order, stats->malformed,
+            stats->bytes, stats->seconds, (0.0 < stats->seconds) ?
+            (double) stats->readings / stats->seconds : 0.0);
+}
@@ -0,0 +1,42 @@
+#ifndef ENERGYMONITOR_BENCH_H_
+#define ENERGYMONITOR_BENCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * @brief Monotonic time in seconds, for timing the benchmark programs.
+ */
+static inline double get_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Read an optional size from the command line.
+ * @return the first argument if it is a positive number, default_size otherwise.
+ */
+static inline size_t get_bench_size(const int argc, char** argv, const size_t default_size)
+{
+    if (1 < argc)
+    {
+        const unsigned long long size = strtoull(argv[1], NULL, 10);
+        if (0 < size)
+            return (size_t) size;
+    }
+    return default_size;
+}
+
+/**
+ * @brief Report the rate of a timed run.
+ */
+static inline void report_rate(const char* name, const size_t count, const double seconds)
+{
+    printf("%-32s %12zu items %9.3f s %14.0f items/s\n", name, count, seconds,
+            (0.0 < seconds) ? (double) count / seconds : 0.0);
+}
+
+#endif
@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "anomaly_detector.h"
+#include "energy_monitor.h"
+
+// 20M readings per run, as the fleet sends them, one reading per meter per step
+#define DEFAULT_READING_COUNT 20000000
+#define STEP_SECONDS 60
+// Step of each run the usage anomalies are injected at, the first after the warm-up
+#define INJECT_STEP 16
+// Steps a meter skips to inject a gap, from step 2
+#define GAP_STEPS 6
+#define INJECTED_ALERTS 5
+
+/**
+ * @brief Forms of meter ID.
+ */
+typedef enum
+{
+    DENSE_IDS = 0,
+    RANDOM_IDS = 1,
+    HIGH_BIT_IDS = 2
+} id_form;
+
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static double next_uniform(uint64_t* state)
+{
+    return (double) (next_random(state) >> 11) / 9007199254740992.0;
+}
+
+/**
+ * @brief ID of a meter: dense, spread by a splitmix64 finaliser, or differing in the high bits
+ * only, e.g. a site code above a device number.
+ */
+static uint64_t get_meter_id(const size_t meter, const id_form form)
+{
+    if (DENSE_IDS == form)
+        return meter;
+    if (HIGH_BIT_IDS == form)
+        return (uint64_t) meter << 40;
+    uint64_t id = meter + UINT64_C(0x9E3779B97F4A7C15);
+    id = (id ^ (id >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+    id = (id ^ (id >> 27)) * UINT64_C(0x94D049BB133111EB);
+    return id ^ (id >> 31);
+}
+
+/**
+ * @brief Run a fleet through the detector a step at a time, timing only detect_anomalies().
+ * One of each anomaly is injected, any other alert is a false positive.
+ * @param is_shuffled readings of a step in a random meter order, rather than by meter.
+ */
+static void run_fleet(const char* name, const size_t meter_count, const size_t reading_count,
+        const id_form form, const int is_shuffled)
+{
+    const size_t steps = (reading_count + meter_count - 1) / meter_count;
+    meter_reading* readings = malloc(meter_count * sizeof(meter_reading));
+    size_t* order = malloc(meter_count * sizeof(size_t));
+    anomaly_detector detector;
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    if (NULL == readings || NULL == order ||
+            !initialise_anomaly_detector(&detector, &config, meter_count))
+    {
+        fprintf(stderr, "Allocation for %zu meters failed.\n", meter_count);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < meter_count; ++i)
+        order[i] = i;
+    for (size_t i = meter_count - 1; is_shuffled && 0 < i; --i)
+    {
+        const size_t j = (size_t) (next_random(&state) % (i + 1));
+        const size_t swapped = order[i];
+        order[i] = order[j];
+        order[j] = swapped;
+    }
+    const size_t spike_meter = meter_count / 7;
+    const size_t dropout_meter = 2 * meter_count / 7;
+    const size_t cleared_meter = 3 * meter_count / 7;
+    const size_t regression_meter = 4 * meter_count / 7;
+    const size_t gap_meter = 5 * meter_count / 7;
+    size_t alerts = 0;
+    double seconds = 0.0;
+    size_t count = 0;
+    for (size_t step = 0; step < steps; ++step)
+    {
+        const size_t step_count = (reading_count - count < meter_count) ?
+                reading_count - count : meter_count;
+        size_t written = 0;
+        for (size_t i = 0; i < step_count; ++i)
+        {
+            const size_t meter = order[i];
+            if (gap_meter == meter && 2 <= step && 2 + GAP_STEPS > step)
+                continue;
+            const double scale = 0.2 + (double) (meter % 17) * 0.1;
+            meter_reading* reading = readings + written++;
+            memset(reading, 0, sizeof(*reading));
+            reading->meter_id = get_meter_id(meter, form);
+            reading->snapshot.timestamp = 1000 + step * STEP_SECONDS;
+            reading->snapshot.electric_usage = scale * (0.95 + 0.1 * next_uniform(&state));
+            reading->snapshot.gas_usage = 2.0 * scale * (0.95 + 0.1 * next_uniform(&state));
+            reading->snapshot.status = bitmask_electric_usage | bitmask_gas_usage;
+            if (INJECT_STEP != step)
+                continue;
+            if (spike_meter == meter)
+                reading->snapshot.electric_usage *= 10.0;
+            else if (dropout_meter == meter)
+                reading->snapshot.gas_usage = 0.0;
+            else if (cleared_meter == meter)
+                reading->snapshot.status = bitmask_gas_usage;
+            else if (regression_meter == meter)
+                reading->snapshot.timestamp -= 2 * STEP_SECONDS;
+        }
+        const double start = get_seconds();
+        detect_anomalies(&detector, readings, written);
+        seconds += get_seconds() - start;
+        count += written;
+        anomaly_alert_batch* batch = NULL;
+        while (NULL != (batch = pop_anomaly_alerts(&detector)))
+        {
+            alerts += batch->count;
+            release_anomaly_alerts(&detector, batch);
+        }
+    }
+    report_rate(name, count, seconds);
+    printf("%-32s %.1f ns per reading, %zu steps, %zu alerts, %d injected, %llu dropped\n", "",
+            seconds * 1e9 / (double) count, steps, alerts,
+            (INJECT_STEP < steps) ? INJECTED_ALERTS : 0,
+            (unsigned long long) detector.dropped_alert_count);
+    free_anomaly_detector(&detector);
+    free(readings);
+    free(order);
+}
+
+int main(int argc, char** argv)
+{
+    const size_t count = get_bench_size(argc, argv, DEFAULT_READING_COUNT);
+    // State in cache
+    run_fleet("1K meters, random IDs", 1000, count, RANDOM_IDS, 0);
+    // Fleet scale, the state and ID table far larger than the cache
+    run_fleet("100K meters, dense IDs", 100000, count, DENSE_IDS, 0);
+    run_fleet("100K meters, random IDs", 100000, count, RANDOM_IDS, 0);
+    run_fleet("100K meters, high bit IDs", 100000, count, HIGH_BIT_IDS, 0);
+    run_fleet("1M meters, random IDs", 1000000, count, RANDOM_IDS, 0);
+    run_fleet("1M meters, high bit IDs", 1000000, count, HIGH_BIT_IDS, 0);
+    run_fleet("1M meters, random IDs shuffled", 1000000, count, RANDOM_IDS, 1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "heavy_hitters.h"
+#include "energy_monitor.h"
+
+#define DEFAULT_UPDATE_COUNT 10000000
+// Update rate the tracker is expected to sustain on one thread
+#define TARGET_UPDATES_PER_SECOND 10e6
+
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * @brief Fill readings for meter_count meters, skewed (roughly Zipfian) or uniform.
+ */
+static void create_readings(meter_reading* readings, const size_t count,
+        const uint64_t meter_count, const int is_skewed)
+{
+    uint64_t state = 2463534242ULL;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const double uniform = (double) (next_random(&state) >> 11) / 9007199254740992.0;
+        const uint64_t meter = is_skewed ?
+                (uint64_t) pow((double) meter_count, uniform * uniform) - 1 :
+                (uint64_t) (uniform * (double) meter_count);
+        readings[i].meter_id = meter * UINT64_C(0x9E3779B97F4A7C15);
+        readings[i].snapshot.timestamp = i;
+        readings[i].snapshot.electric_usage = 0.5 + (double) (next_random(&state) % 100) / 100.0;
+        readings[i].snapshot.gas_usage = readings[i].snapshot.electric_usage;
+        readings[i].snapshot.status = bitmask_electric_usage | bitmask_gas_usage;
+    }
+}
+
+static void run_updates(const char* name, const meter_reading* readings, const size_t count)
+{
+    static heavy_hitter_tracker tracker;
+    initialise_heavy_hitter_tracker(&tracker);
+    const double start = get_seconds();
+    for (size_t i = 0; i < count; ++i)
+        add_heavy_hitter_weight(&tracker, readings[i].meter_id,
+                readings[i].snapshot.electric_usage);
+    const double seconds = get_seconds() - start;
+    report_rate(name, count, seconds);
+    heavy_hitter top;
+    get_top_heavy_hitters(&tracker, &top, 1);
+    printf("%-32s top meter %016llx weight %.1f, error bound %.1f, target %s\n", "",
+            (unsigned long long) top.meter_id, top.weight,
+            get_heavy_hitter_error_bound(&tracker),
+            ((double) count / seconds >= TARGET_UPDATES_PER_SECOND) ? "met" : "missed");
+}
+
+int main(int argc, char** argv)
+{
+    const size_t count = get_bench_size(argc, argv, DEFAULT_UPDATE_COUNT);
+    meter_reading* readings = malloc(count * sizeof(meter_reading));
+    if (NULL == readings)
+    {
+        fprintf(stderr, "Allocation for %zu readings failed.\n", count);
+        return EXIT_FAILURE;
+    }
+    // Meters within capacity, a skewed fleet, and a uniform fleet replacing on most updates
+    create_readings(readings, count, HEAVY_HITTER_CAPACITY / 2, 0);
+    run_updates("updates, 512 meters", readings, count);
+    create_readings(readings, count, 1000000, 1);
+    run_updates("updates, 1M meters skewed", readings, count);
+    create_readings(readings, count, 1000000, 0);
+    run_updates("updates, 1M meters uniform", readings, count);
+    // Both trackers per reading, i.e., two updates each
+    static usage_heavy_hitters hitters;
+    initialise_usage_heavy_hitters(&hitters);
+    create_readings(readings, count, 1000000, 1);
+    const double start = get_seconds();
+    add_readings_to_heavy_hitters(&hitters, readings, count);
+    report_rate("readings, 1M meters skewed", count, get_seconds() - start);
+    free(readings);
+    return EXIT_SUCCESS;
+}
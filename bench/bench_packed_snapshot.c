@@ -0,0 +1,107 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "packed_snapshot.h"
+#include "energy_monitor.h"
+
+// 10M readings, 480MB as usage_snapshot and 200MB packed
+#define DEFAULT_READING_COUNT 10000000
+#define BASE_TIMESTAMP UINT64_C(1717372800)
+#define SCAN_REPEATS 5
+
+static void create_snapshots(usage_snapshot* snapshots, const size_t count)
+{
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < count; ++i)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        snapshots[i].timestamp = BASE_TIMESTAMP + i * 10;
+        snapshots[i].electric_usage = (double) (state % 5000000) / PACKED_SNAPSHOT_SCALE;
+        snapshots[i].electric_cost = snapshots[i].electric_usage * 0.3;
+        snapshots[i].gas_usage = (double) ((state >> 24) % 5000000) / PACKED_SNAPSHOT_SCALE;
+        snapshots[i].gas_cost = snapshots[i].gas_usage * 0.07;
+        snapshots[i].status = 15;
+    }
+}
+
+/**
+ * @brief Sequential scan summing electric_usage, the memory bound case packing targets.
+ */
+static double scan_snapshots(const usage_snapshot* snapshots, const size_t count)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i)
+        sum += snapshots[i].electric_usage;
+    return sum;
+}
+
+static double scan_packed(const packed_usage_snapshot* packed, const size_t count)
+{
+    int64_t sum = 0;
+    for (size_t i = 0; i < count; ++i)
+        sum += packed[i].electric_usage;
+    return (double) sum / PACKED_SNAPSHOT_SCALE;
+}
+
+int main(int argc, char** argv)
+{
+    // Counts past the 28 bit offset range at 10 second steps would need several blocks
+    size_t count = get_bench_size(argc, argv, DEFAULT_READING_COUNT);
+    if (PACKED_SNAPSHOT_MAX_OFFSET / 10 < count)
+        count = PACKED_SNAPSHOT_MAX_OFFSET / 10;
+    usage_snapshot* snapshots = malloc(count * sizeof(usage_snapshot));
+    packed_usage_snapshot* packed = malloc(count * sizeof(packed_usage_snapshot));
+    if (NULL == snapshots || NULL == packed)
+    {
+        fprintf(stderr, "Allocation for %zu readings failed.\n", count);
+        return EXIT_FAILURE;
+    }
+    create_snapshots(snapshots, count);
+    // Touch the output so page faults are not timed
+    memset(packed, 0, count * sizeof(packed_usage_snapshot));
+    double start = get_seconds();
+    pack_error error = PACK_OK;
+    const size_t packed_count = pack_snapshots(snapshots, count, BASE_TIMESTAMP, packed, &error);
+    report_rate("pack_snapshots", packed_count, get_seconds() - start);
+    if (count != packed_count || PACK_OK != error)
+    {
+        fprintf(stderr, "Packing stopped at %zu, error %d.\n", packed_count, (int) error);
+        return EXIT_FAILURE;
+    }
+    start = get_seconds();
+    unpack_snapshots(packed, count, BASE_TIMESTAMP, snapshots);
+    report_rate("unpack_snapshots", count, get_seconds() - start);
+    // Best of several scans, the first may still fault pages in
+    double full_seconds = 1e30;
+    double packed_seconds = 1e30;
+    double full_sum = 0.0;
+    double packed_sum = 0.0;
+    for (int repeat = 0; repeat < SCAN_REPEATS; ++repeat)
+    {
+        start = get_seconds();
+        full_sum = scan_snapshots(snapshots, count);
+        const double full = get_seconds() - start;
+        start = get_seconds();
+        packed_sum = scan_packed(packed, count);
+        const double compact = get_seconds() - start;
+        full_seconds = (full < full_seconds) ? full : full_seconds;
+        packed_seconds = (compact < packed_seconds) ? compact : packed_seconds;
+    }
+    report_rate("scan usage_snapshot", count, full_seconds);
+    report_rate("scan packed_usage_snapshot", count, packed_seconds);
+    printf("%-32s %zu -> %zu bytes per reading, %.1f -> %.1f MB, scan speedup %.2fx, "
+            "sums %.3f %.3f\n", "", sizeof(usage_snapshot), sizeof(packed_usage_snapshot),
+            (double) (count * sizeof(usage_snapshot)) / 1e6,
+            (double) (count * sizeof(packed_usage_snapshot)) / 1e6,
+            full_seconds / packed_seconds, full_sum, packed_sum);
+    free(snapshots);
+    free(packed);
+    return EXIT_SUCCESS;
+}
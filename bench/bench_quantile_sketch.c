@@ -0,0 +1,78 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "quantile_sketch.h"
+
+#define DEFAULT_VALUE_COUNT 10000000
+
+static double next_uniform(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (double) (*state >> 11) / 9007199254740992.0;
+}
+
+static int compare_values(const void* left, const void* right)
+{
+    const double left_value = *(const double*) left;
+    const double right_value = *(const double*) right;
+    return (left_value > right_value) - (left_value < right_value);
+}
+
+/**
+ * @brief Sketch count log-uniform values spread over a factor of e^log_span and compare the
+ * quantiles with the exact ones, the memory of each is reported.
+ */
+static void measure_accuracy(double* values, const size_t count, const double log_span)
+{
+    static const double quantiles[] = {0.01, 0.1, 0.5, 0.9, 0.99, 0.999};
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < count; ++i)
+        values[i] = 0.01 * exp(log_span * next_uniform(&state));
+    quantile_sketch sketch;
+    initialise_quantile_sketch(&sketch);
+    const double start = get_seconds();
+    for (size_t i = 0; i < count; ++i)
+        add_to_quantile_sketch(&sketch, values[i]);
+    const double seconds = get_seconds() - start;
+    qsort(values, count, sizeof(double), compare_values);
+    printf("%10zu %8.1e %10zu %12zu %6.1f", count, exp(log_span), sizeof(quantile_sketch),
+            count * sizeof(double), (double) count / seconds / 1e6);
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+    {
+        const double exact = values[(size_t) (quantiles[i] * (double) (count - 1))];
+        printf(" %7.4f", fabs(get_quantile(&sketch, quantiles[i]) - exact) / exact);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    const size_t count = get_bench_size(argc, argv, DEFAULT_VALUE_COUNT);
+    double* values = malloc(count * sizeof(double));
+    if (NULL == values)
+    {
+        fprintf(stderr, "Allocation for %zu values failed.\n", count);
+        return EXIT_FAILURE;
+    }
+    printf("Relative error of the sketch against exact quantiles, accuracy %.2f\n",
+            QUANTILE_SKETCH_ACCURACY);
+    printf("%10s %8s %10s %12s %6s %7s %7s %7s %7s %7s %7s\n", "values", "span", "sketch B",
+            "exact B", "M/s", "p1", "p10", "p50", "p90", "p99", "p99.9");
+    // Memory against the count of values, over a span the window holds
+    for (size_t values_count = 1000; values_count < count; values_count *= 10)
+        measure_accuracy(values, values_count, 5.0);
+    measure_accuracy(values, count, 5.0);
+    // Accuracy against the span of the values, low quantiles collapse past a factor of ~6e17
+    const double log_spans[] = {1.0, 5.0, 10.0, 20.0, 40.0, 45.0};
+    for (size_t i = 0; i < sizeof(log_spans) / sizeof(log_spans[0]); ++i)
+        measure_accuracy(values, (count < 1000000) ? count : 1000000, log_spans[i]);
+    free(values);
+    return EXIT_SUCCESS;
+}
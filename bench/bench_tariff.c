@@ -0,0 +1,65 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "tariff.h"
+#include "energy_monitor.h"
+
+// A year of per-second readings
+#define DEFAULT_READING_COUNT 31536000
+
+int main(int argc, char** argv)
+{
+    const size_t count = get_bench_size(argc, argv, DEFAULT_READING_COUNT);
+    const double electric_unit_rate[TARIFF_BAND_COUNT] = {0.15, 0.30};
+    const double gas_unit_rate[TARIFF_BAND_COUNT] = {0.05, 0.07};
+    tariff tariff_table;
+    initialise_tariff(&tariff_table, electric_unit_rate, gas_unit_rate, 0.50, 0.30, 3600);
+    set_tariff_band(&tariff_table, PEAK, 16 * 3600, 19 * 3600);
+    usage_snapshot* snapshots = malloc(count * sizeof(usage_snapshot));
+    uint64_t* timestamps = malloc(count * sizeof(uint64_t));
+    double* usage = malloc(4 * count * sizeof(double));
+    if (NULL == snapshots || NULL == timestamps || NULL == usage)
+    {
+        fprintf(stderr, "Allocation for %zu readings failed.\n", count);
+        return EXIT_FAILURE;
+    }
+    double* electric_usage = usage;
+    double* gas_usage = usage + count;
+    double* electric_cost = usage + 2 * count;
+    double* gas_cost = usage + 3 * count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        timestamps[i] = UINT64_C(1704067200) + i;
+        electric_usage[i] = 0.001 * (double) (i % 1000);
+        gas_usage[i] = 0.002 * (double) (i % 500);
+        // Touch the outputs so page faults are not timed
+        electric_cost[i] = 0.0;
+        gas_cost[i] = 0.0;
+        const usage_snapshot snapshot = {timestamps[i], electric_usage[i], 0.0, gas_usage[i], 0.0,
+                (uint8_t) ((0 == i % 97) ? bitmask_gas_usage : 15)};
+        snapshots[i] = snapshot;
+    }
+    double start = get_seconds();
+    price_snapshots(&tariff_table, snapshots, count);
+    report_rate("price_snapshots", count, get_seconds() - start);
+    start = get_seconds();
+    price_usage(&tariff_table, timestamps, electric_usage, gas_usage, electric_cost, gas_cost,
+            count);
+    report_rate("price_usage", count, get_seconds() - start);
+    tariff_totals totals;
+    start = get_seconds();
+    compute_tariff_totals(&tariff_table, snapshots, count, &totals);
+    report_rate("compute_tariff_totals", count, get_seconds() - start);
+    // Print the results so the work is not optimised away
+    printf("electric %.2f gas %.2f days %llu check %.2f\n", totals.electric_energy_cost,
+            totals.gas_energy_cost, (unsigned long long) totals.days,
+            electric_cost[count - 1] + gas_cost[count / 2] + snapshots[count / 3].electric_cost);
+    free(snapshots);
+    free(timestamps);
+    free(usage);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,167 @@
+#ifndef ENERGYMONITOR_ANOMALY_DETECTOR_H_
+#define ENERGYMONITOR_ANOMALY_DETECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+#include "batch_queue.h"
+
+/**
+ * Constants
+ */
+// Alerts per batch, and batches in the pool, i.e., the bound on alerts awaiting a consumer
+#define ANOMALY_ALERT_BATCH_SIZE 256
+#define ANOMALY_ALERT_POOL_SIZE 64
+// Meter ID table capacity is a power of two, keeping the load at or below 3/4
+#define ANOMALY_METER_LOAD_NUMERATOR 3
+#define ANOMALY_METER_LOAD_DENOMINATOR 4
+
+/**
+ * @brief Enum defining the anomalies detected.
+ */
+typedef enum
+{
+    ELECTRIC_SPIKE = 0,
+    ELECTRIC_DROPOUT = 1,
+    GAS_SPIKE = 2,
+    GAS_DROPOUT = 3,
+    ELECTRIC_STATUS_CLEARED = 4,
+    GAS_STATUS_CLEARED = 5,
+    TIMESTAMP_GAP = 6,
+    TIMESTAMP_REGRESSION = 7
+} anomaly_type;
+
+/**
+ * @brief An anomaly of a reading.
+ * Notes:
+ * - Spikes and dropouts: value is the usage, expected the EWMA mean.
+ * - Gaps and regressions: value is the timestamp, expected the previous timestamp.
+ * - Cleared status bits: value and expected are 0.
+ */
+typedef struct
+{
+    uint64_t meter_id;
+    uint64_t timestamp;
+    anomaly_type type;
+    double value;
+    double expected;
+} anomaly_alert;
+
+/**
+ * @brief A batch of alerts, taken from and returned to the detector's pool.
+ */
+typedef struct
+{
+    size_t count;
+    anomaly_alert alerts[ANOMALY_ALERT_BATCH_SIZE];
+} anomaly_alert_batch;
+
+/**
+ * @brief Detection configuration.
+ * Notes:
+ * - A usage value is anomalous when (value - mean)^2 > threshold^2 * (variance +
+ *   (deviation_floor * mean)^2 + min_variance), the floors stop steady meters alerting on noise.
+ * - No usage alerts are raised until a meter has warmup_readings values of a field.
+ * - A value raising an alert updates the mean and variance as a value at the threshold would,
+ *   so one spike does not hide the next, and a lasting change in usage stops alerting.
+ */
+typedef struct
+{
+    double alpha;
+    double threshold;
+    double deviation_floor;
+    double min_variance;
+    uint32_t warmup_readings;
+    uint64_t gap_seconds;
+} anomaly_config;
+
+/**
+ * @brief Streaming anomaly detector over a fleet of meters, O(1) per reading.
+ * Notes:
+ * - Meter IDs are any uint64_t, mapped to dense state indexes by an open addressing table in
+ *   order of first reading. Up to meter_count meters are tracked, readings of meters beyond
+ *   them are counted as rejected.
+ * - Per-meter state is structure-of-arrays, one array per field, indexed by dense index.
+ * - Only the thread calling detect_anomalies() updates the detector, alert batches are popped
+ *   and released by any thread through the lock-free queues.
+ * - Alerts are dropped and counted, never blocking detection, when the consumer falls behind
+ *   and the pool is exhausted.
+ */
+typedef struct
+{
+    anomaly_config config;
+    double threshold_squared;
+    double deviation_floor_squared;
+    size_t meter_count;
+    size_t tracked_count;
+    uint64_t* table_meter_ids;
+    uint32_t* table_indexes;
+    size_t table_mask;
+    unsigned int table_shift;
+    double* electric_mean;
+    double* electric_variance;
+    double* gas_mean;
+    double* gas_variance;
+    uint32_t* electric_count;
+    uint32_t* gas_count;
+    uint64_t* last_timestamp;
+    uint8_t* last_status;
+    anomaly_alert_batch* alert_pool;
+    anomaly_alert_batch* current_alerts;
+    batch_queue free_alerts;
+    batch_queue full_alerts;
+    uint64_t reading_count;
+    uint64_t alert_count;
+    uint64_t dropped_alert_count;
+    uint64_t rejected_count;
+} anomaly_detector;
+
+/**
+ * @brief Initialise a configuration with defaults: alpha 0.05, 5 sigma, a 5% deviation floor,
+ * 16 warm-up readings and a 300 second gap.
+ * @param config configuration to initialise.
+ */
+void initialise_anomaly_config(anomaly_config* config);
+
+/**
+ * @brief Initialise a detector with no history for any meter.
+ * @param detector detector to initialise.
+ * @param config detection configuration.
+ * @param meter_count number of meters tracked, 1 to UINT32_MAX - 1.
+ * @return 1 (true) if successful, 0 if the configuration is invalid or allocation failed.
+ */
+int initialise_anomaly_detector(anomaly_detector* detector, const anomaly_config* config,
+        const size_t meter_count);
+
+/**
+ * @brief Free a detector, alert batches held by a consumer must be released first.
+ * @param detector detector to free.
+ */
+void free_anomaly_detector(anomaly_detector* detector);
+
+/**
+ * @brief Check a batch of readings for anomalies and update the state of their meters.
+ * Alerts raised are queued before returning.
+ * @param detector detector to update.
+ * @param readings readings to check, in arrival order.
+ * @param count number of readings.
+ */
+void detect_anomalies(anomaly_detector* detector, const meter_reading* readings,
+        const size_t count);
+
+/**
+ * @brief Pop a batch of alerts without blocking.
+ * @param detector detector to pop from.
+ * @return the batch, NULL if no alerts are queued, release it when done.
+ */
+anomaly_alert_batch* pop_anomaly_alerts(anomaly_detector* detector);
+
+/**
+ * @brief Return a popped batch of alerts to the pool.
+ * @param detector detector the batch was popped from.
+ * @param batch batch to release.
+ */
+void release_anomaly_alerts(anomaly_detector* detector, anomaly_alert_batch* batch);
+
+#endif
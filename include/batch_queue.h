@@ -0,0 +1,75 @@
+#ifndef ENERGYMONITOR_BATCH_QUEUE_H_
+#define ENERGYMONITOR_BATCH_QUEUE_H_
+
+#include <stddef.h>
+
+/**
+ * Constants
+ */
+// Cache line size, used to keep producer and consumer positions apart
+#define CACHE_LINE_BYTES 64
+
+/**
+ * @brief A slot of the queue, its sequence tells producers and consumers whose turn it is.
+ */
+typedef struct
+{
+    size_t sequence;
+    void* batch;
+} batch_queue_cell;
+
+/**
+ * @brief Bounded lock-free multi-producer multi-consumer queue of batch pointers.
+ * Notes:
+ * - Capacity must be a power of two.
+ * - Positions are padded onto separate cache lines so producers and consumers do not
+ *   invalidate each other.
+ */
+typedef struct
+{
+    batch_queue_cell* cells;
+    size_t mask;
+    char padding_cells[CACHE_LINE_BYTES];
+    size_t enqueue_position;
+    char padding_enqueue[CACHE_LINE_BYTES];
+    size_t dequeue_position;
+    char padding_dequeue[CACHE_LINE_BYTES];
+} batch_queue;
+
+/**
+ * @brief Initialise a queue.
+ * @param queue queue to initialise.
+ * @param capacity number of batches the queue holds, a power of two.
+ * @return 1 (true) if successful, 0 if the capacity is invalid or allocation failed.
+ */
+int initialise_batch_queue(batch_queue* queue, const size_t capacity);
+
+/**
+ * @brief Release the storage of a queue, batches still queued are not freed.
+ * @param queue queue to release.
+ */
+void free_batch_queue(batch_queue* queue);
+
+/**
+ * @brief Push a batch without blocking.
+ * @param queue queue to push to.
+ * @param batch batch to push, must not be NULL.
+ * @return 1 (true) if pushed, 0 if the queue is full.
+ */
+int try_push_batch(batch_queue* queue, void* batch);
+
+/**
+ * @brief Pop a batch without blocking.
+ * @param queue queue to pop from.
+ * @return the batch, NULL if the queue is empty.
+ */
+void* try_pop_batch(batch_queue* queue);
+
+/**
+ * @brief Get the approximate number of batches queued.
+ * @param queue queue to inspect.
+ * @return number of batches, exact only when the queue is quiescent.
+ */
+size_t get_batch_queue_occupancy(const batch_queue* queue);
+
+#endif
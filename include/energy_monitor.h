@@ -10,10 +10,10 @@
 //
 // Constants
 //
-const int bitmask_electric_usage = 1;
-const int bitmask_electric_cost = 2;
-const int bitmask_gas_usage = 4;
-const int bitmask_gas_cost = 8;
+static const int bitmask_electric_usage = 1;
+static const int bitmask_electric_cost = 2;
+static const int bitmask_gas_usage = 4;
+static const int bitmask_gas_cost = 8;
 //
 // Enumerations
 //
@@ -39,4 +39,11 @@ typedef struct
     
 } usage_snapshot;
 
+typedef struct
+{
+    uint64_t meter_id;
+    usage_snapshot snapshot;
+
+} meter_reading;
+
 #endif
@@ -0,0 +1,112 @@
+#ifndef ENERGYMONITOR_HEAVY_HITTERS_H_
+#define ENERGYMONITOR_HEAVY_HITTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Meters tracked per tracker, a power of two, fixes the memory budget
+#define HEAVY_HITTER_CAPACITY 1024
+// Hash slots per tracker, twice the capacity keeps probe sequences short
+#define HEAVY_HITTER_SLOTS (2 * HEAVY_HITTER_CAPACITY)
+// Children per node of the counter heap
+#define HEAVY_HITTER_HEAP_ARITY 4
+// Top-K queries up to this K use a single insertion pass instead of a sort
+#define HEAVY_HITTER_SMALL_TOP 32
+// Marks an empty hash slot
+#define HEAVY_HITTER_EMPTY_SLOT UINT32_MAX
+
+/**
+ * @brief A tracked meter, its true weight is in the range weight - error to weight.
+ */
+typedef struct
+{
+    uint64_t meter_id;
+    double weight;
+    double error;
+    uint32_t slot;
+} heavy_hitter;
+
+/**
+ * @brief Weighted Space-Saving tracker of the heaviest meters, in fixed memory.
+ * Notes:
+ * - counters is a 4-ary min-heap on weight, so the lightest meter is replaced in O(log capacity).
+ * - slots is an open addressing hash table from meter ID to heap position.
+ * - Any meter with a true weight above total_weight / HEAVY_HITTER_CAPACITY is tracked.
+ */
+typedef struct
+{
+    heavy_hitter counters[HEAVY_HITTER_CAPACITY];
+    uint32_t slots[HEAVY_HITTER_SLOTS];
+    size_t size;
+    double total_weight;
+} heavy_hitter_tracker;
+
+/**
+ * @brief Heaviest electric and gas consumers.
+ */
+typedef struct
+{
+    heavy_hitter_tracker electric_usage;
+    heavy_hitter_tracker gas_usage;
+} usage_heavy_hitters;
+
+/**
+ * @brief Initialise an empty tracker.
+ * @param tracker tracker to initialise.
+ */
+void initialise_heavy_hitter_tracker(heavy_hitter_tracker* tracker);
+
+/**
+ * @brief Add weight to a meter, replacing the lightest meter when the tracker is full.
+ * @param tracker tracker to update.
+ * @param meter_id meter to add to.
+ * @param weight weight to add, values at or below zero are ignored.
+ */
+void add_heavy_hitter_weight(heavy_hitter_tracker* tracker, const uint64_t meter_id,
+        const double weight);
+
+/**
+ * @brief Get the heaviest meters, heaviest first.
+ * @param tracker tracker to query.
+ * @param top output meters, room for count items.
+ * @param count number of meters requested, the K of top-K.
+ * @return number of meters written, less than count when fewer are tracked.
+ */
+size_t get_top_heavy_hitters(const heavy_hitter_tracker* tracker, heavy_hitter* top,
+        const size_t count);
+
+/**
+ * @brief Get the most any tracked weight can overestimate its true weight.
+ * @param tracker tracker to query.
+ * @return the weight of the lightest meter when full, otherwise 0 as counts are exact.
+ */
+double get_heavy_hitter_error_bound(const heavy_hitter_tracker* tracker);
+
+/**
+ * @brief Initialise empty electric and gas trackers.
+ * @param hitters trackers to initialise.
+ */
+void initialise_usage_heavy_hitters(usage_heavy_hitters* hitters);
+
+/**
+ * @brief Add the usage of a reading, fields not flagged valid in status are skipped.
+ * @param hitters trackers to update.
+ * @param reading reading to add.
+ */
+void add_reading_to_heavy_hitters(usage_heavy_hitters* hitters, const meter_reading* reading);
+
+/**
+ * @brief Add the usage of an array of readings.
+ * @param hitters trackers to update.
+ * @param readings readings to add.
+ * @param count number of readings.
+ */
+void add_readings_to_heavy_hitters(usage_heavy_hitters* hitters, const meter_reading* readings,
+        const size_t count);
+
+#endif
@@ -1,5 +1,110 @@
 #ifndef ENERGYMONITOR_INGESTOR_H_
 #define ENERGYMONITOR_INGESTOR_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Longest number, in characters, accepted by the ingestor
+#define MAX_NUMBER_CHARACTERS 64
+// Longest key, in bytes after unescaping, matched by the ingestor, longer keys are skipped
+#define MAX_KEY_BYTES 64
+
+/**
+ * @brief Enum defining the per document result codes of the batch ingestor.
+ */
+typedef enum
+{
+    INGEST_OK = 0,
+    INGEST_EMPTY_DOCUMENT = 1,
+    INGEST_SYNTAX_ERROR = 2,
+    INGEST_INVALID_STRING = 3,
+    INGEST_INVALID_NUMBER = 4,
+    INGEST_MISSING_TIMESTAMP = 5,
+    INGEST_MISSING_METER_ID = 6
+} ingest_error;
+
+/**
+ * @brief A single JSON document within a larger buffer, not NUL terminated.
+ */
+typedef struct
+{
+    const char* json;
+    size_t json_length;
+} json_document;
+
+/**
+ * @brief Parse a single usage_snapshot JSON document.
+ * Recognises timestamp, electric_usage, electric_cost, gas_usage, gas_cost and status_flags,
+ * other keys, including meter_id, are skipped.
+ * @param json Pointer to the start of the document.
+ * @param json_length Length of the document.
+ * @param snapshot Output snapshot, zeroed on error.
+ * @return INGEST_OK if successful, otherwise the error code.
+ * Notes:
+ * - When status_flags is absent, status flags the usage and cost fields present.
+ * - Nothing is logged or allocated, errors are reported through the return code only.
+ */
+ingest_error parse_usage_document(const char* json, size_t json_length,
+        usage_snapshot* snapshot);
+
+/**
+ * @brief Parse a single meter_reading JSON document, i.e., a usage_snapshot with a meter_id.
+ * meter_id is an unsigned integer, quoted or not, and is required.
+ * @param json Pointer to the start of the document.
+ * @param json_length Length of the document.
+ * @param reading Output reading, zeroed on error.
+ * @return INGEST_OK if successful, INGEST_MISSING_METER_ID without a meter_id, otherwise the
+ * error code as for parse_usage_document().
+ */
+ingest_error parse_meter_reading_document(const char* json, size_t json_length,
+        meter_reading* reading);
+
+/**
+ * @brief Parse an array of usage_snapshot JSON documents.
+ * @param documents documents to parse.
+ * @param count number of documents.
+ * @param snapshots output snapshots, one per document, room for count items.
+ * @param errors output result codes, one per document, room for count items.
+ * @return number of documents parsed successfully.
+ */
+size_t parse_usage_documents(const json_document* documents, const size_t count,
+        usage_snapshot* snapshots, ingest_error* errors);
+
+/**
+ * @brief Parse newline delimited usage_snapshot JSON documents (NDJSON).
+ * Blank lines are skipped and produce no output.
+ * @param json Pointer to the start of the buffer.
+ * @param json_length Length of the buffer.
+ * @param snapshots output snapshots, one per document.
+ * @param errors output result codes, one per document.
+ * @param capacity room in snapshots and errors.
+ * @param bytes_consumed Set to the bytes of the buffer processed, less than json_length only
+ * when capacity is reached.
+ * @return number of documents written to snapshots and errors.
+ * Notes:
+ * - A final line without a trailing newline is parsed as a document, split streamed input on
+ *   newlines before calling.
+ */
+size_t parse_usage_ndjson(const char* json, size_t json_length, usage_snapshot* snapshots,
+        ingest_error* errors, const size_t capacity, size_t* bytes_consumed);
+
+/**
+ * @brief Parse newline delimited meter_reading JSON documents (NDJSON).
+ * As parse_usage_ndjson(), each document parsed by parse_meter_reading_document().
+ * @param json Pointer to the start of the buffer.
+ * @param json_length Length of the buffer.
+ * @param readings output readings, one per document.
+ * @param errors output result codes, one per document.
+ * @param capacity room in readings and errors.
+ * @param bytes_consumed Set to the bytes of the buffer processed.
+ * @return number of documents written to readings and errors.
+ */
+size_t parse_meter_reading_ndjson(const char* json, size_t json_length, meter_reading* readings,
+        ingest_error* errors, const size_t capacity, size_t* bytes_consumed);
 
 #endif
@@ -10,6 +10,10 @@
  */
 // Maximum memory 
 #define MAX_HEAP_BYTES 1000000
+// Stack buffer for decoding escaped strings
+#define STRING_BUFFER_BYTES 1024
+// Returned by parse_string() when the buffer ends before the closing quote
+#define JSON_STRING_UNTERMINATED SIZE_MAX
 
 /**
  * @brief Enum defining JSON item types.
@@ -131,6 +135,20 @@ int is_comma(const char ch);
  */
 int is_boolean(const char* json);
 
+/**
+ * @brief Performs lookahead to check for a JSON true literal.
+ * @param json Pointer to the current position in the buffer.
+ * @return 1 if "true" is found, 0 otherwise.
+ */
+int is_true(const char* json);
+
+/**
+ * @brief Performs lookahead to check for a JSON false literal.
+ * @param json Pointer to the current position in the buffer.
+ * @return 1 if "false" is found, 0 otherwise.
+ */
+int is_false(const char* json);
+
 /**
  * @brief Performs lookahead to check for a JSON null literal.
  * @param json Pointer to the current position in the buffer.
@@ -140,9 +158,11 @@ int is_null(const char* json);
 
 /**
  * @brief Consumes a string from the JSON buffer until the closing quote.
+ * Escape sequences are skipped, so an escaped quote does not end the string.
  * @param json Pointer starting after the opening quote.
  * @param json_length Remaining length of the buffer.
- * @return Remaining json_length after consuming the string content.
+ * @return Length of the string content, excluding the closing quote, or
+ * JSON_STRING_UNTERMINATED if the buffer ends before the closing quote.
  */
 size_t parse_string(const char* json, size_t json_length);
 
@@ -192,25 +212,70 @@ int is_begin_marker(const char ch);
 int is_end_marker(const char ch);
 
 /**
- * @brief Determines if a quote character is escaped by a preceding backslash.
- * @param json Pointer to the current quote in the JSON buffer.
- * @return 1 if the quote is escaped (e.g., \"), 0 if it is a literal/closing quote.
+ * @brief Checks if the character starts a JSON escape sequence.
+ * @param ch Character to check.
+ * @return 1 if '\\', 0 otherwise.
+ */
+int is_escape(const char ch);
+
+/**
+ * @brief Validates that a buffer holds well-formed UTF-8.
+ * Rejects overlong encodings, surrogates and code points above U+10FFFF.
+ * ASCII runs are checked a word (8 bytes) at a time.
+ * @param json Pointer to the start of the buffer.
+ * @param json_length Length of the buffer.
+ * @return 1 if valid UTF-8, 0 otherwise.
+ */
+int is_valid_utf8(const char* json, size_t json_length);
+
+/**
+ * @brief Checks for raw control characters (below 0x20), which RFC 8259 requires to be
+ * escaped inside strings. Checked a word (8 bytes) at a time.
+ * @param json Pointer to the start of the buffer.
+ * @param json_length Length of the buffer.
+ * @return 1 if a control character is found, 0 otherwise.
+ */
+int has_control_character(const char* json, size_t json_length);
+
+/**
+ * @brief Validates the content of a JSON string without decoding it, as decode_string() with
+ * a buffer large enough.
+ * @param json Pointer to the first byte after the opening quote.
+ * @param string_length Length of the string content, as returned by parse_string().
+ * @return 1 if the escapes, UTF-8 and characters are valid, 0 otherwise.
+ */
+int is_valid_string(const char* json, size_t string_length);
+
+/**
+ * @brief Decodes the content of a JSON string, i.e., the bytes between the quotes.
+ * Unescapes \", \\, \/, \b, \f, \n, \r, \t and \uXXXX (including surrogate pairs)
+ * and validates the result is UTF-8 with no raw control characters.
+ * @param json Pointer to the first byte after the opening quote.
+ * @param string_length Length of the string content, as returned by parse_string().
+ * @param buffer Caller or arena buffer used when the string contains escapes.
+ * @param buffer_length Length of the buffer, string_length bytes is always sufficient.
+ * @param decoded Set to the decoded string, points into json when there are no escapes.
+ * @param decoded_length Set to the length of the decoded string.
+ * @return 1 if successful, 0 for invalid escapes, invalid UTF-8 or a buffer too small.
  */
-int is_quote_with_escape_sequence(const char* json);
+int decode_string(const char* json, size_t string_length, char* buffer, size_t buffer_length,
+        const char** decoded, size_t* decoded_length);
 
 /**
  * @brief Identifies the token type at the current pointer and delegates to type-specific parsers.
  * Handles strings (including quote stripping), numbers, booleans, and nulls.
  * @param json Pointer to the current attribute/value.
  * @param json_length Remaining length of the buffer.
- * @return Updated remaining buffer length after processing the attribute.
+ * @return Updated remaining buffer length after processing the attribute, 0 if a string has
+ * no closing quote, i.e., the rest of the buffer is consumed.
  */
 size_t parse_attributes(const char* json, size_t json_length, json_item** current_item_address,
         size_t* allocated_count, size_t* used_count);
 
 /**
  * @brief Primary entry point for the linear JSON parser.
- * Iteratively parses attributes and advances the buffer pointer until the length is exhausted.
+ * Iteratively parses attributes and advances the buffer pointer until the length is exhausted,
+ * stops at a string with no closing quote.
  * @param json Pointer to the start of the JSON string.
  * @param json_length Total length of the JSON string.
  */
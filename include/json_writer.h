@@ -0,0 +1,107 @@
+#ifndef JSON_JSON_WRITER_H_
+#define JSON_JSON_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "json.h"
+
+/**
+ * Constants
+ */
+// Output chunk size, and chunks gathered into a single writev when all are full
+#define JSON_WRITER_CHUNK_BYTES 4096
+#define JSON_WRITER_CHUNKS 16
+// Escaped key cache, direct mapped on the key address
+#define JSON_WRITER_KEY_SLOTS 64
+#define JSON_WRITER_KEY_ARENA_BYTES 4096
+// Deepest nesting of containers
+#define JSON_WRITER_MAX_DEPTH 64
+
+/**
+ * @brief A cached key, the quoted and escaped key and its ':' held in the key arena.
+ */
+typedef struct
+{
+    const char* key;
+    size_t key_length;
+    uint32_t offset;
+    uint32_t length;
+} json_writer_key;
+
+/**
+ * @brief Streaming JSON writer with fixed memory.
+ * Notes:
+ * - Output is copied into fixed-size chunks, flushed with a single writev when all chunks
+ *   are full, so documents of any size are written without one large buffer.
+ * - Keys are escaped once and cached by address, trees built from the same key strings, e.g.,
+ *   the records of an aggregate feed, copy the escaped key without rescanning it.
+ * - Nothing is allocated per value, a writer is a single allocation made by the caller.
+ * - A failed write is sticky, later calls return 0 until the writer is initialised again.
+ */
+typedef struct
+{
+    int fd;
+    int is_failed;
+    size_t chunk_count;
+    size_t chunk_length;
+    size_t depth;
+    uint8_t has_members[JSON_WRITER_MAX_DEPTH];
+    size_t key_arena_length;
+    json_writer_key keys[JSON_WRITER_KEY_SLOTS];
+    char key_arena[JSON_WRITER_KEY_ARENA_BYTES];
+    char chunks[JSON_WRITER_CHUNKS][JSON_WRITER_CHUNK_BYTES];
+} json_writer;
+
+/**
+ * @brief Initialise a writer.
+ * @param writer writer to initialise.
+ * @param fd output file descriptor.
+ */
+void initialise_json_writer(json_writer* writer, const int fd);
+
+/**
+ * @brief Write a json_object tree as a value.
+ * @param writer writer to use.
+ * @param object root of the tree.
+ * @return 1 (true) if successful, 0 if the tree is invalid or a write failed.
+ * Notes:
+ * - OBJECT: item holds size json_object members, containers are keyed by their name.
+ * - ARRAY: item holds size json_object elements.
+ * - ITEM: item holds size json_items, spliced into the enclosing container, as "key": value
+ *   members of an OBJECT or as values of an ARRAY; a root ITEM is written as an object.
+ * - STRING values are UTF-8 text and are escaped, INTEGER, FLOAT and BOOLEAN values are
+ *   JSON literals and are copied.
+ * - Inside an array begun with write_json_array_begin() the value is comma separated.
+ */
+int write_json_object(json_writer* writer, const json_object* object);
+
+/**
+ * @brief Begin an array, so large arrays are streamed element by element.
+ * @param writer writer to use.
+ * @return 1 (true) if successful, 0 if nested too deep or a write failed.
+ */
+int write_json_array_begin(json_writer* writer);
+
+/**
+ * @brief End the array begun last.
+ * @param writer writer to use.
+ * @return 1 (true) if successful, 0 if no array is open or a write failed.
+ */
+int write_json_array_end(json_writer* writer);
+
+/**
+ * @brief Write a newline, e.g., to end an NDJSON record.
+ * @param writer writer to use.
+ * @return 1 (true) if successful, 0 if a write failed.
+ */
+int write_json_newline(json_writer* writer);
+
+/**
+ * @brief Write out all buffered chunks.
+ * @param writer writer to flush.
+ * @return 1 (true) if successful, 0 if a write failed.
+ */
+int flush_json_writer(json_writer* writer);
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef ENERGYMONITOR_LOAD_GENERATOR_H_
+#define ENERGYMONITOR_LOAD_GENERATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Output buffered before a single write
+#define GENERATOR_BUFFER_BYTES (64 * 1024)
+// Readings held back to produce out-of-order output
+#define GENERATOR_DELAY_SLOTS 64
+// Longest NDJSON line produced
+#define GENERATOR_MAX_LINE_BYTES 256
+
+/**
+ * @brief Enum defining the stream formats produced and replayed.
+ */
+typedef enum
+{
+    FORMAT_NDJSON = 0,
+    FORMAT_BINARY = 1
+} stream_format;
+
+/**
+ * @brief Synthetic load configuration.
+ * Notes:
+ * - Readings are produced round robin over the meters, one reading per meter per interval.
+ * - target_rate of 0 produces readings as fast as possible.
+ * - malformed_rate applies to FORMAT_NDJSON only, binary records are always well formed.
+ */
+typedef struct
+{
+    uint64_t meter_count;
+    uint64_t reading_count;
+    uint64_t start_timestamp;
+    uint64_t interval_seconds;
+    double target_rate;
+    double jitter;
+    double out_of_order_rate;
+    double malformed_rate;
+    uint64_t seed;
+    stream_format format;
+} generator_config;
+
+/**
+ * @brief Statistics of a generate or replay run.
+ */
+typedef struct
+{
+    uint64_t readings;
+    uint64_t out_of_order;
+    uint64_t malformed;
+    uint64_t bytes;
+    double seconds;
+} generator_stats;
+
+/**
+ * @brief Initialise a configuration with defaults: 1000 meters, 1M readings, per minute
+ * readings from the main.c stub timestamp, 5% jitter, 0.1% out of order and malformed,
+ * NDJSON as fast as possible.
+ * @param config configuration to initialise.
+ */
+void initialise_generator_config(generator_config* config);
+
+/**
+ * @brief Open an output target.
+ * @param target "-" for stdout, "tcp:host:port" for a socket, otherwise a file path.
+ * @return file descriptor, -1 on failure.
+ * Notes:
+ * - Writes to a socket closed by the peer fail without raising SIGPIPE. A pipe closed by its
+ *   reader raises SIGPIPE, ignore it first so the write fails instead.
+ */
+int open_generator_output(const char* target);
+
+/**
+ * @brief Produce a synthetic stream with diurnal electric and gas usage curves.
+ * The stream is reproducible, the same configuration and seed produce the same bytes.
+ * @param config load configuration.
+ * @param output_fd output file descriptor.
+ * @param stats output statistics.
+ * @return 1 (true) if successful, 0 if a write failed.
+ */
+int generate_load(const generator_config* config, const int output_fd, generator_stats* stats);
+
+/**
+ * @brief Replay a captured stream, pacing readings by their original timestamps.
+ * Readings with a timestamp earlier than the last paced one, and malformed lines, are
+ * written immediately.
+ * @param capture_path path of the captured file.
+ * @param format format of the captured file, also the format written.
+ * @param speed replay speed, 1.0 is the original timing, 0 is as fast as possible.
+ * @param output_fd output file descriptor.
+ * @param stats output statistics.
+ * @return 1 (true) if successful, 0 if the capture could not be read or a write failed.
+ */
+int replay_capture(const char* capture_path, const stream_format format, const double speed,
+        const int output_fd, generator_stats* stats);
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef ENERGYMONITOR_METER_TOTALS_H_
+#define ENERGYMONITOR_METER_TOTALS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "energy_monitor.h"
+#include "segment_store.h"
+
+/**
+ * Constants
+ */
+// Checkpoint file magic, "EMTOT001"
+#define METER_TOTALS_MAGIC UINT64_C(0x313030544F544D45)
+#define METER_TOTALS_VERSION 2
+// Table capacity is grown to keep the load at or below 3/4
+#define METER_TOTALS_LOAD_NUMERATOR 3
+#define METER_TOTALS_LOAD_DENOMINATOR 4
+#define METER_TOTALS_MIN_CAPACITY 1024
+// Longest checkpoint path, leaves room for the temporary file suffix
+#define MAX_CHECKPOINT_PATH_CHARACTERS 512
+#define CHECKPOINT_TEMPORARY_SUFFIX ".tmp"
+
+/**
+ * @brief Running totals of a meter, a slot with a zero reading_count is empty.
+ */
+typedef struct
+{
+    uint64_t meter_id;
+    uint64_t reading_count;
+    uint64_t last_timestamp;
+    double electric_usage;
+    double electric_cost;
+    double gas_usage;
+    double gas_cost;
+} meter_total;
+
+/**
+ * @brief Header of the table, followed by capacity meter_total slots.
+ * Notes:
+ * - The header and slots are one contiguous region holding no pointers, so the region is
+ *   written to a checkpoint as is and mmap'ed back in place, with no deserialization pass.
+ * - position is the segment store position of the readings folded in, replay of raw readings
+ *   resumes from it with read_readings_from_position(). A timestamp is no resume point,
+ *   readings arrive out of order.
+ */
+typedef struct
+{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t slot_bytes;
+    uint64_t capacity;
+    uint64_t size;
+    store_position position;
+    uint64_t reserved[2];
+} meter_totals_header;
+
+/**
+ * @brief Open addressing hash table of the running totals of every meter.
+ * Notes:
+ * - A fresh table is calloc'ed, so empty slots cost nothing until touched.
+ * - A table loaded from a checkpoint is a private mapping of the file, slots are paged in on
+ *   first use and updates are copy-on-write, the checkpoint file is never modified.
+ */
+typedef struct
+{
+    meter_totals_header* header;
+    meter_total* slots;
+    size_t region_bytes;
+    int is_mapped;
+} meter_totals;
+
+/**
+ * @brief Periodic checkpoint writer.
+ * Notes:
+ * - A checkpoint is written by a forked child from its copy-on-write view of the table, so
+ *   ingest continues while the checkpoint is written.
+ * - The child writes to path with CHECKPOINT_TEMPORARY_SUFFIX, syncs, then renames over
+ *   path, so path always holds a complete checkpoint.
+ */
+typedef struct
+{
+    char path[MAX_CHECKPOINT_PATH_CHARACTERS];
+    char temporary_path[MAX_CHECKPOINT_PATH_CHARACTERS];
+    uint64_t interval_seconds;
+    time_t last_started;
+    pid_t pid;
+    uint64_t completed;
+    uint64_t failed;
+} checkpoint_writer;
+
+/**
+ * @brief Initialise an empty table.
+ * @param totals table to initialise.
+ * @param expected_meters meters expected, sizes the table to avoid growing.
+ * @return 1 (true) if successful, 0 if the allocation failed.
+ */
+int initialise_meter_totals(meter_totals* totals, const size_t expected_meters);
+
+/**
+ * @brief Load a table from a checkpoint, usable immediately.
+ * @param totals table to load.
+ * @param path checkpoint path.
+ * @return 1 (true) if successful, 0 if the checkpoint is missing or invalid.
+ * Notes:
+ * - Checkpoints are only valid on the architecture that wrote them.
+ * - A checkpoint whose size breaks the 3/4 load bound is invalid, as a full table has no
+ *   empty slot to end a probe.
+ */
+int load_meter_totals(meter_totals* totals, const char* path);
+
+/**
+ * @brief Free a table, unmapping a loaded checkpoint.
+ * @param totals table to free.
+ */
+void free_meter_totals(meter_totals* totals);
+
+/**
+ * @brief Add a reading to the totals of its meter, fields not flagged valid in status are
+ * skipped.
+ * @param totals table to update.
+ * @param reading reading to add.
+ * @return 1 (true) if successful, 0 if growing the table failed.
+ */
+int add_reading_to_meter_totals(meter_totals* totals, const meter_reading* reading);
+
+/**
+ * @brief Add an array of readings to the totals of their meters.
+ * @param totals table to update.
+ * @param readings readings to add.
+ * @param count number of readings.
+ * @return 1 (true) if successful, 0 if growing the table failed.
+ */
+int add_readings_to_meter_totals(meter_totals* totals, const meter_reading* readings,
+        const size_t count);
+
+/**
+ * @brief Record the store position of the readings folded in, checkpointed with the totals.
+ * @param totals table to update.
+ * @param position position after the last reading folded in, as get_segment_store_position()
+ * after appending and flushing those readings.
+ */
+void set_meter_totals_position(meter_totals* totals, const store_position* position);
+
+/**
+ * @brief Find the totals of a meter.
+ * @param totals table to query.
+ * @param meter_id meter to find.
+ * @return the totals, NULL if the meter has no readings.
+ */
+const meter_total* find_meter_total(const meter_totals* totals, const uint64_t meter_id);
+
+/**
+ * @brief Initialise a checkpoint writer.
+ * @param writer writer to initialise.
+ * @param path checkpoint path.
+ * @param interval_seconds seconds between checkpoints started by poll_checkpoint.
+ * @return 1 (true) if successful, 0 if the path is too long.
+ */
+int initialise_checkpoint_writer(checkpoint_writer* writer, const char* path,
+        const uint64_t interval_seconds);
+
+/**
+ * @brief Start writing a checkpoint in a forked child.
+ * @param writer writer to use.
+ * @param totals table to checkpoint, as of this call.
+ * @return 1 (true) if started, 0 if a checkpoint is in progress or the fork failed.
+ * Notes:
+ * - Call from the thread that updates the table, the child sees the table as of the fork.
+ */
+int start_checkpoint(checkpoint_writer* writer, const meter_totals* totals);
+
+/**
+ * @brief Reap a finished checkpoint, and start a new one when the interval has elapsed.
+ * Cheap enough to call after every batch.
+ * @param writer writer to use.
+ * @param totals table to checkpoint.
+ * @return 1 (true) if a checkpoint was started.
+ */
+int poll_checkpoint(checkpoint_writer* writer, const meter_totals* totals);
+
+/**
+ * @brief Wait for the checkpoint in progress, if any.
+ * @param writer writer to wait for.
+ * @return 1 (true) if no checkpoint was in progress or it completed, 0 if it failed.
+ */
+int finish_checkpoint(checkpoint_writer* writer);
+
+#endif
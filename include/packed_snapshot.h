@@ -0,0 +1,119 @@
+#ifndef ENERGYMONITOR_PACKED_SNAPSHOT_H_
+#define ENERGYMONITOR_PACKED_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Fixed-point scale of usage and cost values, i.e., resolution of 1e-6
+#define PACKED_SNAPSHOT_SCALE 1000000.0
+// Bits of the packed word holding the timestamp offset from the block base
+#define PACKED_SNAPSHOT_OFFSET_BITS 28
+// Largest timestamp offset representable, roughly 8.5 years
+#define PACKED_SNAPSHOT_MAX_OFFSET ((UINT32_C(1) << PACKED_SNAPSHOT_OFFSET_BITS) - 1)
+// Status bits packed above the timestamp offset
+#define PACKED_SNAPSHOT_STATUS_MASK 0x0F
+// Largest usage or cost magnitude representable, INT32_MAX / PACKED_SNAPSHOT_SCALE
+#define PACKED_SNAPSHOT_MAX_VALUE 2147.483647
+
+/**
+ * @brief Enum defining the result codes of packing a snapshot.
+ */
+typedef enum
+{
+    PACK_OK = 0,
+    PACK_TIMESTAMP_OUT_OF_RANGE = 1,
+    PACK_VALUE_OUT_OF_RANGE = 2
+} pack_error;
+
+/**
+ * @brief Compact usage_snapshot, 20 bytes against 48 for the full struct.
+ * Notes:
+ * - offset_and_status holds the timestamp offset from the block base in the low 28 bits
+ *   and the four status bits in the high 4 bits.
+ * - Usage and cost are signed fixed-point with a resolution of 1 / PACKED_SNAPSHOT_SCALE,
+ *   limited to -2147.483648 to +2147.483647 (PACKED_SNAPSHOT_MAX_VALUE) per reading.
+ */
+typedef struct
+{
+    uint32_t offset_and_status;
+    int32_t electric_usage;
+    int32_t electric_cost;
+    int32_t gas_usage;
+    int32_t gas_cost;
+} packed_usage_snapshot;
+
+/**
+ * @brief Get the timestamp offset of a packed snapshot from its block base.
+ * @param packed packed snapshot.
+ * @return offset in seconds.
+ */
+static inline uint32_t get_packed_offset(const packed_usage_snapshot* packed)
+{
+    return packed->offset_and_status & PACKED_SNAPSHOT_MAX_OFFSET;
+}
+
+/**
+ * @brief Get the status bits of a packed snapshot.
+ * @param packed packed snapshot.
+ * @return status bits, as in usage_snapshot.
+ */
+static inline uint8_t get_packed_status(const packed_usage_snapshot* packed)
+{
+    return (uint8_t) (packed->offset_and_status >> PACKED_SNAPSHOT_OFFSET_BITS);
+}
+
+/**
+ * @brief Pack a snapshot relative to a block base timestamp.
+ * @param snapshot snapshot to pack.
+ * @param base_timestamp base timestamp of the block.
+ * @param packed output packed snapshot.
+ * @return PACK_OK if successful, PACK_TIMESTAMP_OUT_OF_RANGE if the timestamp is before the base
+ * or more than PACKED_SNAPSHOT_MAX_OFFSET after it, PACK_VALUE_OUT_OF_RANGE if a usage or cost
+ * is beyond +/-PACKED_SNAPSHOT_MAX_VALUE or not a number.
+ * Notes:
+ * - Values are rounded to the nearest 1 / PACKED_SNAPSHOT_SCALE.
+ * - Status bits above PACKED_SNAPSHOT_STATUS_MASK are dropped.
+ */
+pack_error pack_snapshot(const usage_snapshot* snapshot, const uint64_t base_timestamp,
+        packed_usage_snapshot* packed);
+
+/**
+ * @brief Unpack a snapshot relative to a block base timestamp.
+ * @param packed packed snapshot.
+ * @param base_timestamp base timestamp of the block.
+ * @param snapshot output snapshot.
+ */
+void unpack_snapshot(const packed_usage_snapshot* packed, const uint64_t base_timestamp,
+        usage_snapshot* snapshot);
+
+/**
+ * @brief Pack an array of snapshots relative to a block base timestamp.
+ * @param snapshots snapshots to pack.
+ * @param count number of snapshots.
+ * @param base_timestamp base timestamp of the block.
+ * @param packed output packed snapshots, room for count items.
+ * @param error output result of the snapshot packing stopped at, PACK_OK if all were packed.
+ * @return number of snapshots packed, stops at the first snapshot that cannot be packed.
+ * Notes:
+ * - On PACK_TIMESTAMP_OUT_OF_RANGE the remaining snapshots need a new block base.
+ * - On PACK_VALUE_OUT_OF_RANGE no block base helps, the snapshot cannot be packed at all.
+ */
+size_t pack_snapshots(const usage_snapshot* snapshots, const size_t count,
+        const uint64_t base_timestamp, packed_usage_snapshot* packed, pack_error* error);
+
+/**
+ * @brief Unpack an array of snapshots relative to a block base timestamp.
+ * @param packed packed snapshots.
+ * @param count number of snapshots.
+ * @param base_timestamp base timestamp of the block.
+ * @param snapshots output snapshots, room for count items.
+ */
+void unpack_snapshots(const packed_usage_snapshot* packed, const size_t count,
+        const uint64_t base_timestamp, usage_snapshot* snapshots);
+
+#endif
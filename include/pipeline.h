@@ -0,0 +1,132 @@
+#ifndef ENERGYMONITOR_PIPELINE_H_
+#define ENERGYMONITOR_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+#include "ingestor.h"
+
+/**
+ * Constants
+ */
+// Bytes of NDJSON read per raw chunk
+#define PIPELINE_CHUNK_BYTES (64 * 1024)
+// Snapshots per parsed batch
+#define PIPELINE_BATCH_SNAPSHOTS 1024
+// Chunks and batches in flight, a power of two, bounds pipeline memory.
+// Each reader holds one more chunk, which it fills, so the chunk pool is input count larger.
+#define PIPELINE_POOL_SIZE 64
+// Most threads per stage
+#define MAX_STAGE_THREADS 64
+// Yields of a waiting thread before it blocks until woken
+#define PIPELINE_SPIN_WAITS 64
+
+/**
+ * @brief A batch of parsed snapshots handed to the sink stage.
+ */
+typedef struct
+{
+    usage_snapshot snapshots[PIPELINE_BATCH_SNAPSHOTS];
+    ingest_error errors[PIPELINE_BATCH_SNAPSHOTS];
+    size_t count;
+} snapshot_batch;
+
+/**
+ * @brief A batch of parsed meter readings handed to the sink stage.
+ */
+typedef struct
+{
+    meter_reading readings[PIPELINE_BATCH_SNAPSHOTS];
+    ingest_error errors[PIPELINE_BATCH_SNAPSHOTS];
+    size_t count;
+} meter_reading_batch;
+
+/**
+ * @brief Sink stage callback, called from the sink threads once per batch.
+ * The batch is recycled on return, so it must not be retained.
+ */
+typedef void (*snapshot_batch_consumer)(const snapshot_batch* batch, void* context);
+
+/**
+ * @brief Sink stage callback of meter readings, as snapshot_batch_consumer.
+ */
+typedef void (*meter_reading_batch_consumer)(const meter_reading_batch* batch, void* context);
+
+/**
+ * @brief Pipeline configuration, one reader thread per input descriptor.
+ * Notes:
+ * - Exactly one of consumer and reading_consumer is set. With consumer, lines are parsed as
+ *   usage_snapshots and meter_id is skipped. With reading_consumer, lines are parsed as
+ *   meter_readings and a line without a meter_id is a parse error.
+ */
+typedef struct
+{
+    const int* input_fds;
+    size_t input_count;
+    size_t parser_count;
+    size_t sink_count;
+    snapshot_batch_consumer consumer;
+    void* consumer_context;
+    meter_reading_batch_consumer reading_consumer;
+} pipeline_config;
+
+/**
+ * @brief Statistics of a stage, summed over its threads.
+ * Notes:
+ * - records counts bytes for the reader stage and snapshots for the parser and sink stages.
+ * - stalls counts waits on a full downstream (no free chunk or batch), i.e., backpressure.
+ * - idle_waits counts waits on an empty upstream queue.
+ * - blocks counts the stalls and idle waits that outlasted PIPELINE_SPIN_WAITS yields and
+ *   blocked the thread until woken.
+ */
+typedef struct
+{
+    uint64_t batches;
+    uint64_t records;
+    uint64_t stalls;
+    uint64_t idle_waits;
+    uint64_t blocks;
+} stage_stats;
+
+/**
+ * @brief Statistics of an input queue, sampled on every pop.
+ */
+typedef struct
+{
+    uint64_t samples;
+    uint64_t occupancy_sum;
+    uint64_t max_occupancy;
+} queue_stats;
+
+/**
+ * @brief Statistics of a pipeline run.
+ */
+typedef struct
+{
+    stage_stats reader;
+    stage_stats parser;
+    stage_stats sink;
+    queue_stats chunk_queue;
+    queue_stats batch_queue;
+    uint64_t parse_errors;
+} pipeline_stats;
+
+/**
+ * @brief Run the reader, parser and sink stages until every input reaches end of file.
+ * Stages pass chunks and batches through bounded lock-free queues, drawn from fixed pools,
+ * so a slow stage stalls the stages upstream of it rather than growing memory.
+ * A waiting thread yields briefly then blocks, an idle stage does not hold a CPU.
+ * @param config pipeline configuration.
+ * @param stats output statistics.
+ * @return 1 (true) if successful, 0 if the configuration is invalid or setup failed.
+ */
+int run_pipeline(const pipeline_config* config, pipeline_stats* stats);
+
+/**
+ * @brief Log the statistics of a pipeline run at INFO.
+ * @param stats statistics to log.
+ */
+void log_pipeline_stats(const pipeline_stats* stats);
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef ENERGYMONITOR_QUANTILE_SKETCH_H_
+#define ENERGYMONITOR_QUANTILE_SKETCH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Relative accuracy of a quantile, while the values span fewer buckets than the sketch holds
+#define QUANTILE_SKETCH_ACCURACY 0.02
+// Buckets per sketch, i.e., fixed memory (8KB), spans values over a factor of about 6e17, e.g.
+// standby readings of 1e-9 kWh up to peaks of 6e8 kWh in one sketch
+#define QUANTILE_SKETCH_BUCKETS 1024
+// Values at or below this are counted as zero
+#define QUANTILE_SKETCH_MIN_VALUE 1e-9
+// Periods held by a windowed sketch
+#define QUANTILE_WINDOW_PERIODS 24
+
+/**
+ * @brief Mergeable quantile sketch with logarithmic buckets (DDSketch).
+ * Notes:
+ * - A value is counted in bucket ceil(log(value) / log(gamma)), with
+ *   gamma = (1 + accuracy) / (1 - accuracy), so any quantile is within the relative accuracy.
+ * - The buckets are a sliding window of QUANTILE_SKETCH_BUCKETS indexes ending at the highest
+ *   bucket, values below the window are collapsed into the lowest bucket, so memory is fixed
+ *   and the upper quantiles keep their accuracy. The window covers every value from
+ *   QUANTILE_SKETCH_MIN_VALUE up to about 6e8, so only values beyond that range, or more than
+ *   a factor of about 6e17 below the maximum, lose accuracy.
+ * - The window depends only on the values added, so sketches of parts of a stream, e.g. one
+ *   per thread, merged are equal to a sketch of the whole stream.
+ * - The sketch is flat and position independent, it can be copied between threads or sent
+ *   between processes as bytes and merged.
+ */
+typedef struct
+{
+    uint64_t count;
+    uint64_t zero_count;
+    double min;
+    double max;
+    double sum;
+    int32_t offset;
+    uint64_t counts[QUANTILE_SKETCH_BUCKETS];
+} quantile_sketch;
+
+/**
+ * @brief Quantile sketches of the usage fields of a meter, or of a fleet.
+ */
+typedef struct
+{
+    quantile_sketch electric_usage;
+    quantile_sketch gas_usage;
+} usage_sketch;
+
+/**
+ * @brief Usage sketches over a sliding window of QUANTILE_WINDOW_PERIODS periods.
+ */
+typedef struct
+{
+    uint64_t period_seconds;
+    uint64_t newest_period;
+    usage_sketch periods[QUANTILE_WINDOW_PERIODS];
+} windowed_usage_sketch;
+
+/**
+ * @brief Initialise an empty sketch.
+ * @param sketch sketch to initialise.
+ */
+void initialise_quantile_sketch(quantile_sketch* sketch);
+
+/**
+ * @brief Add a value to a sketch, O(1) amortized.
+ * @param sketch sketch to update.
+ * @param value value to add, negative values are counted as zero.
+ */
+void add_to_quantile_sketch(quantile_sketch* sketch, const double value);
+
+/**
+ * @brief Merge a sketch into another.
+ * @param sketch sketch to update.
+ * @param other sketch to merge from.
+ */
+void merge_quantile_sketch(quantile_sketch* sketch, const quantile_sketch* other);
+
+/**
+ * @brief Estimate a quantile.
+ * @param sketch sketch to query.
+ * @param quantile quantile in the range 0 to 1, e.g. 0.99.
+ * @return the estimated value, 0 if the sketch is empty.
+ */
+double get_quantile(const quantile_sketch* sketch, const double quantile);
+
+/**
+ * @brief Initialise empty usage sketches.
+ * @param sketch sketches to initialise.
+ */
+void initialise_usage_sketch(usage_sketch* sketch);
+
+/**
+ * @brief Add the usage of a snapshot, fields not flagged valid in status are skipped.
+ * @param sketch sketches to update.
+ * @param snapshot snapshot to add.
+ */
+void add_snapshot_to_usage_sketch(usage_sketch* sketch, const usage_snapshot* snapshot);
+
+/**
+ * @brief Merge usage sketches into another.
+ * @param sketch sketches to update.
+ * @param other sketches to merge from.
+ */
+void merge_usage_sketch(usage_sketch* sketch, const usage_sketch* other);
+
+/**
+ * @brief Initialise an empty windowed sketch.
+ * @param sketch sketch to initialise.
+ * @param period_seconds length of a period, the window covers QUANTILE_WINDOW_PERIODS periods.
+ */
+void initialise_windowed_usage_sketch(windowed_usage_sketch* sketch, const uint64_t period_seconds);
+
+/**
+ * @brief Add the usage of a snapshot to the period of its timestamp.
+ * A newer period expires the oldest, snapshots older than the window are dropped.
+ * @param sketch sketch to update.
+ * @param snapshot snapshot to add.
+ */
+void add_snapshot_to_windowed_usage_sketch(windowed_usage_sketch* sketch,
+        const usage_snapshot* snapshot);
+
+/**
+ * @brief Merge the periods of the window into a single usage sketch.
+ * @param sketch windowed sketch to query.
+ * @param window output sketches covering the whole window.
+ */
+void get_windowed_usage_sketch(const windowed_usage_sketch* sketch, usage_sketch* window);
+
+#endif
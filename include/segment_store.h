@@ -0,0 +1,165 @@
+#ifndef ENERGYMONITOR_SEGMENT_STORE_H_
+#define ENERGYMONITOR_SEGMENT_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Readings per sparse index entry, i.e., the unit read by a range query
+#define STORE_INDEX_INTERVAL 256
+// Readings buffered before a single batched write
+#define STORE_WRITE_BUFFER_READINGS 4096
+// Default segment size before rolling to a new segment
+#define STORE_DEFAULT_SEGMENT_BYTES (64 * 1024 * 1024)
+// Longest path of a segment file
+#define MAX_PATH_CHARACTERS 512
+// Longest store directory path, leaves room for the segment file name
+#define MAX_DIRECTORY_CHARACTERS (MAX_PATH_CHARACTERS - 64)
+// Returned by query_readings() and read_readings_from_position() when the store could not be
+// flushed or read
+#define STORE_QUERY_FAILED SIZE_MAX
+
+/**
+ * @brief Sparse index entry, the timestamp range of a block of STORE_INDEX_INTERVAL readings.
+ */
+typedef struct
+{
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    uint64_t offset;
+} segment_index_entry;
+
+/**
+ * @brief A segment, i.e., a data file of meter_readings and its sparse index.
+ * Notes:
+ * - Sealed segments use an index mmap'ed from their index file.
+ * - The active segment, the last one, holds its index on the heap until it is sealed.
+ */
+typedef struct
+{
+    uint64_t sequence;
+    uint64_t record_count;
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    const segment_index_entry* index;
+    size_t index_count;
+    size_t index_capacity;
+    void* mapping;
+    size_t mapping_length;
+} segment;
+
+/**
+ * @brief Position in a store, readings before it are written, e.g., a replay resume point.
+ * Notes:
+ * - Readings are stored in append order, so a position holds for out-of-order timestamps.
+ */
+typedef struct
+{
+    uint64_t sequence;
+    uint64_t record_count;
+} store_position;
+
+/**
+ * @brief Append-only store of meter_readings split into segment files.
+ * Notes:
+ * - A failed write rolls the active segment back to the last reading written in full.
+ * - When that rollback or a segment roll fails, the store is marked failed and refuses
+ *   further appends, reopening it recovers the segments on disk.
+ */
+typedef struct
+{
+    char directory[MAX_DIRECTORY_CHARACTERS];
+    size_t max_segment_bytes;
+    segment* segments;
+    size_t segment_count;
+    size_t segment_capacity;
+    int active_fd;
+    meter_reading* write_buffer;
+    size_t buffered_count;
+    int is_failed;
+} segment_store;
+
+/**
+ * @brief Open a store, creating the directory if required.
+ * Sealed segment indexes are mmap'ed, only the active segment is scanned to rebuild its
+ * index, so startup time is bounded by the segment size rather than the total data size.
+ * @param store store to open.
+ * @param directory directory holding the segment files.
+ * @param max_segment_bytes segment size that triggers a roll to a new segment.
+ * @return 1 (true) if successful, 0 otherwise.
+ */
+int open_segment_store(segment_store* store, const char* directory, size_t max_segment_bytes);
+
+/**
+ * @brief Append readings to the active segment, rolling segments at the size limit.
+ * Readings are buffered and written in batches of STORE_WRITE_BUFFER_READINGS.
+ * @param store open store.
+ * @param readings readings to append.
+ * @param count number of readings.
+ * @return 1 (true) if successful, 0 if a write failed or the store has failed.
+ * Notes:
+ * - On a failed write, the buffered readings, including those of earlier calls not yet
+ *   flushed, are discarded and the store holds only the readings written before them.
+ */
+int append_readings(segment_store* store, const meter_reading* readings, const size_t count);
+
+/**
+ * @brief Write any buffered readings to the active segment.
+ * @param store open store.
+ * @return 1 (true) if successful, 0 if the write failed, the buffered readings are then
+ * discarded, or the store has failed.
+ */
+int flush_segment_store(segment_store* store);
+
+/**
+ * @brief Get the position after the last reading written, buffered readings are excluded.
+ * @param store open store.
+ * @param position output position, the active segment and its readings written.
+ * @return 1 (true) if successful, 0 if the store has failed.
+ */
+int get_segment_store_position(const segment_store* store, store_position* position);
+
+/**
+ * @brief Find the readings of a meter with a timestamp in [from_timestamp, to_timestamp].
+ * Only segments, and blocks within them, whose timestamp range overlaps are read.
+ * @param store open store.
+ * @param meter_id meter to find.
+ * @param from_timestamp first timestamp, inclusive.
+ * @param to_timestamp last timestamp, inclusive.
+ * @param readings output readings, in the order stored.
+ * @param capacity room in readings.
+ * @return total number of matches, readings beyond capacity are counted but not written,
+ * STORE_QUERY_FAILED if buffered readings could not be flushed or a segment could not be read.
+ */
+size_t query_readings(segment_store* store, const uint64_t meter_id,
+        const uint64_t from_timestamp, const uint64_t to_timestamp, meter_reading* readings,
+        const size_t capacity);
+
+/**
+ * @brief Read readings in the order appended, from a position, e.g., to replay the readings
+ * written after a checkpoint.
+ * Call repeatedly with the updated position until it returns 0.
+ * @param store open store.
+ * @param position first reading to read, as get_segment_store_position() gives, updated to
+ * the position after the last reading read.
+ * @param readings output readings.
+ * @param capacity room in readings.
+ * @return number of readings read, 0 at the end of the store, STORE_QUERY_FAILED if buffered
+ * readings could not be flushed, the position is not in the store or a segment could not be
+ * read.
+ */
+size_t read_readings_from_position(segment_store* store, store_position* position,
+        meter_reading* readings, const size_t capacity);
+
+/**
+ * @brief Flush and close a store, releasing all memory and mappings.
+ * The active segment is left unsealed and is recovered by the next open.
+ * @param store store to close.
+ */
+void close_segment_store(segment_store* store);
+
+#endif
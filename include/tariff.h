@@ -0,0 +1,156 @@
+#ifndef ENERGYMONITOR_TARIFF_H_
+#define ENERGYMONITOR_TARIFF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "energy_monitor.h"
+
+/**
+ * Constants
+ */
+// Seconds in a day
+#define TARIFF_SECONDS_PER_DAY 86400
+// Width of a time-of-use slot, in seconds (half hourly)
+#define TARIFF_SLOT_SECONDS 1800
+// Number of time-of-use slots in a day
+#define TARIFF_SLOTS_PER_DAY (TARIFF_SECONDS_PER_DAY / TARIFF_SLOT_SECONDS)
+// Number of readings priced per block by the batched routines
+#define TARIFF_BATCH_SIZE 256
+
+/**
+ * @brief Enum defining the time-of-use bands of a tariff.
+ */
+typedef enum
+{
+    OFF_PEAK = 0,
+    PEAK = 1,
+    TARIFF_BAND_COUNT = 2
+} tariff_band;
+
+/**
+ * @brief Time-of-use tariff, unit rates per band and daily standing charges.
+ * Notes:
+ * - The per slot rate tables are derived from the band rates and slot bands, they
+ *   are maintained by initialise_tariff() and set_tariff_band(), do not modify directly.
+ * - utc_offset_seconds shifts the UTC timestamps into the local day of the tariff.
+ */
+typedef struct
+{
+    double electric_unit_rate[TARIFF_BAND_COUNT];
+    double gas_unit_rate[TARIFF_BAND_COUNT];
+    double electric_standing_charge;
+    double gas_standing_charge;
+    int32_t utc_offset_seconds;
+    uint8_t slot_band[TARIFF_SLOTS_PER_DAY];
+    double electric_slot_rate[TARIFF_SLOTS_PER_DAY];
+    double gas_slot_rate[TARIFF_SLOTS_PER_DAY];
+} tariff;
+
+/**
+ * @brief Cost totals over a range of readings, including standing charges.
+ */
+typedef struct
+{
+    double electric_energy_cost;
+    double gas_energy_cost;
+    double electric_standing_cost;
+    double gas_standing_cost;
+    uint64_t days;
+} tariff_totals;
+
+/**
+ * @brief Initialise a tariff with every slot in the OFF_PEAK band.
+ * @param tariff_table tariff to initialise.
+ * @param electric_unit_rate electric unit rates, indexed by tariff_band.
+ * @param gas_unit_rate gas unit rates, indexed by tariff_band.
+ * @param electric_standing_charge electric standing charge per day.
+ * @param gas_standing_charge gas standing charge per day.
+ * @param utc_offset_seconds offset of the tariff local time from UTC.
+ */
+void initialise_tariff(tariff* tariff_table, const double electric_unit_rate[TARIFF_BAND_COUNT],
+        const double gas_unit_rate[TARIFF_BAND_COUNT], const double electric_standing_charge,
+        const double gas_standing_charge, const int32_t utc_offset_seconds);
+
+/**
+ * @brief Assign a band to the slots covering [start_second, end_second) of the local day.
+ * @param tariff_table tariff to update.
+ * @param band band to assign.
+ * @param start_second first second of the day in the band, rounded down to a slot boundary.
+ * @param end_second second of the day the band ends, rounded up to a slot boundary.
+ * @return 1 (true) if successful, 0 if the band or the range is invalid.
+ * Notes:
+ * - A range with end_second before start_second wraps past midnight.
+ */
+int set_tariff_band(tariff* tariff_table, const tariff_band band, const uint32_t start_second,
+        const uint32_t end_second);
+
+/**
+ * @brief Get the time-of-use slot of a timestamp.
+ * @param tariff_table tariff defining the local day.
+ * @param timestamp UTC timestamp in seconds.
+ * @return slot index in the range 0 to TARIFF_SLOTS_PER_DAY - 1.
+ */
+static inline size_t get_tariff_slot(const tariff* tariff_table, const uint64_t timestamp)
+{
+    const uint64_t local_timestamp = timestamp + (uint64_t) (int64_t) tariff_table->utc_offset_seconds;
+    return (size_t) ((local_timestamp % TARIFF_SECONDS_PER_DAY) / TARIFF_SLOT_SECONDS);
+}
+
+/**
+ * @brief Get the local day number of a timestamp.
+ * @param tariff_table tariff defining the local day.
+ * @param timestamp UTC timestamp in seconds.
+ * @return days since the epoch in tariff local time.
+ */
+static inline uint64_t get_tariff_day(const tariff* tariff_table, const uint64_t timestamp)
+{
+    const uint64_t local_timestamp = timestamp + (uint64_t) (int64_t) tariff_table->utc_offset_seconds;
+    return local_timestamp / TARIFF_SECONDS_PER_DAY;
+}
+
+/**
+ * @brief Scalar reference pricing of a single reading.
+ * Sets electric_cost and gas_cost from the usage and the slot rates, a cost is only
+ * flagged valid in status when the corresponding usage is flagged valid.
+ * @param tariff_table tariff to price against.
+ * @param snapshot reading to price.
+ */
+void price_snapshot(const tariff* tariff_table, usage_snapshot* snapshot);
+
+/**
+ * @brief Pricing of an array of readings, same results as price_snapshot().
+ * @param tariff_table tariff to price against.
+ * @param snapshots readings to price.
+ * @param count number of readings.
+ */
+void price_snapshots(const tariff* tariff_table, usage_snapshot* snapshots, const size_t count);
+
+/**
+ * @brief Batched pricing of usage held as separate arrays (structure of arrays).
+ * The rate multiply runs over contiguous arrays and is vectorized by the compiler.
+ * The arrays must not overlap, and no status is applied, all usage is priced.
+ * @param tariff_table tariff to price against.
+ * @param timestamps UTC timestamps in seconds.
+ * @param electric_usage electric usage per reading.
+ * @param gas_usage gas usage per reading.
+ * @param electric_cost output electric cost per reading.
+ * @param gas_cost output gas cost per reading.
+ * @param count number of readings.
+ */
+void price_usage(const tariff* tariff_table, const uint64_t* restrict timestamps,
+        const double* restrict electric_usage, const double* restrict gas_usage,
+        double* restrict electric_cost, double* restrict gas_cost, const size_t count);
+
+/**
+ * @brief Compute the cost totals of an array of readings, without modifying them.
+ * @param tariff_table tariff to price against.
+ * @param snapshots readings, in any order.
+ * @param count number of readings.
+ * @param totals output totals, standing charges are applied once per local day from the
+ * first to the last reading, days without readings included.
+ */
+void compute_tariff_totals(const tariff* tariff_table, const usage_snapshot* snapshots,
+        const size_t count, tariff_totals* totals);
+
+#endif
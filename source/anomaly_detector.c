@@ -0,0 +1,256 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "anomaly_detector.h"
+#include "energy_monitor.h"
+#include "batch_queue.h"
+#include "log.h"
+
+/**
+ * @brief Queue the batch being filled for the consumer.
+ * The full queue holds the whole pool, so the push always succeeds.
+ */
+static void publish_alerts(anomaly_detector* detector)
+{
+    if (NULL == detector->current_alerts)
+        return;
+    try_push_batch(&detector->full_alerts, detector->current_alerts);
+    detector->current_alerts = NULL;
+}
+
+static void raise_alert(anomaly_detector* detector, const meter_reading* reading,
+        const anomaly_type type, const double value, const double expected)
+{
+    ++detector->alert_count;
+    if (NULL == detector->current_alerts)
+    {
+        detector->current_alerts = try_pop_batch(&detector->free_alerts);
+        if (NULL == detector->current_alerts)
+        {
+            ++detector->dropped_alert_count;
+            return;
+        }
+        detector->current_alerts->count = 0;
+    }
+    anomaly_alert* alert = detector->current_alerts->alerts + detector->current_alerts->count++;
+    alert->meter_id = reading->meter_id;
+    alert->timestamp = reading->snapshot.timestamp;
+    alert->type = type;
+    alert->value = value;
+    alert->expected = expected;
+    if (ANOMALY_ALERT_BATCH_SIZE == detector->current_alerts->count)
+        publish_alerts(detector);
+}
+
+/**
+ * @brief Check a usage value against the EWMA mean and variance of its meter, then update them.
+ * @param spike alert type of a spike, the dropout type follows it.
+ */
+static void check_usage(anomaly_detector* detector, const meter_reading* reading,
+        const double value, double* mean, double* variance, uint32_t* count,
+        const anomaly_type spike)
+{
+    const uint32_t seen = *count;
+    if (0 == seen)
+    {
+        *mean = value;
+        *variance = 0.0;
+        *count = 1;
+        return;
+    }
+    const double mean_value = *mean;
+    const double variance_value = *variance;
+    double difference = value - mean_value;
+    if (detector->config.warmup_readings <= seen)
+    {
+        // Squared comparison, no square root on the hot path
+        const double limit = detector->threshold_squared * (variance_value +
+                detector->deviation_floor_squared * mean_value * mean_value +
+                detector->config.min_variance);
+        if (difference * difference > limit)
+        {
+            raise_alert(detector, reading, (0.0 < difference) ? spike : spike + 1, value,
+                    mean_value);
+            // Folded in clamped to the limit, a spike barely moves the mean or variance so the
+            // next spike is still caught, while a lasting change in usage is learnt over time
+            difference = (0.0 < difference) ? sqrt(limit) : -sqrt(limit);
+        }
+    }
+    else
+        *count = seen + 1;
+    // Exponentially weighted mean and variance, O(1) and no history kept
+    const double increment = detector->config.alpha * difference;
+    *mean = mean_value + increment;
+    *variance = (1.0 - detector->config.alpha) * (variance_value + difference * increment);
+}
+
+/**
+ * @brief Find the dense index of a meter, assigning the next one to a new meter.
+ * @return 1 (true) if found or assigned, 0 if the meter is new and meter_count are tracked.
+ */
+static int find_meter_index(anomaly_detector* detector, const uint64_t meter_id, size_t* meter)
+{
+    // Fibonacci hashing, the top log2(capacity) bits select the home slot. Lower bits would
+    // drop the high bits of the ID, e.g. IDs k << 40 would share a few slots.
+    size_t slot = (size_t) ((meter_id * UINT64_C(0x9E3779B97F4A7C15)) >> detector->table_shift);
+    // Table indexes are one based, zero is an empty slot
+    while (0 != detector->table_indexes[slot])
+    {
+        if (meter_id == detector->table_meter_ids[slot])
+        {
+            *meter = detector->table_indexes[slot] - 1;
+            return 1;
+        }
+        slot = (slot + 1) & detector->table_mask;
+    }
+    if (detector->meter_count == detector->tracked_count)
+        return 0;
+    *meter = detector->tracked_count++;
+    detector->table_meter_ids[slot] = meter_id;
+    detector->table_indexes[slot] = (uint32_t) (*meter + 1);
+    return 1;
+}
+
+static void check_reading(anomaly_detector* detector, const meter_reading* reading,
+        const size_t meter)
+{
+    const usage_snapshot* snapshot = &reading->snapshot;
+    const uint64_t last_timestamp = detector->last_timestamp[meter];
+    if (0 != last_timestamp)
+    {
+        if (snapshot->timestamp < last_timestamp)
+            raise_alert(detector, reading, TIMESTAMP_REGRESSION, (double) snapshot->timestamp,
+                    (double) last_timestamp);
+        else if (snapshot->timestamp - last_timestamp > detector->config.gap_seconds)
+            raise_alert(detector, reading, TIMESTAMP_GAP, (double) snapshot->timestamp,
+                    (double) last_timestamp);
+    }
+    if (snapshot->timestamp > last_timestamp)
+        detector->last_timestamp[meter] = snapshot->timestamp;
+    const uint8_t last_status = detector->last_status[meter];
+    if (snapshot->status & bitmask_electric_usage)
+        check_usage(detector, reading, snapshot->electric_usage, detector->electric_mean + meter,
+                detector->electric_variance + meter, detector->electric_count + meter,
+                ELECTRIC_SPIKE);
+    else if (last_status & bitmask_electric_usage)
+        raise_alert(detector, reading, ELECTRIC_STATUS_CLEARED, 0.0, 0.0);
+    if (snapshot->status & bitmask_gas_usage)
+        check_usage(detector, reading, snapshot->gas_usage, detector->gas_mean + meter,
+                detector->gas_variance + meter, detector->gas_count + meter, GAS_SPIKE);
+    else if (last_status & bitmask_gas_usage)
+        raise_alert(detector, reading, GAS_STATUS_CLEARED, 0.0, 0.0);
+    detector->last_status[meter] = snapshot->status;
+}
+
+void initialise_anomaly_config(anomaly_config* config)
+{
+    config->alpha = 0.05;
+    config->threshold = 5.0;
+    config->deviation_floor = 0.05;
+    config->min_variance = 1e-12;
+    config->warmup_readings = 16;
+    config->gap_seconds = 300;
+}
+
+int initialise_anomaly_detector(anomaly_detector* detector, const anomaly_config* config,
+        const size_t meter_count)
+{
+    memset(detector, 0, sizeof(*detector));
+    if (0 == meter_count || UINT32_MAX <= meter_count ||
+            !(0.0 < config->alpha && 1.0 >= config->alpha) ||
+            !(0.0 < config->threshold))
+    {
+        LOG(ERROR, "Invalid anomaly configuration, alpha %f, threshold %f, meters %zu.\n",
+                config->alpha, config->threshold, meter_count);
+        return 0;
+    }
+    detector->config = *config;
+    detector->threshold_squared = config->threshold * config->threshold;
+    detector->deviation_floor_squared = config->deviation_floor * config->deviation_floor;
+    detector->meter_count = meter_count;
+    // At least two slots, so the hash shift is below 64
+    size_t table_capacity = 2;
+    detector->table_shift = 63;
+    while (table_capacity * ANOMALY_METER_LOAD_NUMERATOR <
+            meter_count * ANOMALY_METER_LOAD_DENOMINATOR)
+    {
+        table_capacity *= 2;
+        --detector->table_shift;
+    }
+    detector->table_mask = table_capacity - 1;
+    detector->table_meter_ids = malloc(table_capacity * sizeof(uint64_t));
+    detector->table_indexes = calloc(table_capacity, sizeof(uint32_t));
+    detector->electric_mean = calloc(meter_count, sizeof(double));
+    detector->electric_variance = calloc(meter_count, sizeof(double));
+    detector->gas_mean = calloc(meter_count, sizeof(double));
+    detector->gas_variance = calloc(meter_count, sizeof(double));
+    detector->electric_count = calloc(meter_count, sizeof(uint32_t));
+    detector->gas_count = calloc(meter_count, sizeof(uint32_t));
+    detector->last_timestamp = calloc(meter_count, sizeof(uint64_t));
+    detector->last_status = calloc(meter_count, sizeof(uint8_t));
+    detector->alert_pool = malloc(ANOMALY_ALERT_POOL_SIZE * sizeof(anomaly_alert_batch));
+    if (NULL == detector->table_meter_ids || NULL == detector->table_indexes ||
+            NULL == detector->electric_mean || NULL == detector->electric_variance ||
+            NULL == detector->gas_mean || NULL == detector->gas_variance ||
+            NULL == detector->electric_count || NULL == detector->gas_count ||
+            NULL == detector->last_timestamp || NULL == detector->last_status ||
+            NULL == detector->alert_pool ||
+            !initialise_batch_queue(&detector->free_alerts, ANOMALY_ALERT_POOL_SIZE) ||
+            !initialise_batch_queue(&detector->full_alerts, ANOMALY_ALERT_POOL_SIZE))
+    {
+        LOG(ERROR, "Anomaly detector allocation for %zu meters failed.\n", meter_count);
+        free_anomaly_detector(detector);
+        return 0;
+    }
+    for (size_t i = 0; i < ANOMALY_ALERT_POOL_SIZE; ++i)
+        try_push_batch(&detector->free_alerts, detector->alert_pool + i);
+    return 1;
+}
+
+void free_anomaly_detector(anomaly_detector* detector)
+{
+    free(detector->table_meter_ids);
+    free(detector->table_indexes);
+    free(detector->electric_mean);
+    free(detector->electric_variance);
+    free(detector->gas_mean);
+    free(detector->gas_variance);
+    free(detector->electric_count);
+    free(detector->gas_count);
+    free(detector->last_timestamp);
+    free(detector->last_status);
+    free(detector->alert_pool);
+    free_batch_queue(&detector->free_alerts);
+    free_batch_queue(&detector->full_alerts);
+    memset(detector, 0, sizeof(*detector));
+}
+
+void detect_anomalies(anomaly_detector* detector, const meter_reading* readings,
+        const size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        size_t meter = 0;
+        if (!find_meter_index(detector, readings[i].meter_id, &meter))
+        {
+            ++detector->rejected_count;
+            continue;
+        }
+        check_reading(detector, readings + i, meter);
+    }
+    detector->reading_count += count;
+    publish_alerts(detector);
+}
+
+anomaly_alert_batch* pop_anomaly_alerts(anomaly_detector* detector)
+{
+    return try_pop_batch(&detector->full_alerts);
+}
+
+void release_anomaly_alerts(anomaly_detector* detector, anomaly_alert_batch* batch)
+{
+    try_push_batch(&detector->free_alerts, batch);
+}
@@ -0,0 +1,101 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch_queue.h"
+#include "log.h"
+
+int initialise_batch_queue(batch_queue* queue, const size_t capacity)
+{
+    memset(queue, 0, sizeof(*queue));
+    if (2 > capacity || 0 != (capacity & (capacity - 1)))
+    {
+        LOG(ERROR, "Queue capacity %zu must be a power of two, at least 2.\n", capacity);
+        return 0;
+    }
+    queue->cells = malloc(sizeof(batch_queue_cell) * capacity);
+    if (NULL == queue->cells)
+    {
+        LOG(ERROR, "Queue allocation failed for %zu batches.\n", capacity);
+        return 0;
+    }
+    // Each cell starts free for the producer at its own position
+    for (size_t i = 0; i < capacity; ++i)
+    {
+        queue->cells[i].sequence = i;
+        queue->cells[i].batch = NULL;
+    }
+    queue->mask = capacity - 1;
+    return 1;
+}
+
+void free_batch_queue(batch_queue* queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+int try_push_batch(batch_queue* queue, void* batch)
+{
+    size_t position = __atomic_load_n(&queue->enqueue_position, __ATOMIC_RELAXED);
+    batch_queue_cell* cell = NULL;
+    for (;;)
+    {
+        cell = queue->cells + (position & queue->mask);
+        const size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        const intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+        // Cell free at this position, claim it
+        if (0 == difference)
+        {
+            if (__atomic_compare_exchange_n(&queue->enqueue_position, &position, position + 1,
+                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        // Cell still holds the batch from one lap ago, i.e., full
+        else if (0 > difference)
+            return 0;
+        // Another producer claimed the position, reload
+        else
+            position = __atomic_load_n(&queue->enqueue_position, __ATOMIC_RELAXED);
+    }
+    cell->batch = batch;
+    __atomic_store_n(&cell->sequence, position + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+void* try_pop_batch(batch_queue* queue)
+{
+    size_t position = __atomic_load_n(&queue->dequeue_position, __ATOMIC_RELAXED);
+    batch_queue_cell* cell = NULL;
+    for (;;)
+    {
+        cell = queue->cells + (position & queue->mask);
+        const size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        const intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+        // Cell published at this position, claim it
+        if (0 == difference)
+        {
+            if (__atomic_compare_exchange_n(&queue->dequeue_position, &position, position + 1,
+                        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        // Cell not yet published, i.e., empty
+        else if (0 > difference)
+            return NULL;
+        // Another consumer claimed the position, reload
+        else
+            position = __atomic_load_n(&queue->dequeue_position, __ATOMIC_RELAXED);
+    }
+    void* batch = cell->batch;
+    // Free the cell for the producer one lap ahead
+    __atomic_store_n(&cell->sequence, position + queue->mask + 1, __ATOMIC_RELEASE);
+    return batch;
+}
+
+size_t get_batch_queue_occupancy(const batch_queue* queue)
+{
+    const size_t dequeue_position = __atomic_load_n(&queue->dequeue_position, __ATOMIC_RELAXED);
+    const size_t enqueue_position = __atomic_load_n(&queue->enqueue_position, __ATOMIC_RELAXED);
+    return (enqueue_position > dequeue_position) ? enqueue_position - dequeue_position : 0;
+}
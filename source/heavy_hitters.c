@@ -0,0 +1,217 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heavy_hitters.h"
+#include "energy_monitor.h"
+
+static size_t get_home_slot(const uint64_t meter_id)
+{
+    // Fibonacci hashing, the top bits are well mixed
+    return (size_t) ((meter_id * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (HEAVY_HITTER_SLOTS - 1);
+}
+
+static size_t get_next_slot(const size_t slot)
+{
+    return (slot + 1) & (HEAVY_HITTER_SLOTS - 1);
+}
+
+/**
+ * @brief Find the hash slot of a meter, or the empty slot where it would be inserted.
+ */
+static size_t find_slot(const heavy_hitter_tracker* tracker, const uint64_t meter_id)
+{
+    size_t slot = get_home_slot(meter_id);
+    while (HEAVY_HITTER_EMPTY_SLOT != tracker->slots[slot] &&
+            meter_id != tracker->counters[tracker->slots[slot]].meter_id)
+        slot = get_next_slot(slot);
+    return slot;
+}
+
+/**
+ * @brief Remove a hash slot, shifting later entries of the probe sequence back into the gap.
+ */
+static void remove_slot(heavy_hitter_tracker* tracker, size_t gap)
+{
+    size_t slot = get_next_slot(gap);
+    while (HEAVY_HITTER_EMPTY_SLOT != tracker->slots[slot])
+    {
+        const uint32_t position = tracker->slots[slot];
+        const size_t home = get_home_slot(tracker->counters[position].meter_id);
+        // Move the entry back when the gap lies on its probe sequence
+        const size_t distance_to_slot = (slot - home) & (HEAVY_HITTER_SLOTS - 1);
+        const size_t distance_to_gap = (gap - home) & (HEAVY_HITTER_SLOTS - 1);
+        if (distance_to_gap < distance_to_slot)
+        {
+            tracker->slots[gap] = position;
+            tracker->counters[position].slot = (uint32_t) gap;
+            gap = slot;
+        }
+        slot = get_next_slot(slot);
+    }
+    tracker->slots[gap] = HEAVY_HITTER_EMPTY_SLOT;
+}
+
+/**
+ * @brief Place a counter at a heap position and point its hash slot at it.
+ */
+static void place_counter(heavy_hitter_tracker* tracker, const size_t position,
+        const heavy_hitter* counter)
+{
+    tracker->counters[position] = *counter;
+    tracker->slots[counter->slot] = (uint32_t) position;
+}
+
+/**
+ * @brief Restore the heap after the weight at position increased.
+ * The heap is HEAVY_HITTER_HEAP_ARITY-ary, halving the depth walked on every replacement.
+ */
+static void sift_down(heavy_hitter_tracker* tracker, size_t position)
+{
+    const heavy_hitter counter = tracker->counters[position];
+    for (;;)
+    {
+        const size_t first_child = HEAVY_HITTER_HEAP_ARITY * position + 1;
+        if (first_child >= tracker->size)
+            break;
+        const size_t last_child = (first_child + HEAVY_HITTER_HEAP_ARITY < tracker->size) ?
+                first_child + HEAVY_HITTER_HEAP_ARITY : tracker->size;
+        size_t lightest = first_child;
+        for (size_t child = first_child + 1; child < last_child; ++child)
+            if (tracker->counters[child].weight < tracker->counters[lightest].weight)
+                lightest = child;
+        if (counter.weight <= tracker->counters[lightest].weight)
+            break;
+        place_counter(tracker, position, tracker->counters + lightest);
+        position = lightest;
+    }
+    place_counter(tracker, position, &counter);
+}
+
+/**
+ * @brief Restore the heap after a counter was appended at position.
+ */
+static void sift_up(heavy_hitter_tracker* tracker, size_t position)
+{
+    const heavy_hitter counter = tracker->counters[position];
+    while (0 < position)
+    {
+        const size_t parent = (position - 1) / HEAVY_HITTER_HEAP_ARITY;
+        if (tracker->counters[parent].weight <= counter.weight)
+            break;
+        place_counter(tracker, position, tracker->counters + parent);
+        position = parent;
+    }
+    place_counter(tracker, position, &counter);
+}
+
+void initialise_heavy_hitter_tracker(heavy_hitter_tracker* tracker)
+{
+    tracker->size = 0;
+    tracker->total_weight = 0.0;
+    for (size_t i = 0; i < HEAVY_HITTER_SLOTS; ++i)
+        tracker->slots[i] = HEAVY_HITTER_EMPTY_SLOT;
+}
+
+void add_heavy_hitter_weight(heavy_hitter_tracker* tracker, const uint64_t meter_id,
+        const double weight)
+{
+    if (!(0.0 < weight))
+        return;
+    tracker->total_weight += weight;
+    const size_t slot = find_slot(tracker, meter_id);
+    // Tracked, increase in place
+    if (HEAVY_HITTER_EMPTY_SLOT != tracker->slots[slot])
+    {
+        const size_t position = tracker->slots[slot];
+        tracker->counters[position].weight += weight;
+        sift_down(tracker, position);
+        return;
+    }
+    // Room, track exactly
+    if (HEAVY_HITTER_CAPACITY > tracker->size)
+    {
+        const heavy_hitter counter = {meter_id, weight, 0.0, (uint32_t) slot};
+        tracker->counters[tracker->size] = counter;
+        tracker->slots[slot] = (uint32_t) tracker->size;
+        sift_up(tracker, tracker->size++);
+        return;
+    }
+    // Full, the new meter inherits the lightest weight as its error
+    const heavy_hitter lightest = tracker->counters[0];
+    remove_slot(tracker, lightest.slot);
+    const size_t new_slot = find_slot(tracker, meter_id);
+    const heavy_hitter counter = {meter_id, lightest.weight + weight, lightest.weight,
+            (uint32_t) new_slot};
+    place_counter(tracker, 0, &counter);
+    sift_down(tracker, 0);
+}
+
+static int compare_heavier_first(const void* left, const void* right)
+{
+    const double left_weight = ((const heavy_hitter*) left)->weight;
+    const double right_weight = ((const heavy_hitter*) right)->weight;
+    return (left_weight < right_weight) - (left_weight > right_weight);
+}
+
+size_t get_top_heavy_hitters(const heavy_hitter_tracker* tracker, heavy_hitter* top,
+        const size_t count)
+{
+    const size_t top_count = (count < tracker->size) ? count : tracker->size;
+    if (0 == top_count)
+        return 0;
+    // Large K, sort everything
+    if (HEAVY_HITTER_SMALL_TOP < top_count)
+    {
+        heavy_hitter sorted[HEAVY_HITTER_CAPACITY];
+        memcpy(sorted, tracker->counters, sizeof(heavy_hitter) * tracker->size);
+        qsort(sorted, tracker->size, sizeof(heavy_hitter), compare_heavier_first);
+        memcpy(top, sorted, sizeof(heavy_hitter) * top_count);
+        return top_count;
+    }
+    // Small K, one pass keeping the heaviest top_count in order by insertion
+    size_t kept = 0;
+    for (size_t i = 0; i < tracker->size; ++i)
+    {
+        const heavy_hitter* counter = tracker->counters + i;
+        if (kept == top_count && counter->weight <= top[kept - 1].weight)
+            continue;
+        size_t position = (kept < top_count) ? kept++ : kept - 1;
+        while (0 < position && top[position - 1].weight < counter->weight)
+        {
+            top[position] = top[position - 1];
+            --position;
+        }
+        top[position] = *counter;
+    }
+    return top_count;
+}
+
+double get_heavy_hitter_error_bound(const heavy_hitter_tracker* tracker)
+{
+    return (HEAVY_HITTER_CAPACITY == tracker->size) ? tracker->counters[0].weight : 0.0;
+}
+
+void initialise_usage_heavy_hitters(usage_heavy_hitters* hitters)
+{
+    initialise_heavy_hitter_tracker(&hitters->electric_usage);
+    initialise_heavy_hitter_tracker(&hitters->gas_usage);
+}
+
+void add_reading_to_heavy_hitters(usage_heavy_hitters* hitters, const meter_reading* reading)
+{
+    const usage_snapshot* snapshot = &reading->snapshot;
+    if (snapshot->status & bitmask_electric_usage)
+        add_heavy_hitter_weight(&hitters->electric_usage, reading->meter_id,
+                snapshot->electric_usage);
+    if (snapshot->status & bitmask_gas_usage)
+        add_heavy_hitter_weight(&hitters->gas_usage, reading->meter_id, snapshot->gas_usage);
+}
+
+void add_readings_to_heavy_hitters(usage_heavy_hitters* hitters, const meter_reading* readings,
+        const size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        add_reading_to_heavy_hitters(hitters, readings + i);
+}
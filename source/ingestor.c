@@ -1 +1,530 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
 #include "ingestor.h"
+#include "energy_monitor.h"
+#include "json.h"
+
+/**
+ * @brief Document cursor, local to a single parse so no global state is shared.
+ */
+typedef struct
+{
+    const char* json;
+    size_t json_length;
+    size_t position;
+} document_cursor;
+
+/**
+ * @brief Enum defining the usage_snapshot and meter_reading fields recognised by the ingestor.
+ */
+typedef enum
+{
+    FIELD_UNKNOWN = 0,
+    FIELD_METER_ID,
+    FIELD_TIMESTAMP,
+    FIELD_ELECTRIC_USAGE,
+    FIELD_ELECTRIC_COST,
+    FIELD_GAS_USAGE,
+    FIELD_GAS_COST,
+    FIELD_STATUS_FLAGS
+} snapshot_field;
+
+/**
+ * @brief Checks if the character is JSON whitespace.
+ * @param ch Character to check.
+ * @return 1 if space, tab, carriage return or newline.
+ */
+static int is_whitespace(const char ch)
+{
+    return is_space(ch) || '\t' == ch || '\r' == ch || '\n' == ch;
+}
+
+static void skip_whitespace(document_cursor* cursor)
+{
+    while (cursor->position < cursor->json_length &&
+            is_whitespace(cursor->json[cursor->position]))
+        ++cursor->position;
+}
+
+static int has_remaining(const document_cursor* cursor, const size_t length)
+{
+    return cursor->json_length - cursor->position >= length;
+}
+
+static char current_char(const document_cursor* cursor)
+{
+    return cursor->json[cursor->position];
+}
+
+/**
+ * @brief Map a decoded key to the snapshot field it names.
+ * @param key decoded key.
+ * @param key_length length of the key.
+ * @return the field, FIELD_UNKNOWN if the key is not recognised.
+ */
+static snapshot_field to_snapshot_field(const char* key, const size_t key_length)
+{
+    static const struct
+    {
+        const char* name;
+        size_t name_length;
+        snapshot_field field;
+    } fields[] =
+    {
+        {"meter_id", 8, FIELD_METER_ID},
+        {"timestamp", 9, FIELD_TIMESTAMP},
+        {"electric_usage", 14, FIELD_ELECTRIC_USAGE},
+        {"electric_cost", 13, FIELD_ELECTRIC_COST},
+        {"gas_usage", 9, FIELD_GAS_USAGE},
+        {"gas_cost", 8, FIELD_GAS_COST},
+        {"status_flags", 12, FIELD_STATUS_FLAGS},
+    };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+        if (fields[i].name_length == key_length && 0 == memcmp(fields[i].name, key, key_length))
+            return fields[i].field;
+    return FIELD_UNKNOWN;
+}
+
+/**
+ * @brief Consume a string token, the cursor must be at the opening quote.
+ * @param cursor document cursor.
+ * @param string Set to the raw string content.
+ * @param string_length Set to the raw string length.
+ * @return INGEST_OK if successful, INGEST_SYNTAX_ERROR if the closing quote is missing.
+ */
+static ingest_error consume_string(document_cursor* cursor, const char** string,
+        size_t* string_length)
+{
+    ++cursor->position;
+    *string = cursor->json + cursor->position;
+    *string_length = parse_string(*string, cursor->json_length - cursor->position);
+    if (JSON_STRING_UNTERMINATED == *string_length)
+        return INGEST_SYNTAX_ERROR;
+    // Past the content and the closing quote
+    cursor->position += *string_length + 1;
+    return INGEST_OK;
+}
+
+/**
+ * @brief Consume a nested object or array value, which the ingestor skips.
+ * @param cursor document cursor, at the opening bracket.
+ * @return INGEST_OK if successful, otherwise the error code.
+ */
+static ingest_error skip_container(document_cursor* cursor)
+{
+    size_t depth = 0;
+    while (has_remaining(cursor, 1))
+    {
+        const char ch = current_char(cursor);
+        if (is_quote(ch))
+        {
+            const char* string = NULL;
+            size_t string_length = 0;
+            if (INGEST_OK != consume_string(cursor, &string, &string_length))
+                return INGEST_SYNTAX_ERROR;
+            continue;
+        }
+        if (is_begin_marker(ch))
+            ++depth;
+        else if (is_end_marker(ch) && 0 == --depth)
+        {
+            ++cursor->position;
+            return INGEST_OK;
+        }
+        ++cursor->position;
+    }
+    return INGEST_SYNTAX_ERROR;
+}
+
+/**
+ * @brief Check a numeric token against the JSON number grammar,
+ * -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, which strtod alone does not enforce,
+ * e.g. it accepts 1., .5, 01 and +1.
+ * @param number Pointer to the number, not NUL terminated.
+ * @param number_length Length of the number.
+ * @return 1 (true) if the token is a JSON number.
+ */
+static int is_json_number(const char* number, const size_t number_length)
+{
+    size_t index = (0 < number_length && '-' == number[0]);
+    const size_t integer_start = index;
+    while (index < number_length && is_number(number[index]))
+        ++index;
+    // At least one integer digit, and no leading zero unless it is the only one
+    if (integer_start == index || ('0' == number[integer_start] && 1 < index - integer_start))
+        return 0;
+    if (index < number_length && '.' == number[index])
+    {
+        const size_t fraction_start = ++index;
+        while (index < number_length && is_number(number[index]))
+            ++index;
+        if (fraction_start == index)
+            return 0;
+    }
+    if (index < number_length && ('e' == number[index] || 'E' == number[index]))
+    {
+        ++index;
+        if (index < number_length && ('+' == number[index] || '-' == number[index]))
+            ++index;
+        const size_t exponent_start = index;
+        while (index < number_length && is_number(number[index]))
+            ++index;
+        if (exponent_start == index)
+            return 0;
+    }
+    return number_length == index;
+}
+
+/**
+ * @brief Convert a plain decimal, e.g. -3.1234500000, without strtod.
+ * Exact (correctly rounded) when the digits fit in 2^53 and there are at most 22
+ * fraction digits, as both the mantissa and the power of ten are then exact doubles.
+ * Tokens outside the JSON grammar, e.g. 1. or 01, are left to the slow path to reject.
+ * @param number Pointer to the number, not NUL terminated.
+ * @param number_length Length of the number.
+ * @param value Set to the converted value.
+ * @return 1 if converted, 0 if the number needs the strtod slow path.
+ */
+static int to_double_fast_path(const char* number, const size_t number_length, double* value)
+{
+    static const double powers_of_ten[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    size_t index = ('-' == number[0]);
+    const int is_negative = (int) index;
+    uint64_t mantissa = 0;
+    size_t digit_count = 0;
+    size_t fraction_digits = 0;
+    int has_point = 0;
+    for (; index < number_length; ++index)
+    {
+        const char ch = number[index];
+        if (is_number(ch))
+        {
+            mantissa = mantissa * 10 + (uint64_t) (ch - '0');
+            fraction_digits += (size_t) has_point;
+            // 15 digits always fit below 2^53
+            if (15 < ++digit_count)
+                return 0;
+        }
+        else if ('.' == ch && !has_point)
+            has_point = 1;
+        else
+            return 0;
+    }
+    const size_t integer_digits = digit_count - fraction_digits;
+    if (0 == integer_digits || (has_point && 0 == fraction_digits) || 22 < fraction_digits)
+        return 0;
+    // A leading zero must be the only integer digit
+    if ('0' == number[is_negative] && 1 < integer_digits)
+        return 0;
+    const double magnitude = (double) mantissa / powers_of_ten[fraction_digits];
+    *value = is_negative ? -magnitude : magnitude;
+    return 1;
+}
+
+/**
+ * @brief Convert a numeric token to a double.
+ * @param number Pointer to the number, not NUL terminated.
+ * @param number_length Length of the number.
+ * @param value Set to the converted value.
+ * @return INGEST_OK if successful, INGEST_INVALID_NUMBER otherwise.
+ */
+static ingest_error to_double(const char* number, const size_t number_length, double* value)
+{
+    if (0 < number_length && to_double_fast_path(number, number_length, value))
+        return INGEST_OK;
+    if (MAX_NUMBER_CHARACTERS <= number_length || !is_json_number(number, number_length))
+        return INGEST_INVALID_NUMBER;
+    char buffer[MAX_NUMBER_CHARACTERS];
+    memcpy(buffer, number, number_length);
+    buffer[number_length] = '\0';
+    char* end = NULL;
+    *value = strtod(buffer, &end);
+    return (buffer + number_length == end) ? INGEST_OK : INGEST_INVALID_NUMBER;
+}
+
+/**
+ * @brief Convert an unsigned integer token to a uint64_t.
+ * @param number Pointer to the digits, not NUL terminated.
+ * @param number_length Length of the number.
+ * @param value Set to the converted value.
+ * @return INGEST_OK if successful, INGEST_INVALID_NUMBER for non digits or overflow.
+ */
+static ingest_error to_unsigned(const char* number, const size_t number_length, uint64_t* value)
+{
+    // No leading zeros, as in the JSON grammar
+    if (0 == number_length || ('0' == number[0] && 1 < number_length))
+        return INGEST_INVALID_NUMBER;
+    uint64_t result = 0;
+    for (size_t i = 0; i < number_length; ++i)
+    {
+        if (!is_number(number[i]))
+            return INGEST_INVALID_NUMBER;
+        const uint64_t digit = (uint64_t) (number[i] - '0');
+        if ((UINT64_MAX - digit) / 10 < result)
+            return INGEST_INVALID_NUMBER;
+        result = result * 10 + digit;
+    }
+    *value = result;
+    return INGEST_OK;
+}
+
+/**
+ * @brief Consume a value and store it in the reading field it belongs to.
+ * @param cursor document cursor, at the first character of the value.
+ * @param field field the value belongs to.
+ * @param reading reading to update.
+ * @param present_bits updated with the status bit of a usage or cost field stored.
+ * @param has_status set to 1 when status_flags is stored.
+ * @return INGEST_OK if successful, otherwise the error code.
+ */
+static ingest_error consume_value(document_cursor* cursor, const snapshot_field field,
+        meter_reading* reading, int* present_bits, int* has_status)
+{
+    usage_snapshot* snapshot = &reading->snapshot;
+    const char ch = current_char(cursor);
+    const char* value = cursor->json + cursor->position;
+    size_t value_length = 0;
+    if (is_quote(ch))
+    {
+        ingest_error error = consume_string(cursor, &value, &value_length);
+        if (INGEST_OK != error)
+            return error;
+        if (!is_valid_utf8(value, value_length) || has_control_character(value, value_length))
+            return INGEST_INVALID_STRING;
+        // Only status_flags and meter_id are accepted as quoted numbers, e.g. "15"
+        if (FIELD_STATUS_FLAGS != field && FIELD_METER_ID != field)
+            return (FIELD_UNKNOWN == field) ? INGEST_OK : INGEST_INVALID_NUMBER;
+    }
+    else if (is_number(ch) || '-' == ch)
+    {
+        value_length = parse_number(value, cursor->json_length - cursor->position);
+        cursor->position += value_length;
+    }
+    else if (is_begin_marker(ch))
+        return (FIELD_UNKNOWN == field) ? skip_container(cursor) : INGEST_SYNTAX_ERROR;
+    else if (has_remaining(cursor, 4) && (is_true(value) || is_null(value)))
+    {
+        cursor->position += 4;
+        return (FIELD_UNKNOWN == field) ? INGEST_OK : INGEST_INVALID_NUMBER;
+    }
+    else if (has_remaining(cursor, 5) && is_false(value))
+    {
+        cursor->position += 5;
+        return (FIELD_UNKNOWN == field) ? INGEST_OK : INGEST_INVALID_NUMBER;
+    }
+    else
+        return INGEST_SYNTAX_ERROR;
+
+    uint64_t integer = 0;
+    switch (field)
+    {
+        case FIELD_METER_ID:
+            return to_unsigned(value, value_length, &reading->meter_id);
+        case FIELD_TIMESTAMP:
+            return to_unsigned(value, value_length, &snapshot->timestamp);
+        case FIELD_STATUS_FLAGS:
+            if (INGEST_OK != to_unsigned(value, value_length, &integer) || UINT8_MAX < integer)
+                return INGEST_INVALID_NUMBER;
+            snapshot->status = (uint8_t) integer;
+            *has_status = 1;
+            return INGEST_OK;
+        case FIELD_ELECTRIC_USAGE:
+            *present_bits |= bitmask_electric_usage;
+            return to_double(value, value_length, &snapshot->electric_usage);
+        case FIELD_ELECTRIC_COST:
+            *present_bits |= bitmask_electric_cost;
+            return to_double(value, value_length, &snapshot->electric_cost);
+        case FIELD_GAS_USAGE:
+            *present_bits |= bitmask_gas_usage;
+            return to_double(value, value_length, &snapshot->gas_usage);
+        case FIELD_GAS_COST:
+            *present_bits |= bitmask_gas_cost;
+            return to_double(value, value_length, &snapshot->gas_cost);
+        default:
+            return INGEST_OK;
+    }
+}
+
+/**
+ * @brief Parse the members of an object, the cursor must be past the opening brace.
+ * @param cursor document cursor.
+ * @param reading reading to populate.
+ * @param is_meter_reading 1 to require and store meter_id, 0 to skip it as an unknown key.
+ * @return INGEST_OK if successful, otherwise the error code.
+ */
+static ingest_error consume_members(document_cursor* cursor, meter_reading* reading,
+        const int is_meter_reading)
+{
+    int has_meter_id = 0;
+    int has_timestamp = 0;
+    int has_status = 0;
+    int present_bits = 0;
+    char key_buffer[MAX_KEY_BYTES];
+    skip_whitespace(cursor);
+    if (has_remaining(cursor, 1) && is_object_end(current_char(cursor)))
+    {
+        ++cursor->position;
+        return INGEST_MISSING_TIMESTAMP;
+    }
+    while (has_remaining(cursor, 1))
+    {
+        // Key
+        if (!is_quote(current_char(cursor)))
+            return INGEST_SYNTAX_ERROR;
+        const char* raw_key = NULL;
+        size_t raw_key_length = 0;
+        ingest_error error = consume_string(cursor, &raw_key, &raw_key_length);
+        if (INGEST_OK != error)
+            return error;
+        const char* key = NULL;
+        size_t key_length = 0;
+        snapshot_field field = FIELD_UNKNOWN;
+        if (decode_string(raw_key, raw_key_length, key_buffer, MAX_KEY_BYTES, &key, &key_length))
+            field = to_snapshot_field(key, key_length);
+        // A valid key that failed to decode is longer than MAX_KEY_BYTES, so unknown
+        else if (!is_valid_string(raw_key, raw_key_length))
+            return INGEST_INVALID_STRING;
+        if (FIELD_METER_ID == field && !is_meter_reading)
+            field = FIELD_UNKNOWN;
+        has_meter_id |= (FIELD_METER_ID == field);
+        has_timestamp |= (FIELD_TIMESTAMP == field);
+        // Separator
+        skip_whitespace(cursor);
+        if (!has_remaining(cursor, 1) || !is_separator(current_char(cursor)))
+            return INGEST_SYNTAX_ERROR;
+        ++cursor->position;
+        skip_whitespace(cursor);
+        if (!has_remaining(cursor, 1))
+            return INGEST_SYNTAX_ERROR;
+        // Value
+        error = consume_value(cursor, field, reading, &present_bits, &has_status);
+        if (INGEST_OK != error)
+            return error;
+        // Next member or end of object
+        skip_whitespace(cursor);
+        if (!has_remaining(cursor, 1))
+            return INGEST_SYNTAX_ERROR;
+        const char ch = current_char(cursor);
+        ++cursor->position;
+        if (is_object_end(ch))
+        {
+            if (!has_timestamp)
+                return INGEST_MISSING_TIMESTAMP;
+            if (is_meter_reading && !has_meter_id)
+                return INGEST_MISSING_METER_ID;
+            if (!has_status)
+                reading->snapshot.status = (uint8_t) present_bits;
+            return INGEST_OK;
+        }
+        if (!is_comma(ch))
+            return INGEST_SYNTAX_ERROR;
+        skip_whitespace(cursor);
+    }
+    return INGEST_SYNTAX_ERROR;
+}
+
+/**
+ * @brief Parse a single document into a reading, zeroed on error.
+ * @param is_meter_reading 1 to require and store meter_id, 0 to skip it as an unknown key.
+ * @return INGEST_OK if successful, otherwise the error code.
+ */
+static ingest_error parse_document(const char* json, size_t json_length, meter_reading* reading,
+        const int is_meter_reading)
+{
+    memset(reading, 0, sizeof(*reading));
+    document_cursor cursor = {json, json_length, 0};
+    skip_whitespace(&cursor);
+    if (!has_remaining(&cursor, 1))
+        return INGEST_EMPTY_DOCUMENT;
+    if (!is_object_begin(current_char(&cursor)))
+        return INGEST_SYNTAX_ERROR;
+    ++cursor.position;
+    ingest_error error = consume_members(&cursor, reading, is_meter_reading);
+    // Only whitespace may follow the object
+    if (INGEST_OK == error)
+    {
+        skip_whitespace(&cursor);
+        if (has_remaining(&cursor, 1))
+            error = INGEST_SYNTAX_ERROR;
+    }
+    if (INGEST_OK != error)
+        memset(reading, 0, sizeof(*reading));
+    return error;
+}
+
+/**
+ * @brief Parse newline delimited documents into snapshots, or readings when readings is set.
+ */
+static size_t parse_ndjson(const char* json, size_t json_length, usage_snapshot* snapshots,
+        meter_reading* readings, ingest_error* errors, const size_t capacity,
+        size_t* bytes_consumed)
+{
+    size_t document_count = 0;
+    size_t position = 0;
+    while (position < json_length && document_count < capacity)
+    {
+        const char* line = json + position;
+        const char* newline = memchr(line, '\n', json_length - position);
+        const size_t line_length = (NULL == newline) ? json_length - position :
+                (size_t) (newline - line);
+        position += line_length + (NULL != newline);
+        // Skip blank lines, including a lone carriage return
+        size_t i = 0;
+        while (i < line_length && is_whitespace(line[i]))
+            ++i;
+        if (i == line_length)
+            continue;
+        errors[document_count] = (NULL == readings) ?
+                parse_usage_document(line, line_length, snapshots + document_count) :
+                parse_meter_reading_document(line, line_length, readings + document_count);
+        ++document_count;
+    }
+    *bytes_consumed = position;
+    return document_count;
+}
+
+ingest_error parse_usage_document(const char* json, size_t json_length,
+        usage_snapshot* snapshot)
+{
+    meter_reading reading;
+    const ingest_error error = parse_document(json, json_length, &reading, 0);
+    *snapshot = reading.snapshot;
+    return error;
+}
+
+ingest_error parse_meter_reading_document(const char* json, size_t json_length,
+        meter_reading* reading)
+{
+    return parse_document(json, json_length, reading, 1);
+}
+
+size_t parse_usage_documents(const json_document* documents, const size_t count,
+        usage_snapshot* snapshots, ingest_error* errors)
+{
+    size_t parsed_count = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        errors[i] = parse_usage_document(documents[i].json, documents[i].json_length,
+                snapshots + i);
+        parsed_count += (INGEST_OK == errors[i]);
+    }
+    return parsed_count;
+}
+
+size_t parse_usage_ndjson(const char* json, size_t json_length, usage_snapshot* snapshots,
+        ingest_error* errors, const size_t capacity, size_t* bytes_consumed)
+{
+    return parse_ndjson(json, json_length, snapshots, NULL, errors, capacity, bytes_consumed);
+}
+
+size_t parse_meter_reading_ndjson(const char* json, size_t json_length, meter_reading* readings,
+        ingest_error* errors, const size_t capacity, size_t* bytes_consumed)
+{
+    return parse_ndjson(json, json_length, NULL, readings, errors, capacity, bytes_consumed);
+}
@@ -41,6 +41,16 @@ int is_list_end(const char ch)
     return ']' == ch;
 }
 
+int is_begin_marker(const char ch)
+{
+    return is_object_begin(ch) || is_list_begin(ch);
+}
+
+int is_end_marker(const char ch)
+{
+    return is_object_end(ch) || is_list_end(ch);
+}
+
 int is_separator(const char ch)
 {
     return ':' == ch;
@@ -76,9 +86,39 @@ int is_null(const char* json)
     return 0 == strncmp(json, "null", 4); 
 }
 
-int is_quote_with_escape_sequence(const char* json)
+int is_escape(const char ch)
 {
-    return ('\\' == *(json - 1) && '"' == *json); 
+    return '\\' == ch;
+}
+
+/**
+ * Word (8 byte) at a time helpers, used to skip runs of plain bytes.
+ */
+static const uint64_t word_ones = UINT64_C(0x0101010101010101);
+static const uint64_t word_high_bits = UINT64_C(0x8080808080808080);
+
+static uint64_t load_word(const char* json)
+{
+    uint64_t word;
+    memcpy(&word, json, sizeof(word));
+    return word;
+}
+
+static int word_has_byte(const uint64_t word, const unsigned char ch)
+{
+    const uint64_t matches = word ^ (word_ones * ch);
+    return 0 != ((matches - word_ones) & ~matches & word_high_bits);
+}
+
+static int word_is_ascii(const uint64_t word)
+{
+    return 0 == (word & word_high_bits);
+}
+
+static int word_has_control(const uint64_t word)
+{
+    // Exact for a bound of 0x20, any byte below it borrows into its high bit
+    return 0 != ((word - word_ones * 0x20) & ~word & word_high_bits);
 }
 
 int is_next_item_key(const char ch)
@@ -115,24 +155,306 @@ int is_data_item_value()
 
 size_t parse_string(const char* json_string, size_t json_length)
 {
-    const char* value = json_string;
     size_t string_length = 0;
-    while((!is_quote(*json_string) && 0 < json_length) || 
-            is_quote_with_escape_sequence(json_string))
+    while (string_length < json_length)
     {
-        ++json_string;
-        ++string_length;
-        --json_length;
+        // Skip a word at a time while it holds no quote or escape
+        if (sizeof(uint64_t) <= json_length - string_length)
+        {
+            const uint64_t word = load_word(json_string + string_length);
+            if (!word_has_byte(word, '"') && !word_has_byte(word, '\\'))
+            {
+                string_length += sizeof(uint64_t);
+                continue;
+            }
+        }
+        const char ch = json_string[string_length];
+        if (is_quote(ch))
+            return string_length;
+        // Escape: skip the escaped character, so \" does not end the string
+        string_length += is_escape(ch) ? 2 : 1;
+    }
+    // Buffer ended, or ended inside an escape sequence, before the closing quote
+    return JSON_STRING_UNTERMINATED;
+}
+
+int is_valid_utf8(const char* json_string, size_t json_length)
+{
+    const unsigned char* bytes = (const unsigned char*) json_string;
+    size_t index = 0;
+    while (index < json_length)
+    {
+        // ASCII fast path, a word at a time
+        if (sizeof(uint64_t) <= json_length - index && 
+                word_is_ascii(load_word(json_string + index)))
+        {
+            index += sizeof(uint64_t);
+            continue;
+        }
+        const unsigned char lead = bytes[index];
+        if (0x80 > lead)
+        {
+            ++index;
+            continue;
+        }
+        // Continuation count and the valid range of the first continuation byte,
+        // the restricted ranges reject overlong forms, surrogates and > U+10FFFF.
+        size_t continuation_count = 0;
+        unsigned char lower = 0x80;
+        unsigned char upper = 0xBF;
+        if (0xC2 <= lead && 0xDF >= lead)
+            continuation_count = 1;
+        else if (0xE0 == lead)
+        {
+            continuation_count = 2;
+            lower = 0xA0;
+        }
+        else if (0xED == lead)
+        {
+            continuation_count = 2;
+            upper = 0x9F;
+        }
+        else if (0xE1 <= lead && 0xEF >= lead)
+            continuation_count = 2;
+        else if (0xF0 == lead)
+        {
+            continuation_count = 3;
+            lower = 0x90;
+        }
+        else if (0xF4 == lead)
+        {
+            continuation_count = 3;
+            upper = 0x8F;
+        }
+        else if (0xF1 <= lead && 0xF3 >= lead)
+            continuation_count = 3;
+        else
+            return 0;
+        if (json_length - index - 1 < continuation_count)
+            return 0;
+        if (lower > bytes[index + 1] || upper < bytes[index + 1])
+            return 0;
+        for (size_t i = 2; i <= continuation_count; ++i)
+            if (0x80 != (bytes[index + i] & 0xC0))
+                return 0;
+        index += continuation_count + 1;
     }
-    //TODO Handle missing quote
-    return string_length; 
+    return 1;
+}
+
+int has_control_character(const char* json_string, size_t json_length)
+{
+    size_t index = 0;
+    for (; sizeof(uint64_t) <= json_length - index; index += sizeof(uint64_t))
+        if (word_has_control(load_word(json_string + index)))
+            return 1;
+    for (; index < json_length; ++index)
+        if (0x20 > (unsigned char) json_string[index])
+            return 1;
+    return 0;
+}
+
+/**
+ * @brief Parses the four hex digits of a \u escape.
+ * @param json_string Pointer to the first hex digit.
+ * @param code_unit Set to the parsed UTF-16 code unit.
+ * @return 1 if successful, 0 if a digit is not hex.
+ */
+static int parse_hex_code_unit(const char* json_string, uint32_t* code_unit)
+{
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        const char ch = json_string[i];
+        uint32_t digit = 0;
+        if (is_number(ch))
+            digit = (uint32_t) (ch - '0');
+        else if ('a' <= ch && 'f' >= ch)
+            digit = (uint32_t) (ch - 'a' + 10);
+        else if ('A' <= ch && 'F' >= ch)
+            digit = (uint32_t) (ch - 'A' + 10);
+        else
+            return 0;
+        value = (value << 4) | digit;
+    }
+    *code_unit = value;
+    return 1;
+}
+
+/**
+ * @brief Encodes a code point as UTF-8.
+ * @param code_point Unicode scalar value.
+ * @param buffer Output buffer with room for 4 bytes.
+ * @return Number of bytes written.
+ */
+static size_t encode_utf8(const uint32_t code_point, char* buffer)
+{
+    if (0x80 > code_point)
+    {
+        buffer[0] = (char) code_point;
+        return 1;
+    }
+    if (0x800 > code_point)
+    {
+        buffer[0] = (char) (0xC0 | (code_point >> 6));
+        buffer[1] = (char) (0x80 | (code_point & 0x3F));
+        return 2;
+    }
+    if (0x10000 > code_point)
+    {
+        buffer[0] = (char) (0xE0 | (code_point >> 12));
+        buffer[1] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+        buffer[2] = (char) (0x80 | (code_point & 0x3F));
+        return 3;
+    }
+    buffer[0] = (char) (0xF0 | (code_point >> 18));
+    buffer[1] = (char) (0x80 | ((code_point >> 12) & 0x3F));
+    buffer[2] = (char) (0x80 | ((code_point >> 6) & 0x3F));
+    buffer[3] = (char) (0x80 | (code_point & 0x3F));
+    return 4;
+}
+
+/**
+ * @brief Decodes a \uXXXX escape, combining a surrogate pair into one code point.
+ * @param json_string Pointer to the 'u' of the escape.
+ * @param json_length Remaining length from the 'u'.
+ * @param code_point Set to the decoded code point.
+ * @return Number of bytes consumed from the 'u', 0 if the escape is invalid.
+ */
+static size_t decode_unicode_escape(const char* json_string, size_t json_length, 
+        uint32_t* code_point)
+{
+    uint32_t high = 0;
+    if (5 > json_length || !parse_hex_code_unit(json_string + 1, &high))
+        return 0;
+    // Lone low surrogate
+    if (0xDC00 <= high && 0xDFFF >= high)
+        return 0;
+    if (0xD800 > high || 0xDBFF < high)
+    {
+        *code_point = high;
+        return 5;
+    }
+    // High surrogate, must be followed by \uDC00 to \uDFFF
+    uint32_t low = 0;
+    if (11 > json_length || !is_escape(json_string[5]) || 'u' != json_string[6] ||
+            !parse_hex_code_unit(json_string + 7, &low) || 0xDC00 > low || 0xDFFF < low)
+        return 0;
+    *code_point = 0x10000 + ((high - 0xD800) << 10) + (low - 0xDC00);
+    return 11;
+}
+
+int is_valid_string(const char* json_string, size_t string_length)
+{
+    if (!is_valid_utf8(json_string, string_length) ||
+            has_control_character(json_string, string_length))
+        return 0;
+    const char* escape = memchr(json_string, '\\', string_length);
+    while (NULL != escape)
+    {
+        size_t index = (size_t) (escape - json_string);
+        if (index + 1 >= string_length)
+            return 0;
+        uint32_t code_point = 0;
+        size_t consumed = 0;
+        switch (json_string[index + 1])
+        {
+            case '"': case '\\': case '/': case 'b': case 'f': case 'n': case 'r': case 't':
+                index += 2;
+                break;
+            case 'u':
+                consumed = decode_unicode_escape(json_string + index + 1,
+                        string_length - index - 1, &code_point);
+                if (0 == consumed)
+                    return 0;
+                index += 1 + consumed;
+                break;
+            default: return 0;
+        }
+        escape = memchr(json_string + index, '\\', string_length - index);
+    }
+    return 1;
+}
+
+int decode_string(const char* json_string, size_t string_length, char* buffer, 
+        size_t buffer_length, const char** decoded, size_t* decoded_length)
+{
+    // Escapes are ASCII, so validating the raw bytes validates the decoded string
+    if (!is_valid_utf8(json_string, string_length) ||
+            has_control_character(json_string, string_length))
+        return 0;
+    // Zero-copy when there is nothing to unescape
+    const char* escape = memchr(json_string, '\\', string_length);
+    if (NULL == escape)
+    {
+        *decoded = json_string;
+        *decoded_length = string_length;
+        return 1;
+    }
+    // Decoded output is never longer than the escaped input
+    size_t prefix_length = (size_t) (escape - json_string);
+    if (NULL == buffer || buffer_length < prefix_length)
+        return 0;
+    memcpy(buffer, json_string, prefix_length);
+    size_t written = prefix_length;
+    size_t index = prefix_length;
+    while (index < string_length)
+    {
+        const char ch = json_string[index];
+        if (!is_escape(ch))
+        {
+            if (written >= buffer_length)
+                return 0;
+            buffer[written++] = ch;
+            ++index;
+            continue;
+        }
+        if (index + 1 >= string_length)
+            return 0;
+        char unescaped = 0;
+        switch (json_string[index + 1])
+        {
+            case '"': unescaped = '"'; break;
+            case '\\': unescaped = '\\'; break;
+            case '/': unescaped = '/'; break;
+            case 'b': unescaped = '\b'; break;
+            case 'f': unescaped = '\f'; break;
+            case 'n': unescaped = '\n'; break;
+            case 'r': unescaped = '\r'; break;
+            case 't': unescaped = '\t'; break;
+            case 'u':
+            {
+                uint32_t code_point = 0;
+                const size_t consumed = decode_unicode_escape(json_string + index + 1, 
+                        string_length - index - 1, &code_point);
+                if (0 == consumed)
+                    return 0;
+                char utf8[4];
+                const size_t utf8_length = encode_utf8(code_point, utf8);
+                if (buffer_length - written < utf8_length)
+                    return 0;
+                memcpy(buffer + written, utf8, utf8_length);
+                written += utf8_length;
+                index += 1 + consumed;
+                continue;
+            }
+            default: return 0;
+        }
+        if (written >= buffer_length)
+            return 0;
+        buffer[written++] = unescaped;
+        index += 2;
+    }
+    *decoded = buffer;
+    *decoded_length = written;
+    return 1;
 }
 
 size_t parse_number(const char* json_string, size_t json_length)
 {
     const char* value = json_string;
     size_t number_length = 0;
-    while((is_number(*json_string) || is_float(*json_string)) && 0 < json_length) 
+    while (0 < json_length && (is_number(*json_string) || is_float(*json_string)))
     {
         ++json_string;
         ++number_length;
@@ -148,14 +470,29 @@ size_t parse_attributes(const char* json_string, size_t json_length,
     toggle_key_or_value(*json_string);
     size_t parsed_data_length = 0;
     json_item_type data_type = INIT;
+    const char* data = json_string;
+    size_t data_length = 0;
+    char string_buffer[STRING_BUFFER_BYTES];
     // String: Parse and extract string.
     if (is_quote(*json_string))
     {
         // string length +1 to account for leading double quotes.
         parsed_data_length = parse_string(++json_string, --json_length);
+        if (JSON_STRING_UNTERMINATED == parsed_data_length)
+        {
+            LOG(ERROR, "String without a closing quote: %.*s\n", (int) json_length, json_string);
+            return 0;
+        }
         // Reduce json_length by 1 to account for trailing double quotes.
         --json_length;
         data_type = STRING;
+        if (!decode_string(json_string, parsed_data_length, string_buffer, STRING_BUFFER_BYTES,
+                    &data, &data_length))
+        {
+            LOG(ERROR, "Invalid or oversized string: %.*s\n", (int) parsed_data_length, json_string);
+            data = json_string;
+            data_length = parsed_data_length;
+        }
     }
     // Number: Parse and extract number.
     else if (is_number(*json_string))
@@ -185,13 +522,18 @@ size_t parse_attributes(const char* json_string, size_t json_length,
     if (0 < parsed_data_length)
     {
         LOG(DEBUG, "Data length: %zu\n", parsed_data_length);
+        if (STRING != data_type)
+        {
+            data = json_string;
+            data_length = parsed_data_length;
+        }
         if (is_data_item_key())
-            LOG(INFO, "Key  : %.*s\n", (int) parsed_data_length, json_string);
+            LOG(INFO, "Key  : %.*s\n", (int) data_length, data);
             // Check if used < alloc
             // if yes, ++current_item_address
             // ++current_item_address
         else
-            LOG(INFO, "Value: %.*s\n", (int) parsed_data_length, json_string);
+            LOG(INFO, "Value: %.*s\n", (int) data_length, data);
         // Reduce json data length
         json_length -= parsed_data_length;
     }
@@ -300,7 +642,8 @@ void parse_json_string(const char* json_string, size_t json_length)
             ++json_string;
             --json_length;
         }
-        LOG(DEBUG, "Current json pointed at: %c\n", *json_string);
+        if (0 < json_length)
+            LOG(DEBUG, "Current json pointed at: %c\n", *json_string);
         LOG(DEBUG, "JSON LEN: %zu\n", json_length);
     }
     // Free memory
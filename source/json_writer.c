@@ -0,0 +1,383 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "json_writer.h"
+#include "json.h"
+#include "log.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/**
+ * @brief Mark the writer failed, the output is incomplete.
+ */
+static int fail(json_writer* writer)
+{
+    writer->is_failed = 1;
+    return 0;
+}
+
+static int append_bytes(json_writer* writer, const char* data, size_t length)
+{
+    while (0 < length)
+    {
+        // Current chunk full, move to the next one, flushing when all are full
+        if (JSON_WRITER_CHUNK_BYTES == writer->chunk_length)
+        {
+            if (JSON_WRITER_CHUNKS == writer->chunk_count + 1)
+            {
+                if (!flush_json_writer(writer))
+                    return 0;
+            }
+            else
+            {
+                ++writer->chunk_count;
+                writer->chunk_length = 0;
+            }
+        }
+        const size_t room = JSON_WRITER_CHUNK_BYTES - writer->chunk_length;
+        const size_t copied = (length < room) ? length : room;
+        memcpy(writer->chunks[writer->chunk_count] + writer->chunk_length, data, copied);
+        writer->chunk_length += copied;
+        data += copied;
+        length -= copied;
+    }
+    return 1;
+}
+
+static int append_character(json_writer* writer, const char ch)
+{
+    if (JSON_WRITER_CHUNK_BYTES > writer->chunk_length)
+    {
+        writer->chunks[writer->chunk_count][writer->chunk_length++] = ch;
+        return 1;
+    }
+    return append_bytes(writer, &ch, 1);
+}
+
+static int is_escaped(const unsigned char ch)
+{
+    return 0x20 > ch || '"' == ch || '\\' == ch;
+}
+
+/**
+ * @brief Get the escape sequence of a character that must be escaped.
+ * @return length of the escape sequence, 2 or 6 bytes.
+ */
+static size_t get_escape_sequence(const unsigned char ch, char* escape)
+{
+    escape[0] = '\\';
+    switch (ch)
+    {
+        case '"': escape[1] = '"'; return 2;
+        case '\\': escape[1] = '\\'; return 2;
+        case '\b': escape[1] = 'b'; return 2;
+        case '\f': escape[1] = 'f'; return 2;
+        case '\n': escape[1] = 'n'; return 2;
+        case '\r': escape[1] = 'r'; return 2;
+        case '\t': escape[1] = 't'; return 2;
+        default:
+            memcpy(escape + 1, "u00", 3);
+            escape[4] = hex_digits[ch >> 4];
+            escape[5] = hex_digits[ch & 0xF];
+            return 6;
+    }
+}
+
+/**
+ * @brief Append a string escaped, runs needing no escape are copied whole.
+ */
+static int append_escaped(json_writer* writer, const char* string, const size_t length)
+{
+    size_t run_start = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        if (!is_escaped((unsigned char) string[i]))
+            continue;
+        char escape[6];
+        const size_t escape_length = get_escape_sequence((unsigned char) string[i], escape);
+        if (!append_bytes(writer, string + run_start, i - run_start) ||
+                !append_bytes(writer, escape, escape_length))
+            return 0;
+        run_start = i + 1;
+    }
+    return append_bytes(writer, string + run_start, length - run_start);
+}
+
+/**
+ * @brief Escape a key into the key arena as "key": and cache it.
+ * @return the cached key, NULL if the key does not fit in the arena.
+ */
+static const json_writer_key* cache_key(json_writer* writer, json_writer_key* cached,
+        const char* key, const size_t key_length)
+{
+    // Raw key to validate hits, then the worst case escaped key, quotes, ':' and space
+    const size_t worst_bytes = key_length + 6 * key_length + 4;
+    if (JSON_WRITER_KEY_ARENA_BYTES < worst_bytes)
+        return NULL;
+    // Arena full, start over
+    if (JSON_WRITER_KEY_ARENA_BYTES - writer->key_arena_length < worst_bytes)
+    {
+        memset(writer->keys, 0, sizeof(writer->keys));
+        writer->key_arena_length = 0;
+    }
+    char* raw = writer->key_arena + writer->key_arena_length;
+    memcpy(raw, key, key_length);
+    char* escaped = raw + key_length;
+    size_t length = 0;
+    escaped[length++] = '"';
+    for (size_t i = 0; i < key_length; ++i)
+    {
+        if (is_escaped((unsigned char) key[i]))
+            length += get_escape_sequence((unsigned char) key[i], escaped + length);
+        else
+            escaped[length++] = key[i];
+    }
+    memcpy(escaped + length, "\": ", 3);
+    length += 3;
+    cached->key = key;
+    cached->key_length = key_length;
+    cached->offset = (uint32_t) writer->key_arena_length;
+    cached->length = (uint32_t) length;
+    writer->key_arena_length += key_length + length;
+    return cached;
+}
+
+/**
+ * @brief Append "key": using the escaped key cache.
+ */
+static int append_key(json_writer* writer, const char* key, const size_t key_length)
+{
+    if (NULL == key)
+    {
+        LOG(ERROR, "Object member without a key.\n");
+        return fail(writer);
+    }
+    const size_t slot = (size_t) (((uintptr_t) key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) &
+            (JSON_WRITER_KEY_SLOTS - 1);
+    json_writer_key* cached = writer->keys + slot;
+    // Hit only when the address and the text match, key storage may be reused
+    const json_writer_key* hit = (key == cached->key && key_length == cached->key_length &&
+            0 == memcmp(writer->key_arena + cached->offset, key, key_length)) ? cached :
+            cache_key(writer, cached, key, key_length);
+    if (NULL != hit)
+        return append_bytes(writer, writer->key_arena + hit->offset + key_length, hit->length);
+    return append_character(writer, '"') && append_escaped(writer, key, key_length) &&
+            append_bytes(writer, "\": ", 3);
+}
+
+static int append_item_value(json_writer* writer, const json_item* item)
+{
+    switch (item->item_type)
+    {
+        case STRING:
+            if (NULL == item->value && 0 < item->value_length)
+                break;
+            return append_character(writer, '"') &&
+                    append_escaped(writer, item->value, item->value_length) &&
+                    append_character(writer, '"');
+        case INTEGER:
+        case FLOAT:
+        case BOOLEAN:
+            if (NULL == item->value || 0 == item->value_length)
+                break;
+            return append_bytes(writer, item->value, item->value_length);
+        case NULL_VALUE:
+            return append_bytes(writer, "null", 4);
+        default:
+            break;
+    }
+    LOG(ERROR, "Invalid value of type %d.\n", item->item_type);
+    return fail(writer);
+}
+
+static int append_separator(json_writer* writer, const size_t written)
+{
+    return (0 == written) || append_bytes(writer, ", ", 2);
+}
+
+static int append_object(json_writer* writer, const json_object* object, const size_t depth);
+
+/**
+ * @brief Append a child of an OBJECT, an ITEM child adds a member per json_item.
+ */
+static int append_member(json_writer* writer, const json_object* child, const size_t depth,
+        size_t* written)
+{
+    if (ITEM != child->object_type)
+        return append_separator(writer, (*written)++) &&
+                append_key(writer, child->name, (NULL == child->name) ? 0 : strlen(child->name)) &&
+                append_object(writer, child, depth);
+    const json_item* items = child->item;
+    for (size_t i = 0; i < child->size; ++i)
+        if (!append_separator(writer, (*written)++) ||
+                !append_key(writer, items[i].key, items[i].key_length) ||
+                !append_item_value(writer, items + i))
+            return 0;
+    return 1;
+}
+
+/**
+ * @brief Append a child of an ARRAY, an ITEM child adds a value per json_item.
+ */
+static int append_element(json_writer* writer, const json_object* child, const size_t depth,
+        size_t* written)
+{
+    if (ITEM != child->object_type)
+        return append_separator(writer, (*written)++) && append_object(writer, child, depth);
+    const json_item* items = child->item;
+    for (size_t i = 0; i < child->size; ++i)
+        if (!append_separator(writer, (*written)++) || !append_item_value(writer, items + i))
+            return 0;
+    return 1;
+}
+
+static int append_object(json_writer* writer, const json_object* object, const size_t depth)
+{
+    if (JSON_WRITER_MAX_DEPTH <= depth)
+    {
+        LOG(ERROR, "Tree nested deeper than %d.\n", JSON_WRITER_MAX_DEPTH);
+        return fail(writer);
+    }
+    if (NULL == object->item && 0 < object->size)
+    {
+        LOG(ERROR, "Object with %zu children and no storage.\n", object->size);
+        return fail(writer);
+    }
+    size_t written = 0;
+    switch (object->object_type)
+    {
+        case OBJECT:
+            if (!append_character(writer, '{'))
+                return 0;
+            for (size_t i = 0; i < object->size; ++i)
+                if (!append_member(writer, (const json_object*) object->item + i, depth + 1,
+                        &written))
+                    return 0;
+            return append_character(writer, '}');
+        case ARRAY:
+            if (!append_character(writer, '['))
+                return 0;
+            for (size_t i = 0; i < object->size; ++i)
+                if (!append_element(writer, (const json_object*) object->item + i, depth + 1,
+                        &written))
+                    return 0;
+            return append_character(writer, ']');
+        case ITEM:
+            // A root ITEM, written as an object of its items
+            return append_character(writer, '{') &&
+                    append_member(writer, object, depth, &written) &&
+                    append_character(writer, '}');
+        default:
+            LOG(ERROR, "Invalid object of type %d.\n", object->object_type);
+            return fail(writer);
+    }
+}
+
+void initialise_json_writer(json_writer* writer, const int fd)
+{
+    writer->fd = fd;
+    writer->is_failed = 0;
+    writer->chunk_count = 0;
+    writer->chunk_length = 0;
+    writer->depth = 0;
+    writer->key_arena_length = 0;
+    memset(writer->keys, 0, sizeof(writer->keys));
+}
+
+int write_json_object(json_writer* writer, const json_object* object)
+{
+    if (writer->is_failed)
+        return 0;
+    if (0 < writer->depth && writer->has_members[writer->depth - 1] &&
+            !append_bytes(writer, ", ", 2))
+        return 0;
+    if (0 < writer->depth)
+        writer->has_members[writer->depth - 1] = 1;
+    return append_object(writer, object, writer->depth);
+}
+
+int write_json_array_begin(json_writer* writer)
+{
+    if (writer->is_failed)
+        return 0;
+    if (JSON_WRITER_MAX_DEPTH <= writer->depth)
+    {
+        LOG(ERROR, "Arrays nested deeper than %d.\n", JSON_WRITER_MAX_DEPTH);
+        return fail(writer);
+    }
+    if (0 < writer->depth && writer->has_members[writer->depth - 1] &&
+            !append_bytes(writer, ", ", 2))
+        return 0;
+    if (0 < writer->depth)
+        writer->has_members[writer->depth - 1] = 1;
+    writer->has_members[writer->depth++] = 0;
+    return append_character(writer, '[');
+}
+
+int write_json_array_end(json_writer* writer)
+{
+    if (writer->is_failed)
+        return 0;
+    if (0 == writer->depth)
+    {
+        LOG(ERROR, "No array to end.\n");
+        return fail(writer);
+    }
+    --writer->depth;
+    return append_character(writer, ']');
+}
+
+int write_json_newline(json_writer* writer)
+{
+    return !writer->is_failed && append_character(writer, '\n');
+}
+
+int flush_json_writer(json_writer* writer)
+{
+    if (writer->is_failed)
+        return 0;
+    struct iovec chunks[JSON_WRITER_CHUNKS];
+    size_t chunk_count = 0;
+    for (; chunk_count < writer->chunk_count; ++chunk_count)
+    {
+        chunks[chunk_count].iov_base = writer->chunks[chunk_count];
+        chunks[chunk_count].iov_len = JSON_WRITER_CHUNK_BYTES;
+    }
+    chunks[chunk_count].iov_base = writer->chunks[chunk_count];
+    chunks[chunk_count].iov_len = writer->chunk_length;
+    ++chunk_count;
+    struct iovec* pending = chunks;
+    while (0 < chunk_count)
+    {
+        const ssize_t written = writev(writer->fd, pending, (int) chunk_count);
+        if (0 > written)
+        {
+            if (EINTR == errno)
+                continue;
+            LOG(ERROR, "Write of JSON output failed, errno %d.\n", errno);
+            return fail(writer);
+        }
+        // Skip the chunks written, and the written part of a partially written chunk
+        size_t remaining = (size_t) written;
+        while (0 < chunk_count && remaining >= pending->iov_len)
+        {
+            remaining -= pending->iov_len;
+            ++pending;
+            --chunk_count;
+        }
+        if (0 < chunk_count)
+        {
+            pending->iov_base = (char*) pending->iov_base + remaining;
+            pending->iov_len -= remaining;
+        }
+    }
+    writer->chunk_count = 0;
+    writer->chunk_length = 0;
+    return 1;
+}
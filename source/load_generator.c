@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "load_generator.h"
+#include "energy_monitor.h"
+#include "ingestor.h"
+#include "tariff.h"
+#include "log.h"
+
+/**
+ * @brief Buffered output, flushed with a single write when full.
+ */
+typedef struct
+{
+    int fd;
+    int is_socket;
+    size_t length;
+    uint64_t bytes;
+    char data[GENERATOR_BUFFER_BYTES];
+} output_buffer;
+
+/**
+ * @brief Initialise an output buffer for a file descriptor.
+ */
+static void initialise_output(output_buffer* output, const int fd)
+{
+    struct stat status;
+    output->fd = fd;
+    output->is_socket = 0 == fstat(fd, &status) && S_ISSOCK(status.st_mode);
+    output->length = 0;
+    output->bytes = 0;
+}
+
+static int flush_output(output_buffer* output)
+{
+    const char* bytes = output->data;
+    size_t length = output->length;
+    while (0 < length)
+    {
+        // A closed socket fails the send rather than raising SIGPIPE
+        const ssize_t written = output->is_socket ? send(output->fd, bytes, length, MSG_NOSIGNAL) :
+                write(output->fd, bytes, length);
+        if (0 > written)
+        {
+            if (EINTR == errno)
+                continue;
+            LOG(ERROR, "Write of %zu bytes failed, errno %d.\n", length, errno);
+            return 0;
+        }
+        bytes += written;
+        length -= (size_t) written;
+    }
+    output->bytes += output->length;
+    output->length = 0;
+    return 1;
+}
+
+static int write_output(output_buffer* output, const void* data, const size_t length)
+{
+    if (GENERATOR_BUFFER_BYTES - output->length < length && !flush_output(output))
+        return 0;
+    memcpy(output->data + output->length, data, length);
+    output->length += length;
+    return 1;
+}
+
+static double get_elapsed_seconds(const struct timespec* start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Sleep until a point in time after start, flushing first so paced output is timely.
+ * @return 1 (true) if successful, 0 if the flush failed.
+ */
+static int wait_until(output_buffer* output, const struct timespec* start, const double due)
+{
+    const double remaining = due - get_elapsed_seconds(start);
+    if (0.0 >= remaining)
+        return 1;
+    if (!flush_output(output))
+        return 0;
+    struct timespec pause;
+    pause.tv_sec = (time_t) remaining;
+    pause.tv_nsec = (long) ((remaining - (double) pause.tv_sec) * 1e9);
+    while (0 != nanosleep(&pause, &pause) && EINTR == errno)
+        ;
+    return 1;
+}
+
+/**
+ * @brief xorshift64* generator, small and reproducible across platforms.
+ */
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * UINT64_C(0x2545F4914F6CDD1D);
+}
+
+/**
+ * @brief Uniform random number in the range [0, 1).
+ */
+static double next_uniform(uint64_t* state)
+{
+    return (double) (next_random(state) >> 11) / 9007199254740992.0;
+}
+
+/**
+ * @brief Relative household electric demand by hour of day, morning and evening peaks.
+ */
+static double get_electric_curve(const double hour)
+{
+    return 0.4 + 0.6 * exp(-(hour - 8.0) * (hour - 8.0) / 4.0) +
+            1.1 * exp(-(hour - 19.0) * (hour - 19.0) / 6.0);
+}
+
+/**
+ * @brief Relative household gas demand by hour of day, heating on waking and in the evening.
+ */
+static double get_gas_curve(const double hour)
+{
+    return 0.2 + 1.3 * exp(-(hour - 7.0) * (hour - 7.0) / 3.0) +
+            0.9 * exp(-(hour - 18.0) * (hour - 18.0) / 5.0);
+}
+
+/**
+ * @brief Per meter scale of demand, stable for a meter across runs, in the range 0.3 to 2.3.
+ */
+static double get_meter_scale(const uint64_t meter_id, const uint64_t seed)
+{
+    uint64_t state = (meter_id + 1) * UINT64_C(0x9E3779B97F4A7C15) ^ seed;
+    state = (0 == state) ? 1 : state;
+    return 0.3 + 2.0 * next_uniform(&state);
+}
+
+/**
+ * @brief Produce the reading of a meter for an interval.
+ */
+static meter_reading create_reading(const generator_config* config, const tariff* tariff_table,
+        const uint64_t meter_id, const uint64_t timestamp, uint64_t* state)
+{
+    const double hour = (double) (timestamp % TARIFF_SECONDS_PER_DAY) / 3600.0;
+    const double hours = (double) config->interval_seconds / 3600.0;
+    const double scale = get_meter_scale(meter_id, config->seed);
+    const double electric_noise = 1.0 + config->jitter * (2.0 * next_uniform(state) - 1.0);
+    const double gas_noise = 1.0 + config->jitter * (2.0 * next_uniform(state) - 1.0);
+    // Typical household, 0.45 kWh electric and 1.4 kWh gas an hour on average
+    meter_reading reading;
+    reading.meter_id = meter_id;
+    reading.snapshot.timestamp = timestamp;
+    reading.snapshot.electric_usage = 0.45 * hours * scale * get_electric_curve(hour) *
+            electric_noise;
+    reading.snapshot.gas_usage = 1.4 * hours * scale * get_gas_curve(hour) * gas_noise;
+    reading.snapshot.electric_cost = 0.0;
+    reading.snapshot.gas_cost = 0.0;
+    reading.snapshot.status = (uint8_t) (bitmask_electric_usage | bitmask_gas_usage);
+    price_snapshot(tariff_table, &reading.snapshot);
+    return reading;
+}
+
+/**
+ * @brief Format a reading as an NDJSON line, or as a malformed line for a malformed variant.
+ * @param malformed_variant 0 for a well formed line, 1 to 3 for the malformed variants.
+ * @return length of the line.
+ */
+static size_t format_reading(const meter_reading* reading, const int malformed_variant,
+        char* line)
+{
+    const usage_snapshot* snapshot = &reading->snapshot;
+    int length = 0;
+    // Invalid number
+    if (2 == malformed_variant)
+        length = snprintf(line, GENERATOR_MAX_LINE_BYTES, "{\"meter_id\": %llu, \"timestamp\": "
+                "%lluz, \"electric_usage\": 1.0.0}\n", (unsigned long long) reading->meter_id,
+                (unsigned long long) snapshot->timestamp);
+    // Missing timestamp
+    else if (3 == malformed_variant)
+        length = snprintf(line, GENERATOR_MAX_LINE_BYTES, "{\"meter_id\": %llu, "
+                "\"electric_usage\": %.10f}\n", (unsigned long long) reading->meter_id,
+                snapshot->electric_usage);
+    else
+        length = snprintf(line, GENERATOR_MAX_LINE_BYTES, "{\"meter_id\": %llu, \"timestamp\": "
+                "%llu, \"electric_usage\": %.10f, \"electric_cost\": %.10f, \"gas_usage\": %.10f, "
+                "\"gas_cost\": %.10f, \"status_flags\": %d}\n",
+                (unsigned long long) reading->meter_id, (unsigned long long) snapshot->timestamp,
+                snapshot->electric_usage, snapshot->electric_cost, snapshot->gas_usage,
+                snapshot->gas_cost, snapshot->status);
+    // Truncated, cut mid record
+    if (1 == malformed_variant)
+    {
+        length /= 2;
+        line[length++] = '\n';
+    }
+    return (size_t) length;
+}
+
+static int emit_reading(output_buffer* output, const generator_config* config,
+        const meter_reading* reading, uint64_t* state, generator_stats* stats)
+{
+    ++stats->readings;
+    if (FORMAT_BINARY == config->format)
+        return write_output(output, reading, sizeof(*reading));
+    char line[GENERATOR_MAX_LINE_BYTES];
+    int malformed_variant = 0;
+    if (next_uniform(state) < config->malformed_rate)
+    {
+        malformed_variant = 1 + (int) (next_random(state) % 3);
+        ++stats->malformed;
+    }
+    return write_output(output, line, format_reading(reading, malformed_variant, line));
+}
+
+void initialise_generator_config(generator_config* config)
+{
+    config->meter_count = 1000;
+    config->reading_count = 1000000;
+    config->start_timestamp = 1717379654;
+    config->interval_seconds = 60;
+    config->target_rate = 0.0;
+    config->jitter = 0.05;
+    config->out_of_order_rate = 0.001;
+    config->malformed_rate = 0.001;
+    config->seed = 1;
+    config->format = FORMAT_NDJSON;
+}
+
+int open_generator_output(const char* target)
+{
+    if (0 == strcmp("-", target))
+        return STDOUT_FILENO;
+    if (0 != strncmp("tcp:", target, 4))
+    {
+        const int fd = open(target, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (0 > fd)
+            LOG(ERROR, "Unable to open %s, errno %d.\n", target, errno);
+        return fd;
+    }
+    // tcp:host:port
+    char host[256];
+    const char* port = strrchr(target + 4, ':');
+    const size_t host_length = (NULL == port) ? 0 : (size_t) (port - target - 4);
+    if (0 == host_length || sizeof(host) <= host_length)
+    {
+        LOG(ERROR, "Invalid socket target %s, expected tcp:host:port.\n", target);
+        return -1;
+    }
+    memcpy(host, target + 4, host_length);
+    host[host_length] = '\0';
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses = NULL;
+    if (0 != getaddrinfo(host, port + 1, &hints, &addresses))
+    {
+        LOG(ERROR, "Unable to resolve %s.\n", target);
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo* address = addresses; NULL != address && 0 > fd;
+            address = address->ai_next)
+    {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (0 <= fd && 0 != connect(fd, address->ai_addr, address->ai_addrlen))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (0 > fd)
+        LOG(ERROR, "Unable to connect to %s.\n", target);
+    return fd;
+}
+
+int generate_load(const generator_config* config, const int output_fd, generator_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (0 == config->meter_count || 0 == config->interval_seconds)
+    {
+        LOG(ERROR, "Generator requires at least 1 meter and a non zero interval.\n");
+        return 0;
+    }
+    output_buffer* output = malloc(sizeof(output_buffer));
+    if (NULL == output)
+    {
+        LOG(ERROR, "Output buffer allocation failed.\n");
+        return 0;
+    }
+    initialise_output(output, output_fd);
+    // Two rate tariff to price the synthetic usage, peak 16:00 to 19:00
+    const double electric_unit_rate[TARIFF_BAND_COUNT] = {0.18, 0.32};
+    const double gas_unit_rate[TARIFF_BAND_COUNT] = {0.06, 0.06};
+    tariff tariff_table;
+    initialise_tariff(&tariff_table, electric_unit_rate, gas_unit_rate, 0.53, 0.30, 0);
+    set_tariff_band(&tariff_table, PEAK, 16 * 3600, 19 * 3600);
+    meter_reading delayed[GENERATOR_DELAY_SLOTS];
+    int is_delayed[GENERATOR_DELAY_SLOTS] = {0};
+    uint64_t state = (0 == config->seed) ? 1 : config->seed;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int is_successful = 1;
+    for (uint64_t i = 0; i < config->reading_count && is_successful; ++i)
+    {
+        const uint64_t meter_id = i % config->meter_count;
+        const uint64_t timestamp = config->start_timestamp +
+                (i / config->meter_count) * config->interval_seconds;
+        meter_reading reading = create_reading(config, &tariff_table, meter_id, timestamp, &state);
+        // Out of order: hold the reading back, releasing the one held in its slot
+        if (next_uniform(&state) < config->out_of_order_rate)
+        {
+            const size_t slot = (size_t) (next_random(&state) % GENERATOR_DELAY_SLOTS);
+            const meter_reading held = delayed[slot];
+            const int was_delayed = is_delayed[slot];
+            delayed[slot] = reading;
+            is_delayed[slot] = 1;
+            ++stats->out_of_order;
+            if (!was_delayed)
+                continue;
+            reading = held;
+        }
+        if (0.0 < config->target_rate)
+            is_successful = wait_until(output, &start, (double) stats->readings /
+                    config->target_rate);
+        is_successful = is_successful && emit_reading(output, config, &reading, &state, stats);
+    }
+    for (size_t slot = 0; slot < GENERATOR_DELAY_SLOTS && is_successful; ++slot)
+        if (is_delayed[slot])
+            is_successful = emit_reading(output, config, delayed + slot, &state, stats);
+    is_successful = is_successful && flush_output(output);
+    stats->bytes = output->bytes;
+    stats->seconds = get_elapsed_seconds(&start);
+    free(output);
+    return is_successful;
+}
+
+/**
+ * @brief Get the timestamp of a captured record, for pacing.
+ * @return 1 (true) if the record has a timestamp, 0 if it is malformed.
+ */
+static int get_record_timestamp(const char* record, const size_t record_length,
+        const stream_format format, uint64_t* timestamp)
+{
+    if (FORMAT_BINARY == format)
+    {
+        meter_reading reading;
+        memcpy(&reading, record, sizeof(reading));
+        *timestamp = reading.snapshot.timestamp;
+        return 1;
+    }
+    usage_snapshot snapshot;
+    if (INGEST_OK != parse_usage_document(record, record_length, &snapshot))
+        return 0;
+    *timestamp = snapshot.timestamp;
+    return 1;
+}
+
+int replay_capture(const char* capture_path, const stream_format format, const double speed,
+        const int output_fd, generator_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    const int capture_fd = open(capture_path, O_RDONLY);
+    struct stat capture_status;
+    if (0 > capture_fd || 0 != fstat(capture_fd, &capture_status))
+    {
+        LOG(ERROR, "Unable to open capture %s, errno %d.\n", capture_path, errno);
+        if (0 <= capture_fd)
+            close(capture_fd);
+        return 0;
+    }
+    const size_t capture_length = (size_t) capture_status.st_size;
+    if (0 == capture_length)
+    {
+        close(capture_fd);
+        return 1;
+    }
+    const char* capture = mmap(NULL, capture_length, PROT_READ, MAP_PRIVATE, capture_fd, 0);
+    close(capture_fd);
+    output_buffer* output = malloc(sizeof(output_buffer));
+    if (MAP_FAILED == capture || NULL == output)
+    {
+        LOG(ERROR, "Unable to map capture %s.\n", capture_path);
+        if (MAP_FAILED != capture)
+            munmap((void*) capture, capture_length);
+        free(output);
+        return 0;
+    }
+    initialise_output(output, output_fd);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int is_paced = 0;
+    uint64_t first_timestamp = 0;
+    uint64_t last_timestamp = 0;
+    int is_successful = 1;
+    size_t position = 0;
+    while (position < capture_length && is_successful)
+    {
+        // Next record, a whole struct or a line including its newline
+        const char* record = capture + position;
+        size_t record_length = sizeof(meter_reading);
+        if (FORMAT_NDJSON == format)
+        {
+            const char* newline = memchr(record, '\n', capture_length - position);
+            record_length = (NULL == newline) ? capture_length - position :
+                    (size_t) (newline - record) + 1;
+        }
+        else if (capture_length - position < record_length)
+        {
+            LOG(WARN, "Ignoring %zu trailing bytes of capture.\n", capture_length - position);
+            break;
+        }
+        position += record_length;
+        uint64_t timestamp = 0;
+        if (get_record_timestamp(record, record_length, format, &timestamp))
+        {
+            ++stats->readings;
+            if (!is_paced)
+            {
+                is_paced = 1;
+                first_timestamp = timestamp;
+                last_timestamp = timestamp;
+            }
+            else if (timestamp < last_timestamp)
+                ++stats->out_of_order;
+            else
+                last_timestamp = timestamp;
+            if (0.0 < speed)
+                is_successful = wait_until(output, &start,
+                        (double) (last_timestamp - first_timestamp) / speed);
+        }
+        else
+            ++stats->malformed;
+        is_successful = is_successful && write_output(output, record, record_length);
+    }
+    is_successful = is_successful && flush_output(output);
+    stats->bytes = output->bytes;
+    stats->seconds = get_elapsed_seconds(&start);
+    munmap((void*) capture, capture_length);
+    free(output);
+    return is_successful;
+}
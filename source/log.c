@@ -47,7 +47,7 @@ static const char* log_level_to_string(const log_level level)
 void set_log_level(const log_level new_level)
 {
     const char* current_level = log_level_to_string(_current_log_level);
-    fprintf(stdout, "%s Logging level changed from %s to %s.\n", 
+    fprintf(stderr, "%s Logging level changed from %s to %s.\n", 
             current_level,
             current_level, log_level_to_string(new_level));
     _current_log_level = new_level;
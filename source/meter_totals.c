@@ -0,0 +1,311 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "meter_totals.h"
+#include "energy_monitor.h"
+#include "process.h"
+#include "log.h"
+
+static size_t get_region_bytes(const uint64_t capacity)
+{
+    return sizeof(meter_totals_header) + (size_t) capacity * sizeof(meter_total);
+}
+
+static size_t get_home_slot(const uint64_t meter_id, const uint64_t capacity)
+{
+    // Fibonacci hashing, then the top 32 bits scaled to the capacity, no power of two required
+    const uint64_t hash = (meter_id * UINT64_C(0x9E3779B97F4A7C15)) >> 32;
+    return (size_t) ((hash * capacity) >> 32);
+}
+
+/**
+ * @brief Find the slot of a meter, or the empty slot where it would be inserted.
+ */
+static meter_total* find_slot(const meter_totals* totals, const uint64_t meter_id)
+{
+    const uint64_t capacity = totals->header->capacity;
+    size_t slot = get_home_slot(meter_id, capacity);
+    while (0 != totals->slots[slot].reading_count && meter_id != totals->slots[slot].meter_id)
+        slot = (slot + 1 == capacity) ? 0 : slot + 1;
+    return totals->slots + slot;
+}
+
+/**
+ * @brief Allocate a zeroed region, i.e., an empty table.
+ */
+static int allocate_region(meter_totals* totals, const uint64_t capacity)
+{
+    const size_t region_bytes = get_region_bytes(capacity);
+    meter_totals_header* header = calloc(1, region_bytes);
+    if (NULL == header)
+    {
+        LOG(ERROR, "Allocation of %zu bytes for %lu meters failed.\n", region_bytes, capacity);
+        return 0;
+    }
+    header->magic = METER_TOTALS_MAGIC;
+    header->version = METER_TOTALS_VERSION;
+    header->slot_bytes = sizeof(meter_total);
+    header->capacity = capacity;
+    totals->header = header;
+    totals->slots = (meter_total*) (header + 1);
+    totals->region_bytes = region_bytes;
+    totals->is_mapped = 0;
+    return 1;
+}
+
+/**
+ * @brief Double the capacity, reinserting every meter.
+ */
+static int grow_meter_totals(meter_totals* totals)
+{
+    meter_totals grown;
+    if (!allocate_region(&grown, 2 * totals->header->capacity))
+        return 0;
+    for (size_t slot = 0; slot < totals->header->capacity; ++slot)
+        if (0 != totals->slots[slot].reading_count)
+            *find_slot(&grown, totals->slots[slot].meter_id) = totals->slots[slot];
+    grown.header->size = totals->header->size;
+    grown.header->position = totals->header->position;
+    free_meter_totals(totals);
+    *totals = grown;
+    return 1;
+}
+
+int initialise_meter_totals(meter_totals* totals, const size_t expected_meters)
+{
+    uint64_t capacity = (uint64_t) expected_meters * METER_TOTALS_LOAD_DENOMINATOR /
+            METER_TOTALS_LOAD_NUMERATOR + 1;
+    if (METER_TOTALS_MIN_CAPACITY > capacity)
+        capacity = METER_TOTALS_MIN_CAPACITY;
+    return allocate_region(totals, capacity);
+}
+
+int load_meter_totals(meter_totals* totals, const char* path)
+{
+    const int fd = open(path, O_RDONLY);
+    if (0 > fd)
+    {
+        LOG(WARN, "No checkpoint at %s, errno %d.\n", path, errno);
+        return 0;
+    }
+    struct stat file_status;
+    meter_totals_header header;
+    if (0 != fstat(fd, &file_status) || sizeof(header) != pread(fd, &header, sizeof(header), 0))
+    {
+        LOG(ERROR, "Unable to read checkpoint %s.\n", path);
+        close(fd);
+        return 0;
+    }
+    // Capacity bounded before sizing the region, and size within the load bound
+    if (METER_TOTALS_MAGIC != header.magic || METER_TOTALS_VERSION != header.version ||
+            sizeof(meter_total) != header.slot_bytes ||
+            METER_TOTALS_MIN_CAPACITY > header.capacity ||
+            (uint64_t) file_status.st_size / sizeof(meter_total) < header.capacity ||
+            header.size > header.capacity || header.size * METER_TOTALS_LOAD_DENOMINATOR >
+                    header.capacity * METER_TOTALS_LOAD_NUMERATOR ||
+            get_region_bytes(header.capacity) != (size_t) file_status.st_size)
+    {
+        LOG(ERROR, "Invalid checkpoint %s.\n", path);
+        close(fd);
+        return 0;
+    }
+    // Private writable mapping, updates are copy-on-write and never reach the file
+    void* region = mmap(NULL, (size_t) file_status.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+            fd, 0);
+    close(fd);
+    if (MAP_FAILED == region)
+    {
+        LOG(ERROR, "Unable to map checkpoint %s, errno %d.\n", path, errno);
+        return 0;
+    }
+    totals->header = region;
+    totals->slots = (meter_total*) (totals->header + 1);
+    totals->region_bytes = (size_t) file_status.st_size;
+    totals->is_mapped = 1;
+    return 1;
+}
+
+void free_meter_totals(meter_totals* totals)
+{
+    if (NULL == totals->header)
+        return;
+    if (totals->is_mapped)
+        munmap(totals->header, totals->region_bytes);
+    else
+        free(totals->header);
+    totals->header = NULL;
+    totals->slots = NULL;
+    totals->region_bytes = 0;
+}
+
+int add_reading_to_meter_totals(meter_totals* totals, const meter_reading* reading)
+{
+    meter_total* total = find_slot(totals, reading->meter_id);
+    if (0 == total->reading_count)
+    {
+        meter_totals_header* header = totals->header;
+        if ((header->size + 1) * METER_TOTALS_LOAD_DENOMINATOR >
+                header->capacity * METER_TOTALS_LOAD_NUMERATOR)
+        {
+            if (!grow_meter_totals(totals))
+                return 0;
+            total = find_slot(totals, reading->meter_id);
+        }
+        total->meter_id = reading->meter_id;
+        ++totals->header->size;
+    }
+    const usage_snapshot* snapshot = &reading->snapshot;
+    ++total->reading_count;
+    if (snapshot->timestamp > total->last_timestamp)
+        total->last_timestamp = snapshot->timestamp;
+    if (snapshot->status & bitmask_electric_usage)
+        total->electric_usage += snapshot->electric_usage;
+    if (snapshot->status & bitmask_electric_cost)
+        total->electric_cost += snapshot->electric_cost;
+    if (snapshot->status & bitmask_gas_usage)
+        total->gas_usage += snapshot->gas_usage;
+    if (snapshot->status & bitmask_gas_cost)
+        total->gas_cost += snapshot->gas_cost;
+    return 1;
+}
+
+int add_readings_to_meter_totals(meter_totals* totals, const meter_reading* readings,
+        const size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+        if (!add_reading_to_meter_totals(totals, readings + i))
+            return 0;
+    return 1;
+}
+
+void set_meter_totals_position(meter_totals* totals, const store_position* position)
+{
+    totals->header->position = *position;
+}
+
+const meter_total* find_meter_total(const meter_totals* totals, const uint64_t meter_id)
+{
+    const meter_total* total = find_slot(totals, meter_id);
+    return (0 == total->reading_count) ? NULL : total;
+}
+
+int initialise_checkpoint_writer(checkpoint_writer* writer, const char* path,
+        const uint64_t interval_seconds)
+{
+    const int length = snprintf(writer->temporary_path, MAX_CHECKPOINT_PATH_CHARACTERS, "%s%s",
+            path, CHECKPOINT_TEMPORARY_SUFFIX);
+    if (0 > length || MAX_CHECKPOINT_PATH_CHARACTERS <= length)
+    {
+        LOG(ERROR, "Checkpoint path %s too long.\n", path);
+        return 0;
+    }
+    memcpy(writer->path, path, strlen(path) + 1);
+    writer->interval_seconds = interval_seconds;
+    writer->last_started = time(NULL);
+    writer->pid = 0;
+    writer->completed = 0;
+    writer->failed = 0;
+    return 1;
+}
+
+/**
+ * @brief Write a region to the temporary path and rename it over the checkpoint path.
+ * Runs in the forked child, so only async-signal-safe calls are made.
+ */
+static int write_checkpoint_file(const checkpoint_writer* writer, const void* region,
+        size_t length)
+{
+    const int fd = open(writer->temporary_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (0 > fd)
+        return 0;
+    const char* bytes = region;
+    while (0 < length)
+    {
+        const ssize_t written = write(fd, bytes, length);
+        if (0 > written && EINTR == errno)
+            continue;
+        if (0 >= written)
+        {
+            close(fd);
+            return 0;
+        }
+        bytes += written;
+        length -= (size_t) written;
+    }
+    const int is_synced = (0 == fsync(fd));
+    return (0 == close(fd)) && is_synced && 0 == rename(writer->temporary_path, writer->path);
+}
+
+int start_checkpoint(checkpoint_writer* writer, const meter_totals* totals)
+{
+    if (0 != writer->pid)
+        return 0;
+    writer->last_started = time(NULL);
+    // Copy-on-write, the child holds the table as of the fork while ingest continues
+    const pid_t pid = fork();
+    if (has_failed(pid))
+    {
+        LOG(ERROR, "Checkpoint fork failed, errno %d.\n", errno);
+        ++writer->failed;
+        return 0;
+    }
+    if (is_child(pid))
+        _exit(write_checkpoint_file(writer, totals->header, totals->region_bytes) ?
+                EXIT_SUCCESS : EXIT_FAILURE);
+    writer->pid = pid;
+    return 1;
+}
+
+/**
+ * @brief Account for a reaped checkpoint child.
+ */
+static int complete_checkpoint(checkpoint_writer* writer, const int status)
+{
+    writer->pid = 0;
+    if (is_child_process_exit_success(status, EXIT_SUCCESS))
+    {
+        ++writer->completed;
+        return 1;
+    }
+    LOG(ERROR, "Checkpoint %s failed, exit status %d.\n", writer->path,
+            get_child_process_exit_status(status));
+    ++writer->failed;
+    return 0;
+}
+
+int poll_checkpoint(checkpoint_writer* writer, const meter_totals* totals)
+{
+    int status = 0;
+    if (0 != writer->pid && writer->pid == waitpid(writer->pid, &status, WNOHANG))
+        complete_checkpoint(writer, status);
+    if (0 != writer->pid ||
+            (uint64_t) (time(NULL) - writer->last_started) < writer->interval_seconds)
+        return 0;
+    return start_checkpoint(writer, totals);
+}
+
+int finish_checkpoint(checkpoint_writer* writer)
+{
+    if (0 == writer->pid)
+        return 1;
+    int status = 0;
+    if (writer->pid != suspend_and_wait_for_child_process_status(writer->pid, &status))
+    {
+        LOG(ERROR, "Unable to wait for checkpoint %s, errno %d.\n", writer->path, errno);
+        writer->pid = 0;
+        ++writer->failed;
+        return 0;
+    }
+    return complete_checkpoint(writer, status);
+}
@@ -0,0 +1,96 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packed_snapshot.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+/**
+ * @brief Checks if a value fits the packed fixed-point range.
+ * @param value value to check.
+ * @return 1 (true) if the value can be packed.
+ */
+static int is_packable_value(const double value)
+{
+    const double scaled = value * PACKED_SNAPSHOT_SCALE;
+    return (double) INT32_MIN <= scaled && (double) INT32_MAX >= scaled;
+}
+
+/**
+ * @brief Convert a value to fixed-point, rounding half away from zero.
+ * @param value value in range, see is_packable_value().
+ * @return fixed-point value.
+ */
+static int32_t to_fixed_point(const double value)
+{
+    const double scaled = value * PACKED_SNAPSHOT_SCALE;
+    return (int32_t) (scaled + ((0.0 > scaled) ? -0.5 : 0.5));
+}
+
+/**
+ * @brief Convert a fixed-point value back to floating point.
+ * @param value fixed-point value.
+ * @return floating point value.
+ */
+static double from_fixed_point(const int32_t value)
+{
+    return (double) value / PACKED_SNAPSHOT_SCALE;
+}
+
+pack_error pack_snapshot(const usage_snapshot* snapshot, const uint64_t base_timestamp,
+        packed_usage_snapshot* packed)
+{
+    if (base_timestamp > snapshot->timestamp ||
+            PACKED_SNAPSHOT_MAX_OFFSET < snapshot->timestamp - base_timestamp)
+    {
+        LOG(DEBUG, "Timestamp %lu out of range of block base %lu.\n",
+                (unsigned long) snapshot->timestamp, (unsigned long) base_timestamp);
+        return PACK_TIMESTAMP_OUT_OF_RANGE;
+    }
+    if (!is_packable_value(snapshot->electric_usage) ||
+            !is_packable_value(snapshot->electric_cost) ||
+            !is_packable_value(snapshot->gas_usage) ||
+            !is_packable_value(snapshot->gas_cost))
+    {
+        LOG(DEBUG, "Value out of packed range at timestamp %lu.\n",
+                (unsigned long) snapshot->timestamp);
+        return PACK_VALUE_OUT_OF_RANGE;
+    }
+    const uint32_t offset = (uint32_t) (snapshot->timestamp - base_timestamp);
+    const uint32_t status = snapshot->status & PACKED_SNAPSHOT_STATUS_MASK;
+    packed->offset_and_status = offset | (status << PACKED_SNAPSHOT_OFFSET_BITS);
+    packed->electric_usage = to_fixed_point(snapshot->electric_usage);
+    packed->electric_cost = to_fixed_point(snapshot->electric_cost);
+    packed->gas_usage = to_fixed_point(snapshot->gas_usage);
+    packed->gas_cost = to_fixed_point(snapshot->gas_cost);
+    return PACK_OK;
+}
+
+void unpack_snapshot(const packed_usage_snapshot* packed, const uint64_t base_timestamp,
+        usage_snapshot* snapshot)
+{
+    snapshot->timestamp = base_timestamp + get_packed_offset(packed);
+    snapshot->electric_usage = from_fixed_point(packed->electric_usage);
+    snapshot->electric_cost = from_fixed_point(packed->electric_cost);
+    snapshot->gas_usage = from_fixed_point(packed->gas_usage);
+    snapshot->gas_cost = from_fixed_point(packed->gas_cost);
+    snapshot->status = get_packed_status(packed);
+}
+
+size_t pack_snapshots(const usage_snapshot* snapshots, const size_t count,
+        const uint64_t base_timestamp, packed_usage_snapshot* packed, pack_error* error)
+{
+    size_t packed_count = 0;
+    *error = PACK_OK;
+    while (packed_count < count && PACK_OK == (*error = pack_snapshot(snapshots + packed_count,
+            base_timestamp, packed + packed_count)))
+        ++packed_count;
+    return packed_count;
+}
+
+void unpack_snapshots(const packed_usage_snapshot* packed, const size_t count,
+        const uint64_t base_timestamp, usage_snapshot* snapshots)
+{
+    for (size_t i = 0; i < count; ++i)
+        unpack_snapshot(packed + i, base_timestamp, snapshots + i);
+}
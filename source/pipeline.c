@@ -0,0 +1,538 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "batch_queue.h"
+#include "ingestor.h"
+#include "log.h"
+
+/**
+ * @brief Raw NDJSON chunk, holds whole lines only unless a line exceeds the chunk.
+ */
+typedef struct
+{
+    char data[PIPELINE_CHUNK_BYTES];
+    size_t length;
+} raw_chunk;
+
+/**
+ * @brief Where threads block on a queue once their spin is over, woken by pushes to it.
+ */
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    size_t waiters;
+} wait_point;
+
+/**
+ * @brief A queue and the threads blocked on it.
+ */
+typedef struct
+{
+    batch_queue queue;
+    wait_point wait;
+} pipeline_queue;
+
+/**
+ * @brief State shared by every thread of a pipeline run.
+ */
+typedef struct
+{
+    const pipeline_config* config;
+    pipeline_queue free_chunks;
+    pipeline_queue full_chunks;
+    pipeline_queue free_batches;
+    pipeline_queue full_batches;
+    size_t active_readers;
+    size_t active_parsers;
+} pipeline;
+
+/**
+ * @brief Per thread state, statistics are merged after the thread is joined.
+ */
+typedef struct
+{
+    pipeline* shared;
+    int input_fd;
+    pthread_t thread;
+    stage_stats stage;
+    queue_stats input_queue;
+    uint64_t parse_errors;
+} stage_worker;
+
+/**
+ * @brief Wake the threads blocked on a queue, after a push to it or the end of its upstream.
+ * The fence pairs with the one in block_on_queue(): either the waiter sees the change, or
+ * this sees the waiter, so a wakeup is never lost. No system call while nobody waits.
+ */
+static void wake_waiters(pipeline_queue* queue)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 == __atomic_load_n(&queue->wait.waiters, __ATOMIC_RELAXED))
+        return;
+    pthread_mutex_lock(&queue->wait.mutex);
+    pthread_cond_broadcast(&queue->wait.condition);
+    pthread_mutex_unlock(&queue->wait.mutex);
+}
+
+/**
+ * @brief Block until the queue holds an item, or its upstream has finished.
+ * @param active_upstream count of upstream threads still producing, NULL for a pool.
+ */
+static void block_on_queue(pipeline_queue* queue, size_t* active_upstream,
+        stage_worker* worker)
+{
+    ++worker->stage.blocks;
+    pthread_mutex_lock(&queue->wait.mutex);
+    __atomic_add_fetch(&queue->wait.waiters, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (0 == get_batch_queue_occupancy(&queue->queue) && (NULL == active_upstream ||
+            0 != __atomic_load_n(active_upstream, __ATOMIC_ACQUIRE)))
+        pthread_cond_wait(&queue->wait.condition, &queue->wait.mutex);
+    __atomic_sub_fetch(&queue->wait.waiters, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&queue->wait.mutex);
+}
+
+/**
+ * @brief Wait for a queue after a failed pop, yielding PIPELINE_SPIN_WAITS times then blocking.
+ * @param spins waits so far, reset once the thread has blocked.
+ */
+static void wait_on_queue(pipeline_queue* queue, size_t* active_upstream, stage_worker* worker,
+        size_t* spins)
+{
+    if (PIPELINE_SPIN_WAITS > ++*spins)
+    {
+        sched_yield();
+        return;
+    }
+    block_on_queue(queue, active_upstream, worker);
+    *spins = 0;
+}
+
+/**
+ * @brief Pop a batch, waiting while the queue is empty and the upstream stage is running.
+ * @param queue queue to pop from.
+ * @param active_upstream count of upstream threads still producing.
+ * @param worker worker to charge waits and occupancy samples to.
+ * @return the batch, NULL once the upstream has finished and the queue is drained.
+ */
+static void* pop_or_wait(pipeline_queue* queue, size_t* active_upstream, stage_worker* worker)
+{
+    size_t spins = 0;
+    for (;;)
+    {
+        const size_t occupancy = get_batch_queue_occupancy(&queue->queue);
+        void* batch = try_pop_batch(&queue->queue);
+        if (NULL != batch)
+        {
+            ++worker->input_queue.samples;
+            worker->input_queue.occupancy_sum += occupancy;
+            if (occupancy > worker->input_queue.max_occupancy)
+                worker->input_queue.max_occupancy = occupancy;
+            return batch;
+        }
+        // Upstream pushes happen before its count drops, so one more pop after
+        // seeing zero observes everything pushed.
+        if (0 == __atomic_load_n(active_upstream, __ATOMIC_ACQUIRE))
+            return try_pop_batch(&queue->queue);
+        ++worker->stage.idle_waits;
+        wait_on_queue(queue, active_upstream, worker, &spins);
+    }
+}
+
+/**
+ * @brief Pop a free chunk or batch from a pool, waiting while downstream holds them all.
+ * @param pool pool to take from.
+ * @param worker worker to charge stalls to.
+ * @return the free item.
+ */
+static void* acquire_or_stall(pipeline_queue* pool, stage_worker* worker)
+{
+    size_t spins = 0;
+    void* item = NULL;
+    while (NULL == (item = try_pop_batch(&pool->queue)))
+    {
+        ++worker->stage.stalls;
+        wait_on_queue(pool, NULL, worker, &spins);
+    }
+    return item;
+}
+
+/**
+ * @brief Push to a queue, waiting while it is full, then wake any thread blocked on it.
+ * Queues are sized to their pool so this only waits on a transient race.
+ */
+static void push_or_stall(pipeline_queue* queue, void* item, stage_worker* worker)
+{
+    while (!try_push_batch(&queue->queue, item))
+    {
+        ++worker->stage.stalls;
+        sched_yield();
+    }
+    wake_waiters(queue);
+}
+
+/**
+ * @brief Mark a thread of a stage finished, waking the downstream threads blocked on it.
+ */
+static void finish_stage_thread(size_t* active_threads, pipeline_queue* downstream)
+{
+    __atomic_sub_fetch(active_threads, 1, __ATOMIC_RELEASE);
+    wake_waiters(downstream);
+}
+
+/**
+ * @brief Reader stage, reads its input into chunks cut at the last newline.
+ * The partial line after the last newline is carried into the next chunk.
+ */
+static void* run_reader(void* argument)
+{
+    stage_worker* worker = argument;
+    pipeline* shared = worker->shared;
+    raw_chunk* chunk = acquire_or_stall(&shared->free_chunks, worker);
+    chunk->length = 0;
+    int is_end_of_file = 0;
+    while (!is_end_of_file)
+    {
+        const ssize_t bytes_read = read(worker->input_fd, chunk->data + chunk->length,
+                PIPELINE_CHUNK_BYTES - chunk->length);
+        if (0 > bytes_read && EINTR == errno)
+            continue;
+        if (0 > bytes_read)
+            LOG(ERROR, "Read of input %d failed, errno %d.\n", worker->input_fd, errno);
+        is_end_of_file = (0 >= bytes_read);
+        chunk->length += (0 < bytes_read) ? (size_t) bytes_read : 0;
+        if (!is_end_of_file && PIPELINE_CHUNK_BYTES > chunk->length)
+            continue;
+        // Cut at the last newline, unless at end of file or the line fills the chunk
+        size_t cut = chunk->length;
+        if (!is_end_of_file)
+        {
+            const char* data = chunk->data;
+            while (0 < cut && '\n' != data[cut - 1])
+                --cut;
+            if (0 == cut)
+                cut = chunk->length;
+        }
+        if (0 == cut)
+            break;
+        raw_chunk* next = acquire_or_stall(&shared->free_chunks, worker);
+        next->length = chunk->length - cut;
+        memcpy(next->data, chunk->data + cut, next->length);
+        chunk->length = cut;
+        push_or_stall(&shared->full_chunks, chunk, worker);
+        ++worker->stage.batches;
+        worker->stage.records += cut;
+        chunk = next;
+    }
+    push_or_stall(&shared->free_chunks, chunk, worker);
+    finish_stage_thread(&shared->active_readers, &shared->full_chunks);
+    return NULL;
+}
+
+/**
+ * @brief Parse NDJSON into a batch, of snapshots or of meter readings as configured.
+ * @return number of documents parsed, the batch count.
+ */
+static size_t parse_batch(const pipeline* shared, const char* json, const size_t json_length,
+        void* batch, size_t* bytes_consumed, stage_worker* worker)
+{
+    const ingest_error* errors = NULL;
+    size_t count = 0;
+    if (NULL == shared->config->reading_consumer)
+    {
+        snapshot_batch* snapshots = batch;
+        count = snapshots->count = parse_usage_ndjson(json, json_length, snapshots->snapshots,
+                snapshots->errors, PIPELINE_BATCH_SNAPSHOTS, bytes_consumed);
+        errors = snapshots->errors;
+    }
+    else
+    {
+        meter_reading_batch* readings = batch;
+        count = readings->count = parse_meter_reading_ndjson(json, json_length,
+                readings->readings, readings->errors, PIPELINE_BATCH_SNAPSHOTS, bytes_consumed);
+        errors = readings->errors;
+    }
+    for (size_t i = 0; i < count; ++i)
+        worker->parse_errors += (INGEST_OK != errors[i]);
+    return count;
+}
+
+/**
+ * @brief Parser stage, parses chunks into snapshot or meter reading batches.
+ */
+static void* run_parser(void* argument)
+{
+    stage_worker* worker = argument;
+    pipeline* shared = worker->shared;
+    raw_chunk* chunk = NULL;
+    while (NULL != (chunk = pop_or_wait(&shared->full_chunks, &shared->active_readers, worker)))
+    {
+        size_t position = 0;
+        while (position < chunk->length)
+        {
+            void* batch = acquire_or_stall(&shared->free_batches, worker);
+            size_t bytes_consumed = 0;
+            const size_t count = parse_batch(shared, chunk->data + position,
+                    chunk->length - position, batch, &bytes_consumed, worker);
+            position += bytes_consumed;
+            if (0 == count)
+            {
+                push_or_stall(&shared->free_batches, batch, worker);
+                continue;
+            }
+            ++worker->stage.batches;
+            worker->stage.records += count;
+            push_or_stall(&shared->full_batches, batch, worker);
+        }
+        push_or_stall(&shared->free_chunks, chunk, worker);
+    }
+    finish_stage_thread(&shared->active_parsers, &shared->full_batches);
+    return NULL;
+}
+
+/**
+ * @brief Sink stage, hands batches to the consumer.
+ */
+static void* run_sink(void* argument)
+{
+    stage_worker* worker = argument;
+    pipeline* shared = worker->shared;
+    const pipeline_config* config = shared->config;
+    void* batch = NULL;
+    while (NULL != (batch = pop_or_wait(&shared->full_batches, &shared->active_parsers, worker)))
+    {
+        size_t count = 0;
+        if (NULL == config->reading_consumer)
+        {
+            config->consumer(batch, config->consumer_context);
+            count = ((const snapshot_batch*) batch)->count;
+        }
+        else
+        {
+            config->reading_consumer(batch, config->consumer_context);
+            count = ((const meter_reading_batch*) batch)->count;
+        }
+        ++worker->stage.batches;
+        worker->stage.records += count;
+        push_or_stall(&shared->free_batches, batch, worker);
+    }
+    return NULL;
+}
+
+static void merge_stage_stats(stage_stats* total, const stage_stats* part)
+{
+    total->batches += part->batches;
+    total->records += part->records;
+    total->stalls += part->stalls;
+    total->idle_waits += part->idle_waits;
+    total->blocks += part->blocks;
+}
+
+static void merge_queue_stats(queue_stats* total, const queue_stats* part)
+{
+    total->samples += part->samples;
+    total->occupancy_sum += part->occupancy_sum;
+    if (part->max_occupancy > total->max_occupancy)
+        total->max_occupancy = part->max_occupancy;
+}
+
+static int initialise_pipeline_queue(pipeline_queue* queue, const size_t capacity)
+{
+    queue->wait.waiters = 0;
+    if (0 != pthread_mutex_init(&queue->wait.mutex, NULL))
+        return 0;
+    if (0 != pthread_cond_init(&queue->wait.condition, NULL))
+    {
+        pthread_mutex_destroy(&queue->wait.mutex);
+        return 0;
+    }
+    if (!initialise_batch_queue(&queue->queue, capacity))
+    {
+        pthread_cond_destroy(&queue->wait.condition);
+        pthread_mutex_destroy(&queue->wait.mutex);
+        return 0;
+    }
+    return 1;
+}
+
+static void free_pipeline_queue(pipeline_queue* queue)
+{
+    if (NULL == queue->queue.cells)
+        return;
+    free_batch_queue(&queue->queue);
+    pthread_cond_destroy(&queue->wait.condition);
+    pthread_mutex_destroy(&queue->wait.mutex);
+}
+
+/**
+ * @brief Get the chunk queue capacity, the smallest power of two holding every chunk.
+ */
+static size_t get_chunk_queue_capacity(const size_t chunk_count)
+{
+    size_t capacity = PIPELINE_POOL_SIZE;
+    while (capacity < chunk_count)
+        capacity *= 2;
+    return capacity;
+}
+
+/**
+ * @brief Create the queues and fill the pools with chunks and batches.
+ * @param chunks chunk storage, chunk_count items.
+ * @param chunk_count number of chunks, PIPELINE_POOL_SIZE plus one per reader.
+ * @param batches batch storage, PIPELINE_POOL_SIZE items of batch_bytes.
+ * @param batch_bytes size of a batch, of snapshots or of meter readings.
+ * @return 1 (true) if successful.
+ */
+static int initialise_pipeline(pipeline* shared, raw_chunk* chunks, const size_t chunk_count,
+        char* batches, const size_t batch_bytes)
+{
+    const size_t chunk_capacity = get_chunk_queue_capacity(chunk_count);
+    if (!initialise_pipeline_queue(&shared->free_chunks, chunk_capacity) ||
+            !initialise_pipeline_queue(&shared->full_chunks, chunk_capacity) ||
+            !initialise_pipeline_queue(&shared->free_batches, PIPELINE_POOL_SIZE) ||
+            !initialise_pipeline_queue(&shared->full_batches, PIPELINE_POOL_SIZE))
+        return 0;
+    for (size_t i = 0; i < chunk_count; ++i)
+        try_push_batch(&shared->free_chunks.queue, chunks + i);
+    for (size_t i = 0; i < PIPELINE_POOL_SIZE; ++i)
+        try_push_batch(&shared->free_batches.queue, batches + i * batch_bytes);
+    return 1;
+}
+
+static void free_pipeline(pipeline* shared)
+{
+    free_pipeline_queue(&shared->free_chunks);
+    free_pipeline_queue(&shared->full_chunks);
+    free_pipeline_queue(&shared->free_batches);
+    free_pipeline_queue(&shared->full_batches);
+}
+
+/**
+ * @brief Start the threads of a stage.
+ * @return number of threads started, less than count on failure.
+ */
+static size_t start_stage(stage_worker* workers, const size_t count, void* (*routine)(void*))
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (0 != pthread_create(&workers[i].thread, NULL, routine, workers + i))
+        {
+            LOG(ERROR, "Unable to start stage thread %zu.\n", i);
+            return i;
+        }
+    }
+    return count;
+}
+
+int run_pipeline(const pipeline_config* config, pipeline_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (0 == config->input_count || MAX_STAGE_THREADS < config->input_count ||
+            0 == config->parser_count || MAX_STAGE_THREADS < config->parser_count ||
+            0 == config->sink_count || MAX_STAGE_THREADS < config->sink_count ||
+            (NULL == config->consumer) == (NULL == config->reading_consumer))
+    {
+        LOG(ERROR, "Pipeline requires 1 to %d threads per stage and one consumer.\n",
+                MAX_STAGE_THREADS);
+        return 0;
+    }
+    pipeline shared;
+    memset(&shared, 0, sizeof(shared));
+    shared.config = config;
+    shared.active_readers = config->input_count;
+    shared.active_parsers = config->parser_count;
+    // Every reader holds the chunk it is filling while it waits for the next, the extra chunk
+    // per reader stops readers holding the whole pool and deadlocking
+    const size_t chunk_count = PIPELINE_POOL_SIZE + config->input_count;
+    raw_chunk* chunks = malloc(sizeof(raw_chunk) * chunk_count);
+    const size_t batch_bytes = (NULL == config->reading_consumer) ? sizeof(snapshot_batch) :
+            sizeof(meter_reading_batch);
+    char* batches = malloc(batch_bytes * PIPELINE_POOL_SIZE);
+    const size_t worker_count = config->input_count + config->parser_count + config->sink_count;
+    stage_worker* workers = calloc(worker_count, sizeof(stage_worker));
+    if (NULL == chunks || NULL == batches || NULL == workers ||
+            !initialise_pipeline(&shared, chunks, chunk_count, batches, batch_bytes))
+    {
+        LOG(ERROR, "Pipeline allocation failed.\n");
+        free_pipeline(&shared);
+        free(chunks);
+        free(batches);
+        free(workers);
+        return 0;
+    }
+    stage_worker* readers = workers;
+    stage_worker* parsers = readers + config->input_count;
+    stage_worker* sinks = parsers + config->parser_count;
+    for (size_t i = 0; i < worker_count; ++i)
+        workers[i].shared = &shared;
+    for (size_t i = 0; i < config->input_count; ++i)
+        readers[i].input_fd = config->input_fds[i];
+    // Start downstream first, so readers never wait on a stage that is not yet running.
+    // A stage that fails to start is accounted as finished, so the others still drain.
+    const size_t sinks_started = start_stage(sinks, config->sink_count, run_sink);
+    const size_t parsers_started = start_stage(parsers, config->parser_count, run_parser);
+    __atomic_sub_fetch(&shared.active_parsers, config->parser_count - parsers_started,
+            __ATOMIC_RELEASE);
+    wake_waiters(&shared.full_batches);
+    const size_t readers_started = (0 < sinks_started && 0 < parsers_started) ?
+            start_stage(readers, config->input_count, run_reader) : 0;
+    __atomic_sub_fetch(&shared.active_readers, config->input_count - readers_started,
+            __ATOMIC_RELEASE);
+    wake_waiters(&shared.full_chunks);
+    for (size_t i = 0; i < readers_started; ++i)
+    {
+        pthread_join(readers[i].thread, NULL);
+        merge_stage_stats(&stats->reader, &readers[i].stage);
+    }
+    for (size_t i = 0; i < parsers_started; ++i)
+    {
+        pthread_join(parsers[i].thread, NULL);
+        merge_stage_stats(&stats->parser, &parsers[i].stage);
+        merge_queue_stats(&stats->chunk_queue, &parsers[i].input_queue);
+        stats->parse_errors += parsers[i].parse_errors;
+    }
+    for (size_t i = 0; i < sinks_started; ++i)
+    {
+        pthread_join(sinks[i].thread, NULL);
+        merge_stage_stats(&stats->sink, &sinks[i].stage);
+        merge_queue_stats(&stats->batch_queue, &sinks[i].input_queue);
+    }
+    free_pipeline(&shared);
+    free(chunks);
+    free(batches);
+    free(workers);
+    return readers_started == config->input_count && parsers_started == config->parser_count &&
+            sinks_started == config->sink_count;
+}
+
+static double get_mean_occupancy(const queue_stats* queue)
+{
+    return (0 == queue->samples) ? 0.0 : (double) queue->occupancy_sum / (double) queue->samples;
+}
+
+void log_pipeline_stats(const pipeline_stats* stats)
+{
+    const stage_stats* stages[] = {&stats->reader, &stats->parser, &stats->sink};
+    const char* names[] = {"reader", "parser", "sink"};
+    for (size_t i = 0; i < 3; ++i)
+        LOG(INFO, "Stage %-6s: batches %llu, records %llu, stalls %llu, idle waits %llu, "
+                "blocks %llu.\n", names[i], (unsigned long long) stages[i]->batches,
+                (unsigned long long) stages[i]->records, (unsigned long long) stages[i]->stalls,
+                (unsigned long long) stages[i]->idle_waits,
+                (unsigned long long) stages[i]->blocks);
+    LOG(INFO, "Chunk queue occupancy: mean %.2f, max %llu of %d plus one per reader.\n",
+            get_mean_occupancy(&stats->chunk_queue),
+            (unsigned long long) stats->chunk_queue.max_occupancy, PIPELINE_POOL_SIZE);
+    LOG(INFO, "Batch queue occupancy: mean %.2f, max %llu of %d.\n",
+            get_mean_occupancy(&stats->batch_queue),
+            (unsigned long long) stats->batch_queue.max_occupancy, PIPELINE_POOL_SIZE);
+    LOG(INFO, "Parse errors: %llu.\n", (unsigned long long) stats->parse_errors);
+}
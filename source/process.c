@@ -0,0 +1,30 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "process.h"
+
+pid_t suspend_and_wait_for_child_process_status(const pid_t pid, int* status)
+{
+    pid_t reaped = waitpid(pid, status, 0);
+    while (0 > reaped && EINTR == errno)
+        reaped = waitpid(pid, status, 0);
+    return reaped;
+}
+
+int is_child_process_exit_success(const int status, const int success_status)
+{
+    return WIFEXITED(status) && success_status == WEXITSTATUS(status);
+}
+
+int is_child_process_exit_failed(const int status, const int success_status)
+{
+    return !is_child_process_exit_success(status, success_status);
+}
+
+int get_child_process_exit_status(const int status)
+{
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
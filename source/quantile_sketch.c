@@ -0,0 +1,205 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "quantile_sketch.h"
+#include "energy_monitor.h"
+
+/**
+ * @brief Get the bucket index of a positive value.
+ * @param value value above QUANTILE_SKETCH_MIN_VALUE.
+ * @return bucket index.
+ */
+static int32_t get_bucket_index(const double value)
+{
+    // Constant, folded by the compiler when optimising
+    const double inverse_log_gamma = 1.0 / log((1.0 + QUANTILE_SKETCH_ACCURACY) /
+            (1.0 - QUANTILE_SKETCH_ACCURACY));
+    return (int32_t) ceil(log(value) * inverse_log_gamma);
+}
+
+/**
+ * @brief Get the representative value of a bucket, within the accuracy of all its values.
+ * @param index bucket index.
+ * @return the value.
+ */
+static double get_bucket_value(const int32_t index)
+{
+    const double gamma = (1.0 + QUANTILE_SKETCH_ACCURACY) / (1.0 - QUANTILE_SKETCH_ACCURACY);
+    return 2.0 * pow(gamma, (double) index) / (gamma + 1.0);
+}
+
+static int has_buckets(const quantile_sketch* sketch)
+{
+    return sketch->count > sketch->zero_count;
+}
+
+/**
+ * @brief Slide the bucket window up so its top bucket is index.
+ * Buckets falling below the window are collapsed into the new lowest bucket.
+ */
+static void slide_window(quantile_sketch* sketch, const int32_t index)
+{
+    const int32_t new_offset = index - QUANTILE_SKETCH_BUCKETS + 1;
+    const int32_t shift = new_offset - sketch->offset;
+    if (QUANTILE_SKETCH_BUCKETS <= shift)
+    {
+        uint64_t collapsed = 0;
+        for (size_t i = 0; i < QUANTILE_SKETCH_BUCKETS; ++i)
+            collapsed += sketch->counts[i];
+        memset(sketch->counts, 0, sizeof(sketch->counts));
+        sketch->counts[0] = collapsed;
+    }
+    else
+    {
+        uint64_t collapsed = 0;
+        for (int32_t i = 0; i <= shift; ++i)
+            collapsed += sketch->counts[i];
+        memmove(sketch->counts, sketch->counts + shift,
+                sizeof(uint64_t) * (size_t) (QUANTILE_SKETCH_BUCKETS - shift));
+        memset(sketch->counts + QUANTILE_SKETCH_BUCKETS - shift, 0, sizeof(uint64_t) * (size_t) shift);
+        sketch->counts[0] = collapsed;
+    }
+    sketch->offset = new_offset;
+}
+
+/**
+ * @brief Add a weight to a bucket, sliding the window as required.
+ */
+static void add_to_bucket(quantile_sketch* sketch, const int32_t index, const uint64_t weight)
+{
+    if (index >= sketch->offset + QUANTILE_SKETCH_BUCKETS)
+        slide_window(sketch, index);
+    const int32_t position = (index < sketch->offset) ? 0 : index - sketch->offset;
+    sketch->counts[position] += weight;
+}
+
+void initialise_quantile_sketch(quantile_sketch* sketch)
+{
+    memset(sketch, 0, sizeof(*sketch));
+    sketch->min = INFINITY;
+    sketch->max = -INFINITY;
+}
+
+void add_to_quantile_sketch(quantile_sketch* sketch, const double value)
+{
+    if (QUANTILE_SKETCH_MIN_VALUE < value)
+    {
+        const int32_t index = get_bucket_index(value);
+        // First bucket, the top of the window. The window then always ends at the highest
+        // bucket, so it depends only on the values added, not their order or thread.
+        if (!has_buckets(sketch))
+            sketch->offset = index - QUANTILE_SKETCH_BUCKETS + 1;
+        add_to_bucket(sketch, index, 1);
+    }
+    else
+        ++sketch->zero_count;
+    ++sketch->count;
+    sketch->sum += value;
+    if (value < sketch->min)
+        sketch->min = value;
+    if (value > sketch->max)
+        sketch->max = value;
+}
+
+void merge_quantile_sketch(quantile_sketch* sketch, const quantile_sketch* other)
+{
+    if (0 == other->count)
+        return;
+    // First buckets, take the window of the other sketch
+    if (!has_buckets(sketch))
+        sketch->offset = other->offset;
+    // Merge the highest buckets first, so the window slides at most once
+    for (int32_t i = QUANTILE_SKETCH_BUCKETS - 1; 0 <= i; --i)
+    {
+        if (0 == other->counts[i])
+            continue;
+        add_to_bucket(sketch, other->offset + i, other->counts[i]);
+        sketch->count += other->counts[i];
+    }
+    sketch->zero_count += other->zero_count;
+    sketch->count += other->zero_count;
+    sketch->sum += other->sum;
+    if (other->min < sketch->min)
+        sketch->min = other->min;
+    if (other->max > sketch->max)
+        sketch->max = other->max;
+}
+
+double get_quantile(const quantile_sketch* sketch, const double quantile)
+{
+    if (0 == sketch->count)
+        return 0.0;
+    const double clamped_quantile = (0.0 > quantile) ? 0.0 : (1.0 < quantile) ? 1.0 : quantile;
+    const uint64_t rank = (uint64_t) (clamped_quantile * (double) (sketch->count - 1));
+    if (rank < sketch->zero_count)
+        return (0.0 < sketch->min) ? sketch->min : 0.0;
+    uint64_t cumulative = sketch->zero_count;
+    double value = sketch->max;
+    for (int32_t i = 0; i < QUANTILE_SKETCH_BUCKETS; ++i)
+    {
+        cumulative += sketch->counts[i];
+        if (cumulative > rank)
+        {
+            value = get_bucket_value(sketch->offset + i);
+            break;
+        }
+    }
+    // The exact extremes are known, never report beyond them
+    return (value < sketch->min) ? sketch->min : (value > sketch->max) ? sketch->max : value;
+}
+
+void initialise_usage_sketch(usage_sketch* sketch)
+{
+    initialise_quantile_sketch(&sketch->electric_usage);
+    initialise_quantile_sketch(&sketch->gas_usage);
+}
+
+void add_snapshot_to_usage_sketch(usage_sketch* sketch, const usage_snapshot* snapshot)
+{
+    if (snapshot->status & bitmask_electric_usage)
+        add_to_quantile_sketch(&sketch->electric_usage, snapshot->electric_usage);
+    if (snapshot->status & bitmask_gas_usage)
+        add_to_quantile_sketch(&sketch->gas_usage, snapshot->gas_usage);
+}
+
+void merge_usage_sketch(usage_sketch* sketch, const usage_sketch* other)
+{
+    merge_quantile_sketch(&sketch->electric_usage, &other->electric_usage);
+    merge_quantile_sketch(&sketch->gas_usage, &other->gas_usage);
+}
+
+void initialise_windowed_usage_sketch(windowed_usage_sketch* sketch, const uint64_t period_seconds)
+{
+    sketch->period_seconds = (0 == period_seconds) ? 1 : period_seconds;
+    sketch->newest_period = 0;
+    for (size_t i = 0; i < QUANTILE_WINDOW_PERIODS; ++i)
+        initialise_usage_sketch(sketch->periods + i);
+}
+
+void add_snapshot_to_windowed_usage_sketch(windowed_usage_sketch* sketch,
+        const usage_snapshot* snapshot)
+{
+    const uint64_t period = snapshot->timestamp / sketch->period_seconds;
+    // Newer period, expire the periods it replaces
+    if (period > sketch->newest_period)
+    {
+        const uint64_t expired = period - sketch->newest_period;
+        for (uint64_t i = 1; i <= expired && i <= QUANTILE_WINDOW_PERIODS; ++i)
+            initialise_usage_sketch(sketch->periods + (sketch->newest_period + i) %
+                    QUANTILE_WINDOW_PERIODS);
+        sketch->newest_period = period;
+    }
+    // Older than the window
+    else if (sketch->newest_period - period >= QUANTILE_WINDOW_PERIODS)
+        return;
+    add_snapshot_to_usage_sketch(sketch->periods + period % QUANTILE_WINDOW_PERIODS, snapshot);
+}
+
+void get_windowed_usage_sketch(const windowed_usage_sketch* sketch, usage_sketch* window)
+{
+    initialise_usage_sketch(window);
+    for (size_t i = 0; i < QUANTILE_WINDOW_PERIODS; ++i)
+        merge_usage_sketch(window, sketch->periods + i);
+}
@@ -0,0 +1,768 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "segment_store.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+/**
+ * Constants
+ */
+// Index file magic, "EMIDX001"
+#define SEGMENT_INDEX_MAGIC UINT64_C(0x3130305844494D45)
+// Segment file name format, zero padded so names sort by sequence
+#define SEGMENT_DATA_FORMAT "%s/segment_%020llu.dat"
+#define SEGMENT_INDEX_FORMAT "%s/segment_%020llu.idx"
+#define SEGMENT_NAME_PREFIX "segment_"
+#define SEGMENT_DATA_SUFFIX ".dat"
+#define SEGMENT_SEQUENCE_DIGITS 20
+
+/**
+ * @brief Header of an index file, followed by index_count segment_index_entry items.
+ */
+typedef struct
+{
+    uint64_t magic;
+    uint64_t record_count;
+    uint64_t min_timestamp;
+    uint64_t max_timestamp;
+    uint64_t index_count;
+} segment_index_header;
+
+static void get_data_path(const segment_store* store, const uint64_t sequence, char* path)
+{
+    snprintf(path, MAX_PATH_CHARACTERS, SEGMENT_DATA_FORMAT, store->directory,
+            (unsigned long long) sequence);
+}
+
+static void get_index_path(const segment_store* store, const uint64_t sequence, char* path)
+{
+    snprintf(path, MAX_PATH_CHARACTERS, SEGMENT_INDEX_FORMAT, store->directory,
+            (unsigned long long) sequence);
+}
+
+static segment* get_active_segment(segment_store* store)
+{
+    return store->segments + store->segment_count - 1;
+}
+
+static int is_overlapping(const uint64_t min_timestamp, const uint64_t max_timestamp,
+        const uint64_t from_timestamp, const uint64_t to_timestamp)
+{
+    return min_timestamp <= to_timestamp && max_timestamp >= from_timestamp;
+}
+
+/**
+ * @brief Write the whole buffer, retrying partial writes and interrupts.
+ * @return 1 (true) if successful.
+ */
+static int write_fully(const int fd, const void* buffer, size_t length)
+{
+    const char* bytes = buffer;
+    while (0 < length)
+    {
+        const ssize_t written = write(fd, bytes, length);
+        if (0 > written)
+        {
+            if (EINTR == errno)
+                continue;
+            LOG(ERROR, "Write of %zu bytes failed, errno %d.\n", length, errno);
+            return 0;
+        }
+        bytes += written;
+        length -= (size_t) written;
+    }
+    return 1;
+}
+
+/**
+ * @brief Append a new segment, for the caller to populate.
+ * @return the new segment, NULL if allocation failed.
+ */
+static segment* add_segment(segment_store* store, const uint64_t sequence)
+{
+    if (store->segment_count == store->segment_capacity)
+    {
+        const size_t new_capacity = (0 == store->segment_capacity) ? 16 :
+                store->segment_capacity * 2;
+        segment* new_segments = realloc(store->segments, sizeof(segment) * new_capacity);
+        if (NULL == new_segments)
+        {
+            LOG(ERROR, "Segment table allocation failed for %zu segments.\n", new_capacity);
+            return NULL;
+        }
+        store->segments = new_segments;
+        store->segment_capacity = new_capacity;
+    }
+    segment* new_segment = store->segments + store->segment_count++;
+    memset(new_segment, 0, sizeof(*new_segment));
+    new_segment->sequence = sequence;
+    new_segment->min_timestamp = UINT64_MAX;
+    return new_segment;
+}
+
+/**
+ * @brief Add a reading to the heap index of the active segment.
+ * @return 1 (true) if successful, 0 if the index could not grow.
+ */
+static int index_reading(segment* active, const uint64_t timestamp)
+{
+    if (0 == active->record_count % STORE_INDEX_INTERVAL)
+    {
+        if (active->index_count == active->index_capacity)
+        {
+            const size_t new_capacity = (0 == active->index_capacity) ? 64 :
+                    active->index_capacity * 2;
+            segment_index_entry* new_index = realloc((void*) active->index,
+                    sizeof(segment_index_entry) * new_capacity);
+            if (NULL == new_index)
+            {
+                LOG(ERROR, "Segment index allocation failed for %zu entries.\n", new_capacity);
+                return 0;
+            }
+            active->index = new_index;
+            active->index_capacity = new_capacity;
+        }
+        segment_index_entry* entry = (segment_index_entry*) active->index + active->index_count++;
+        entry->min_timestamp = timestamp;
+        entry->max_timestamp = timestamp;
+        entry->offset = active->record_count * sizeof(meter_reading);
+    }
+    else
+    {
+        segment_index_entry* entry = (segment_index_entry*) active->index + active->index_count - 1;
+        if (timestamp < entry->min_timestamp)
+            entry->min_timestamp = timestamp;
+        if (timestamp > entry->max_timestamp)
+            entry->max_timestamp = timestamp;
+    }
+    if (timestamp < active->min_timestamp)
+        active->min_timestamp = timestamp;
+    if (timestamp > active->max_timestamp)
+        active->max_timestamp = timestamp;
+    ++active->record_count;
+    return 1;
+}
+
+/**
+ * @brief Map the index file of a sealed segment.
+ * @return 1 (true) if successful, 0 if the index file is missing or invalid.
+ */
+static int map_segment_index(const segment_store* store, segment* sealed)
+{
+    char path[MAX_PATH_CHARACTERS];
+    get_index_path(store, sealed->sequence, path);
+    const int fd = open(path, O_RDONLY);
+    if (0 > fd)
+        return 0;
+    struct stat file_status;
+    if (0 != fstat(fd, &file_status) || sizeof(segment_index_header) > (size_t) file_status.st_size)
+    {
+        close(fd);
+        return 0;
+    }
+    const size_t length = (size_t) file_status.st_size;
+    void* mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == mapping)
+        return 0;
+    const segment_index_header* header = mapping;
+    if (SEGMENT_INDEX_MAGIC != header->magic || length != sizeof(segment_index_header) +
+            header->index_count * sizeof(segment_index_entry))
+    {
+        LOG(WARN, "Invalid index file %s.\n", path);
+        munmap(mapping, length);
+        return 0;
+    }
+    sealed->record_count = header->record_count;
+    sealed->min_timestamp = header->min_timestamp;
+    sealed->max_timestamp = header->max_timestamp;
+    sealed->index = (const segment_index_entry*) (header + 1);
+    sealed->index_count = (size_t) header->index_count;
+    sealed->index_capacity = 0;
+    sealed->mapping = mapping;
+    sealed->mapping_length = length;
+    return 1;
+}
+
+/**
+ * @brief Write the heap index of a segment to its index file, then map it in its place.
+ * The file is written under a temporary name and renamed, so an index file is never partial.
+ * @return 1 (true) if successful.
+ */
+static int seal_segment(const segment_store* store, segment* active)
+{
+    char path[MAX_PATH_CHARACTERS];
+    char temporary_path[MAX_PATH_CHARACTERS + 4];
+    get_index_path(store, active->sequence, path);
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", path);
+    const int fd = open(temporary_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (0 > fd)
+    {
+        LOG(ERROR, "Unable to create index file %s, errno %d.\n", temporary_path, errno);
+        return 0;
+    }
+    const segment_index_header header = {SEGMENT_INDEX_MAGIC, active->record_count,
+            active->min_timestamp, active->max_timestamp, active->index_count};
+    const int is_written = write_fully(fd, &header, sizeof(header)) &&
+            write_fully(fd, active->index, sizeof(segment_index_entry) * active->index_count) &&
+            0 == fsync(fd);
+    close(fd);
+    if (!is_written || 0 != rename(temporary_path, path))
+    {
+        LOG(ERROR, "Unable to write index file %s.\n", path);
+        unlink(temporary_path);
+        return 0;
+    }
+    free((void*) active->index);
+    active->index = NULL;
+    active->index_count = 0;
+    return map_segment_index(store, active);
+}
+
+/**
+ * @brief Rebuild the heap index of a segment by scanning its data file.
+ * A partial trailing reading, left by a crash mid-write, is truncated.
+ * @param fd data file descriptor, open for reading and writing.
+ * @return 1 (true) if successful.
+ */
+static int rebuild_segment_index(segment* active, const int fd)
+{
+    struct stat file_status;
+    if (0 != fstat(fd, &file_status))
+        return 0;
+    const size_t whole_records = (size_t) file_status.st_size / sizeof(meter_reading);
+    if ((off_t) (whole_records * sizeof(meter_reading)) != file_status.st_size)
+    {
+        LOG(WARN, "Truncating partial reading at end of segment %llu.\n",
+                (unsigned long long) active->sequence);
+        if (0 != ftruncate(fd, (off_t) (whole_records * sizeof(meter_reading))))
+            return 0;
+    }
+    meter_reading block[STORE_INDEX_INTERVAL];
+    size_t record = 0;
+    while (record < whole_records)
+    {
+        const size_t block_count = (whole_records - record < STORE_INDEX_INTERVAL) ?
+                whole_records - record : STORE_INDEX_INTERVAL;
+        const size_t block_bytes = block_count * sizeof(meter_reading);
+        if ((ssize_t) block_bytes != pread(fd, block, block_bytes,
+                    (off_t) (record * sizeof(meter_reading))))
+            return 0;
+        for (size_t i = 0; i < block_count; ++i)
+            if (!index_reading(active, block[i].snapshot.timestamp))
+                return 0;
+        record += block_count;
+    }
+    return 1;
+}
+
+/**
+ * @brief Open the data file of the active segment for appending, recovering its index.
+ * @return 1 (true) if successful.
+ */
+static int open_active_segment(segment_store* store, segment* active)
+{
+    char path[MAX_PATH_CHARACTERS];
+    get_data_path(store, active->sequence, path);
+    const int fd = open(path, O_CREAT | O_RDWR | O_APPEND, 0644);
+    if (0 > fd)
+    {
+        LOG(ERROR, "Unable to open segment %s, errno %d.\n", path, errno);
+        return 0;
+    }
+    if (!rebuild_segment_index(active, fd))
+    {
+        LOG(ERROR, "Unable to recover segment %s.\n", path);
+        close(fd);
+        return 0;
+    }
+    store->active_fd = fd;
+    return 1;
+}
+
+/**
+ * @brief Recover a sealed segment whose index file is missing or invalid.
+ * @return 1 (true) if successful.
+ */
+static int recover_sealed_segment(segment_store* store, segment* sealed)
+{
+    if (!open_active_segment(store, sealed))
+        return 0;
+    close(store->active_fd);
+    store->active_fd = -1;
+    return seal_segment(store, sealed);
+}
+
+/**
+ * @brief Parse the sequence of a data file name, segment_ then 20 digits then .dat.
+ * @return 1 (true) if the name is exactly a data file name, e.g., not a .data or .dat.tmp file.
+ */
+static int parse_data_file_name(const char* name, uint64_t* sequence)
+{
+    const size_t prefix_length = strlen(SEGMENT_NAME_PREFIX);
+    if (prefix_length + SEGMENT_SEQUENCE_DIGITS + strlen(SEGMENT_DATA_SUFFIX) != strlen(name) ||
+            0 != strncmp(name, SEGMENT_NAME_PREFIX, prefix_length) ||
+            0 != strcmp(name + prefix_length + SEGMENT_SEQUENCE_DIGITS, SEGMENT_DATA_SUFFIX))
+        return 0;
+    uint64_t value = 0;
+    for (size_t i = 0; i < SEGMENT_SEQUENCE_DIGITS; ++i)
+    {
+        const char ch = name[prefix_length + i];
+        if ('0' > ch || '9' < ch || (UINT64_MAX - (uint64_t) (ch - '0')) / 10 < value)
+            return 0;
+        value = value * 10 + (uint64_t) (ch - '0');
+    }
+    *sequence = value;
+    return 1;
+}
+
+static int compare_sequences(const void* left, const void* right)
+{
+    const uint64_t left_sequence = *(const uint64_t*) left;
+    const uint64_t right_sequence = *(const uint64_t*) right;
+    return (left_sequence > right_sequence) - (left_sequence < right_sequence);
+}
+
+/**
+ * @brief List the segment sequences present in the store directory, in ascending order.
+ * @param sequences set to a heap array of sequences, to be freed by the caller.
+ * @param count set to the number of sequences.
+ * @return 1 (true) if successful.
+ */
+static int list_segment_sequences(const segment_store* store, uint64_t** sequences,
+        size_t* count)
+{
+    *sequences = NULL;
+    *count = 0;
+    DIR* directory = opendir(store->directory);
+    if (NULL == directory)
+    {
+        LOG(ERROR, "Unable to open store directory %s, errno %d.\n", store->directory, errno);
+        return 0;
+    }
+    size_t capacity = 0;
+    struct dirent* entry = NULL;
+    while (NULL != (entry = readdir(directory)))
+    {
+        uint64_t sequence = 0;
+        if (!parse_data_file_name(entry->d_name, &sequence))
+            continue;
+        if (*count == capacity)
+        {
+            capacity = (0 == capacity) ? 16 : capacity * 2;
+            uint64_t* new_sequences = realloc(*sequences, sizeof(uint64_t) * capacity);
+            if (NULL == new_sequences)
+            {
+                LOG(ERROR, "Segment list allocation failed for %zu segments.\n", capacity);
+                closedir(directory);
+                return 0;
+            }
+            *sequences = new_sequences;
+        }
+        (*sequences)[(*count)++] = sequence;
+    }
+    closedir(directory);
+    // An empty store has no list to sort
+    if (0 < *count)
+        qsort(*sequences, *count, sizeof(uint64_t), compare_sequences);
+    return 1;
+}
+
+/**
+ * @brief Seal the active segment and start the next one.
+ * On failure the store is marked failed, as it may be left without an active segment.
+ * @return 1 (true) if successful.
+ */
+static int roll_segment(segment_store* store)
+{
+    segment* active = get_active_segment(store);
+    const uint64_t next_sequence = active->sequence + 1;
+    if (0 != fsync(store->active_fd))
+        LOG(WARN, "fsync of segment %llu failed, errno %d.\n",
+                (unsigned long long) active->sequence, errno);
+    close(store->active_fd);
+    store->active_fd = -1;
+    segment* next = NULL;
+    if (!seal_segment(store, active) || NULL == (next = add_segment(store, next_sequence)) ||
+            !open_active_segment(store, next))
+    {
+        LOG(ERROR, "Roll to segment %llu failed, store %s refuses further appends.\n",
+                (unsigned long long) next_sequence, store->directory);
+        store->is_failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Roll the active segment back to its first record_count readings after a failed write.
+ * The data file is truncated, dropping any partial reading, and the heap index, the last block
+ * range and the segment range are recomputed to cover only the readings kept.
+ * @return 1 (true) if successful.
+ */
+static int rollback_active_segment(segment_store* store, const uint64_t record_count)
+{
+    segment* active = get_active_segment(store);
+    store->buffered_count = 0;
+    if (0 != ftruncate(store->active_fd, (off_t) (record_count * sizeof(meter_reading))))
+    {
+        LOG(ERROR, "Truncate of segment %llu failed, errno %d.\n",
+                (unsigned long long) active->sequence, errno);
+        return 0;
+    }
+    active->record_count = record_count;
+    active->index_count = (size_t) ((record_count + STORE_INDEX_INTERVAL - 1) /
+            STORE_INDEX_INTERVAL);
+    const size_t block_count = (size_t) (record_count % STORE_INDEX_INTERVAL);
+    if (0 < block_count)
+    {
+        segment_index_entry* entry = (segment_index_entry*) active->index +
+                active->index_count - 1;
+        meter_reading block[STORE_INDEX_INTERVAL];
+        const size_t block_bytes = block_count * sizeof(meter_reading);
+        if ((ssize_t) block_bytes != pread(store->active_fd, block, block_bytes,
+                    (off_t) entry->offset))
+        {
+            LOG(ERROR, "Short read of segment %llu at offset %llu.\n",
+                    (unsigned long long) active->sequence, (unsigned long long) entry->offset);
+            return 0;
+        }
+        entry->min_timestamp = UINT64_MAX;
+        entry->max_timestamp = 0;
+        for (size_t i = 0; i < block_count; ++i)
+        {
+            if (block[i].snapshot.timestamp < entry->min_timestamp)
+                entry->min_timestamp = block[i].snapshot.timestamp;
+            if (block[i].snapshot.timestamp > entry->max_timestamp)
+                entry->max_timestamp = block[i].snapshot.timestamp;
+        }
+    }
+    active->min_timestamp = UINT64_MAX;
+    active->max_timestamp = 0;
+    for (size_t i = 0; i < active->index_count; ++i)
+    {
+        if (active->index[i].min_timestamp < active->min_timestamp)
+            active->min_timestamp = active->index[i].min_timestamp;
+        if (active->index[i].max_timestamp > active->max_timestamp)
+            active->max_timestamp = active->index[i].max_timestamp;
+    }
+    return 1;
+}
+
+int open_segment_store(segment_store* store, const char* directory, size_t max_segment_bytes)
+{
+    memset(store, 0, sizeof(*store));
+    store->active_fd = -1;
+    if (MAX_DIRECTORY_CHARACTERS <= strlen(directory))
+    {
+        LOG(ERROR, "Store directory path exceeds %d characters.\n", MAX_DIRECTORY_CHARACTERS - 1);
+        return 0;
+    }
+    if (sizeof(meter_reading) * STORE_INDEX_INTERVAL > max_segment_bytes)
+    {
+        LOG(ERROR, "Segment size must be at least %zu bytes.\n",
+                sizeof(meter_reading) * STORE_INDEX_INTERVAL);
+        return 0;
+    }
+    strcpy(store->directory, directory);
+    store->max_segment_bytes = max_segment_bytes;
+    if (0 != mkdir(directory, 0755) && EEXIST != errno)
+    {
+        LOG(ERROR, "Unable to create store directory %s, errno %d.\n", directory, errno);
+        return 0;
+    }
+    store->write_buffer = malloc(sizeof(meter_reading) * STORE_WRITE_BUFFER_READINGS);
+    if (NULL == store->write_buffer)
+    {
+        LOG(ERROR, "Write buffer allocation failed.\n");
+        return 0;
+    }
+    uint64_t* sequences = NULL;
+    size_t sequence_count = 0;
+    if (!list_segment_sequences(store, &sequences, &sequence_count))
+    {
+        close_segment_store(store);
+        return 0;
+    }
+    int is_open = 1;
+    for (size_t i = 0; i < sequence_count && is_open; ++i)
+    {
+        segment* existing = add_segment(store, sequences[i]);
+        is_open = (NULL != existing);
+        // Sealed segments: map the index, only rebuilt when missing.
+        // The last segment without an index file is the active segment.
+        if (is_open && !map_segment_index(store, existing))
+        {
+            if (i + 1 == sequence_count)
+                is_open = open_active_segment(store, existing);
+            else
+                is_open = recover_sealed_segment(store, existing);
+        }
+    }
+    free(sequences);
+    // Start a new active segment when there is none, or the last one is sealed
+    if (is_open && 0 > store->active_fd)
+    {
+        const uint64_t sequence = (0 == store->segment_count) ? 0 :
+                get_active_segment(store)->sequence + 1;
+        segment* active = add_segment(store, sequence);
+        is_open = (NULL != active) && open_active_segment(store, active);
+    }
+    if (!is_open)
+    {
+        close_segment_store(store);
+        return 0;
+    }
+    LOG(INFO, "Opened store %s with %zu segments.\n", directory, store->segment_count);
+    return 1;
+}
+
+int flush_segment_store(segment_store* store)
+{
+    if (store->is_failed)
+    {
+        LOG(ERROR, "Store %s has failed, reopen it to recover.\n", store->directory);
+        return 0;
+    }
+    if (0 == store->buffered_count)
+        return 1;
+    if (write_fully(store->active_fd, store->write_buffer,
+            sizeof(meter_reading) * store->buffered_count))
+    {
+        store->buffered_count = 0;
+        return 1;
+    }
+    // Buffered readings are already counted and indexed, drop them and any part written
+    const uint64_t written_count = get_active_segment(store)->record_count -
+            store->buffered_count;
+    if (!rollback_active_segment(store, written_count))
+    {
+        LOG(ERROR, "Rollback failed, store %s refuses further appends.\n", store->directory);
+        store->is_failed = 1;
+    }
+    return 0;
+}
+
+int get_segment_store_position(const segment_store* store, store_position* position)
+{
+    if (store->is_failed || 0 == store->segment_count)
+    {
+        LOG(ERROR, "Store %s has failed, reopen it to recover.\n", store->directory);
+        return 0;
+    }
+    const segment* active = store->segments + store->segment_count - 1;
+    position->sequence = active->sequence;
+    position->record_count = active->record_count - store->buffered_count;
+    return 1;
+}
+
+int append_readings(segment_store* store, const meter_reading* readings, const size_t count)
+{
+    if (store->is_failed)
+    {
+        LOG(ERROR, "Store %s has failed, reopen it to recover.\n", store->directory);
+        return 0;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        segment* active = get_active_segment(store);
+        if (store->max_segment_bytes < (active->record_count + 1) * sizeof(meter_reading))
+        {
+            if (!flush_segment_store(store) || !roll_segment(store))
+                return 0;
+            active = get_active_segment(store);
+        }
+        if (!index_reading(active, readings[i].snapshot.timestamp))
+            return 0;
+        store->write_buffer[store->buffered_count++] = readings[i];
+        if (STORE_WRITE_BUFFER_READINGS == store->buffered_count &&
+                !flush_segment_store(store))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Scan the overlapping blocks of a segment for matching readings.
+ * @param found running count of matches, readings are written while below capacity.
+ * @return 1 (true) if successful.
+ */
+static int query_segment(const segment_store* store, const segment* source,
+        const uint64_t meter_id, const uint64_t from_timestamp, const uint64_t to_timestamp,
+        meter_reading* readings, const size_t capacity, size_t* found)
+{
+    char path[MAX_PATH_CHARACTERS];
+    get_data_path(store, source->sequence, path);
+    const int fd = open(path, O_RDONLY);
+    if (0 > fd)
+    {
+        LOG(ERROR, "Unable to open segment %s, errno %d.\n", path, errno);
+        return 0;
+    }
+    meter_reading block[STORE_INDEX_INTERVAL];
+    for (size_t i = 0; i < source->index_count; ++i)
+    {
+        const segment_index_entry* entry = source->index + i;
+        if (!is_overlapping(entry->min_timestamp, entry->max_timestamp, from_timestamp,
+                    to_timestamp))
+            continue;
+        const uint64_t first_record = entry->offset / sizeof(meter_reading);
+        const size_t block_count = (source->record_count - first_record < STORE_INDEX_INTERVAL) ?
+                (size_t) (source->record_count - first_record) : STORE_INDEX_INTERVAL;
+        const size_t block_bytes = block_count * sizeof(meter_reading);
+        if ((ssize_t) block_bytes != pread(fd, block, block_bytes, (off_t) entry->offset))
+        {
+            LOG(ERROR, "Short read of segment %s at offset %llu.\n", path,
+                    (unsigned long long) entry->offset);
+            close(fd);
+            return 0;
+        }
+        for (size_t j = 0; j < block_count; ++j)
+        {
+            const meter_reading* reading = block + j;
+            if (meter_id != reading->meter_id || from_timestamp > reading->snapshot.timestamp ||
+                    to_timestamp < reading->snapshot.timestamp)
+                continue;
+            if (*found < capacity)
+                readings[*found] = *reading;
+            ++*found;
+        }
+    }
+    close(fd);
+    return 1;
+}
+
+size_t query_readings(segment_store* store, const uint64_t meter_id,
+        const uint64_t from_timestamp, const uint64_t to_timestamp, meter_reading* readings,
+        const size_t capacity)
+{
+    size_t found = 0;
+    if (!flush_segment_store(store))
+    {
+        LOG(ERROR, "Query of store %s failed, buffered readings were not written.\n",
+                store->directory);
+        return STORE_QUERY_FAILED;
+    }
+    for (size_t i = 0; i < store->segment_count; ++i)
+    {
+        const segment* source = store->segments + i;
+        if (0 == source->record_count || !is_overlapping(source->min_timestamp,
+                    source->max_timestamp, from_timestamp, to_timestamp))
+            continue;
+        if (!query_segment(store, source, meter_id, from_timestamp, to_timestamp, readings,
+                    capacity, &found))
+        {
+            LOG(ERROR, "Query of store %s failed at segment %llu.\n", store->directory,
+                    (unsigned long long) source->sequence);
+            return STORE_QUERY_FAILED;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief Read consecutive records of a segment.
+ * @return 1 (true) if successful.
+ */
+static int read_segment_records(const segment_store* store, const segment* source,
+        const uint64_t first_record, meter_reading* readings, const size_t count)
+{
+    char path[MAX_PATH_CHARACTERS];
+    get_data_path(store, source->sequence, path);
+    const int fd = open(path, O_RDONLY);
+    if (0 > fd)
+    {
+        LOG(ERROR, "Unable to open segment %s, errno %d.\n", path, errno);
+        return 0;
+    }
+    const size_t bytes = count * sizeof(meter_reading);
+    const off_t offset = (off_t) (first_record * sizeof(meter_reading));
+    const int is_read = (ssize_t) bytes == pread(fd, readings, bytes, offset);
+    if (!is_read)
+        LOG(ERROR, "Short read of segment %s at offset %llu.\n", path,
+                (unsigned long long) offset);
+    close(fd);
+    return is_read;
+}
+
+size_t read_readings_from_position(segment_store* store, store_position* position,
+        meter_reading* readings, const size_t capacity)
+{
+    if (!flush_segment_store(store))
+    {
+        LOG(ERROR, "Read of store %s failed, buffered readings were not written.\n",
+                store->directory);
+        return STORE_QUERY_FAILED;
+    }
+    size_t i = 0;
+    while (i < store->segment_count && store->segments[i].sequence != position->sequence)
+        ++i;
+    if (store->segment_count == i || position->record_count > store->segments[i].record_count)
+    {
+        LOG(ERROR, "Position %llu:%llu is not in store %s.\n",
+                (unsigned long long) position->sequence,
+                (unsigned long long) position->record_count, store->directory);
+        return STORE_QUERY_FAILED;
+    }
+    size_t count = 0;
+    while (count < capacity)
+    {
+        const segment* source = store->segments + i;
+        // End of a segment, continue from the start of the next
+        if (position->record_count == source->record_count)
+        {
+            if (store->segment_count == ++i)
+                break;
+            position->sequence = store->segments[i].sequence;
+            position->record_count = 0;
+            continue;
+        }
+        const uint64_t remaining = source->record_count - position->record_count;
+        const size_t read_count = (remaining < capacity - count) ? (size_t) remaining :
+                capacity - count;
+        if (!read_segment_records(store, source, position->record_count, readings + count,
+                    read_count))
+        {
+            LOG(ERROR, "Read of store %s failed at segment %llu.\n", store->directory,
+                    (unsigned long long) source->sequence);
+            return STORE_QUERY_FAILED;
+        }
+        position->record_count += read_count;
+        count += read_count;
+    }
+    return count;
+}
+
+void close_segment_store(segment_store* store)
+{
+    if (0 <= store->active_fd)
+    {
+        if (!store->is_failed)
+            flush_segment_store(store);
+        close(store->active_fd);
+        store->active_fd = -1;
+    }
+    for (size_t i = 0; i < store->segment_count; ++i)
+    {
+        segment* existing = store->segments + i;
+        if (NULL != existing->mapping)
+            munmap(existing->mapping, existing->mapping_length);
+        else
+            free((void*) existing->index);
+    }
+    free(store->segments);
+    free(store->write_buffer);
+    memset(store, 0, sizeof(*store));
+    store->active_fd = -1;
+}
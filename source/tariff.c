@@ -0,0 +1,148 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "tariff.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+/**
+ * @brief Rebuild the per slot rate tables from the band rates and the slot bands.
+ * @param tariff_table tariff to update.
+ */
+static void build_slot_rates(tariff* tariff_table)
+{
+    for (size_t slot = 0; slot < TARIFF_SLOTS_PER_DAY; ++slot)
+    {
+        const uint8_t band = tariff_table->slot_band[slot];
+        tariff_table->electric_slot_rate[slot] = tariff_table->electric_unit_rate[band];
+        tariff_table->gas_slot_rate[slot] = tariff_table->gas_unit_rate[band];
+    }
+}
+
+void initialise_tariff(tariff* tariff_table, const double electric_unit_rate[TARIFF_BAND_COUNT],
+        const double gas_unit_rate[TARIFF_BAND_COUNT], const double electric_standing_charge,
+        const double gas_standing_charge, const int32_t utc_offset_seconds)
+{
+    memcpy(tariff_table->electric_unit_rate, electric_unit_rate,
+            sizeof(tariff_table->electric_unit_rate));
+    memcpy(tariff_table->gas_unit_rate, gas_unit_rate, sizeof(tariff_table->gas_unit_rate));
+    tariff_table->electric_standing_charge = electric_standing_charge;
+    tariff_table->gas_standing_charge = gas_standing_charge;
+    tariff_table->utc_offset_seconds = utc_offset_seconds;
+    memset(tariff_table->slot_band, OFF_PEAK, sizeof(tariff_table->slot_band));
+    build_slot_rates(tariff_table);
+}
+
+int set_tariff_band(tariff* tariff_table, const tariff_band band, const uint32_t start_second,
+        const uint32_t end_second)
+{
+    if (0 > (int) band || TARIFF_BAND_COUNT <= band)
+    {
+        LOG(ERROR, "Invalid tariff band %d.\n", (int) band);
+        return 0;
+    }
+    if (TARIFF_SECONDS_PER_DAY < start_second || TARIFF_SECONDS_PER_DAY < end_second)
+    {
+        LOG(ERROR, "Band range %u to %u exceeds %d seconds in a day.\n",
+                start_second, end_second, TARIFF_SECONDS_PER_DAY);
+        return 0;
+    }
+    // Round start down and end up to slot boundaries
+    const size_t start_slot = start_second / TARIFF_SLOT_SECONDS;
+    const size_t end_slot = (end_second + TARIFF_SLOT_SECONDS - 1) / TARIFF_SLOT_SECONDS;
+    // Range wraps past midnight when the end is before the start
+    size_t slot = start_slot;
+    size_t slots_to_assign = (end_slot >= start_slot) ? end_slot - start_slot :
+            TARIFF_SLOTS_PER_DAY - start_slot + end_slot;
+    while (0 < slots_to_assign)
+    {
+        tariff_table->slot_band[slot % TARIFF_SLOTS_PER_DAY] = (uint8_t) band;
+        ++slot;
+        --slots_to_assign;
+    }
+    build_slot_rates(tariff_table);
+    return 1;
+}
+
+void price_snapshot(const tariff* tariff_table, usage_snapshot* snapshot)
+{
+    const size_t slot = get_tariff_slot(tariff_table, snapshot->timestamp);
+    // Select rather than multiply by 0, usage not flagged valid may be NaN or infinite
+    snapshot->electric_cost = (snapshot->status & bitmask_electric_usage) ?
+            snapshot->electric_usage * tariff_table->electric_slot_rate[slot] : 0.0;
+    snapshot->gas_cost = (snapshot->status & bitmask_gas_usage) ?
+            snapshot->gas_usage * tariff_table->gas_slot_rate[slot] : 0.0;
+    // Cost bits sit one bit above their usage bits, copy usage validity across
+    const uint8_t usage_bits = (uint8_t) (snapshot->status &
+            (bitmask_electric_usage | bitmask_gas_usage));
+    snapshot->status = (uint8_t) ((snapshot->status & ~(bitmask_electric_cost | bitmask_gas_cost)) |
+            (usage_bits << 1));
+}
+
+void price_snapshots(const tariff* tariff_table, usage_snapshot* snapshots, const size_t count)
+{
+    // Single pass over the scalar reference, the slot gather and the status mask keep the
+    // array of structures layout from vectorizing, use price_usage() for that
+    for (size_t i = 0; i < count; ++i)
+        price_snapshot(tariff_table, snapshots + i);
+}
+
+void price_usage(const tariff* tariff_table, const uint64_t* restrict timestamps,
+        const double* restrict electric_usage, const double* restrict gas_usage,
+        double* restrict electric_cost, double* restrict gas_cost, const size_t count)
+{
+    double electric_rates[TARIFF_BATCH_SIZE];
+    double gas_rates[TARIFF_BATCH_SIZE];
+    for (size_t base = 0; base < count; base += TARIFF_BATCH_SIZE)
+    {
+        const size_t block = (count - base < TARIFF_BATCH_SIZE) ? count - base : TARIFF_BATCH_SIZE;
+        // Pass 1: gather the rates of each reading's slot
+        for (size_t i = 0; i < block; ++i)
+        {
+            const size_t slot = get_tariff_slot(tariff_table, timestamps[base + i]);
+            electric_rates[i] = tariff_table->electric_slot_rate[slot];
+            gas_rates[i] = tariff_table->gas_slot_rate[slot];
+        }
+        // Pass 2: contiguous multiply, no dependencies between iterations, vectorized
+        for (size_t i = 0; i < block; ++i)
+        {
+            electric_cost[base + i] = electric_usage[base + i] * electric_rates[i];
+            gas_cost[base + i] = gas_usage[base + i] * gas_rates[i];
+        }
+    }
+}
+
+void compute_tariff_totals(const tariff* tariff_table, const usage_snapshot* snapshots,
+        const size_t count, tariff_totals* totals)
+{
+    memset(totals, 0, sizeof(*totals));
+    if (0 == count)
+        return;
+    // Independent accumulators break the floating point add dependency chain, the loop stays
+    // scalar as reordering a floating point sum needs -ffast-math
+    double electric_sum[4] = {0.0, 0.0, 0.0, 0.0};
+    double gas_sum[4] = {0.0, 0.0, 0.0, 0.0};
+    uint64_t first_day = get_tariff_day(tariff_table, snapshots[0].timestamp);
+    uint64_t last_day = first_day;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const usage_snapshot* snapshot = snapshots + i;
+        const size_t slot = get_tariff_slot(tariff_table, snapshot->timestamp);
+        const uint64_t day = get_tariff_day(tariff_table, snapshot->timestamp);
+        electric_sum[i & 3] += (snapshot->status & bitmask_electric_usage) ?
+                snapshot->electric_usage * tariff_table->electric_slot_rate[slot] : 0.0;
+        gas_sum[i & 3] += (snapshot->status & bitmask_gas_usage) ?
+                snapshot->gas_usage * tariff_table->gas_slot_rate[slot] : 0.0;
+        first_day = (day < first_day) ? day : first_day;
+        last_day = (day > last_day) ? day : last_day;
+    }
+    // Standing charges accrue on every day of the range, including days without readings
+    const uint64_t days = last_day - first_day + 1;
+    totals->electric_energy_cost = (electric_sum[0] + electric_sum[1]) +
+            (electric_sum[2] + electric_sum[3]);
+    totals->gas_energy_cost = (gas_sum[0] + gas_sum[1]) + (gas_sum[2] + gas_sum[3]);
+    totals->days = days;
+    totals->electric_standing_cost = tariff_table->electric_standing_charge * (double) days;
+    totals->gas_standing_cost = tariff_table->gas_standing_charge * (double) days;
+}
@@ -0,0 +1,42 @@
+#ifndef ENERGYMONITOR_TEST_H_
+#define ENERGYMONITOR_TEST_H_
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief Minimal checks shared by the test programs, each test program is a main() that
+ * returns EXIT_FAILURE when any check failed.
+ */
+static int test_failures = 0;
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++test_failures; \
+        } \
+    } while (0)
+
+// Relative comparison, for sums accumulated in a different order
+#define CHECK_CLOSE(actual, expected, tolerance) \
+    CHECK(fabs((actual) - (expected)) <= (tolerance) * (fabs(expected) > 1.0 ? fabs(expected) : 1.0))
+
+/**
+ * @brief Report the result of a test program.
+ * @param name name of the test program.
+ * @return EXIT_SUCCESS if every check passed, EXIT_FAILURE otherwise.
+ */
+static inline int finish_test(const char* name)
+{
+    if (0 == test_failures)
+        fprintf(stderr, "%s: passed\n", name);
+    else
+        fprintf(stderr, "%s: %d checks failed\n", name, test_failures);
+    return (0 == test_failures) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
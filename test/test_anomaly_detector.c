@@ -0,0 +1,412 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "anomaly_detector.h"
+#include "energy_monitor.h"
+
+#define METER_COUNT 1000
+#define STEADY_READINGS 32
+#define READING_STEP_SECONDS 60
+// Noisy fleet, readings per meter and the step each anomaly is injected at
+#define FLEET_STEPS 2000
+#define INJECT_STEP 1000
+#define ALERT_CAPACITY 32768
+
+static const int both_usages = bitmask_electric_usage | bitmask_gas_usage;
+
+static anomaly_alert alerts[ALERT_CAPACITY];
+
+/**
+ * @brief A sparse meter ID, spread over the whole uint64_t range.
+ */
+static uint64_t get_meter_id(const size_t meter)
+{
+    return UINT64_MAX - (uint64_t) meter * (UINT64_C(1) << 40);
+}
+
+static meter_reading create_reading(const uint64_t meter_id, const uint64_t timestamp,
+        const double electric_usage, const double gas_usage, const int status)
+{
+    meter_reading reading;
+    memset(&reading, 0, sizeof(reading));
+    reading.meter_id = meter_id;
+    reading.snapshot.timestamp = timestamp;
+    reading.snapshot.electric_usage = electric_usage;
+    reading.snapshot.gas_usage = gas_usage;
+    reading.snapshot.status = (uint8_t) status;
+    return reading;
+}
+
+/**
+ * @brief Pop and release every queued batch, copying the alerts in order.
+ * @param batch_sizes output count of each batch popped, NULL if not needed.
+ * @return number of alerts popped.
+ */
+static size_t pop_alerts(anomaly_detector* detector, size_t* batch_sizes, size_t* batch_count)
+{
+    size_t count = 0;
+    size_t batches = 0;
+    anomaly_alert_batch* batch = NULL;
+    while (NULL != (batch = pop_anomaly_alerts(detector)))
+    {
+        for (size_t i = 0; i < batch->count && count < ALERT_CAPACITY; ++i)
+            alerts[count++] = batch->alerts[i];
+        if (NULL != batch_sizes)
+            batch_sizes[batches] = batch->count;
+        ++batches;
+        release_anomaly_alerts(detector, batch);
+    }
+    if (NULL != batch_count)
+        *batch_count = batches;
+    return count;
+}
+
+/**
+ * @brief Feed one reading and pop the alerts it raised.
+ * @return number of alerts, copied to alerts.
+ */
+static size_t detect_one(anomaly_detector* detector, const meter_reading reading)
+{
+    detect_anomalies(detector, &reading, 1);
+    return pop_alerts(detector, NULL, NULL);
+}
+
+/**
+ * @brief Feed a meter steady readings of both usages, one step apart.
+ * @return the timestamp after the last reading.
+ */
+static uint64_t feed_steady(anomaly_detector* detector, const uint64_t meter_id,
+        uint64_t timestamp, const size_t count, const double electric_usage,
+        const double gas_usage)
+{
+    for (size_t i = 0; i < count; ++i, timestamp += READING_STEP_SECONDS)
+        CHECK(0 == detect_one(detector, create_reading(meter_id, timestamp, electric_usage,
+                gas_usage, both_usages)));
+    return timestamp;
+}
+
+static void test_sparse_meter_ids(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, METER_COUNT));
+    static meter_reading readings[METER_COUNT];
+    for (size_t step = 0; step < STEADY_READINGS; ++step)
+    {
+        for (size_t meter = 0; meter < METER_COUNT; ++meter)
+            readings[meter] = create_reading(get_meter_id(meter),
+                    1000 + step * READING_STEP_SECONDS, 1.0 + (double) meter, 0.0,
+                    bitmask_electric_usage);
+        detect_anomalies(&detector, readings, METER_COUNT);
+    }
+    CHECK(METER_COUNT == detector.tracked_count);
+    CHECK(0 == detector.rejected_count);
+    CHECK(0 == pop_alerts(&detector, NULL, NULL));
+    // IDs differing only in their high bits still spread over the table, probes stay short
+    size_t probes = 0;
+    for (size_t slot = 0; slot <= detector.table_mask; ++slot)
+    {
+        if (0 == detector.table_indexes[slot])
+            continue;
+        const size_t home = (size_t) ((detector.table_meter_ids[slot] *
+                UINT64_C(0x9E3779B97F4A7C15)) >> detector.table_shift);
+        probes += (slot - home) & detector.table_mask;
+    }
+    CHECK(2 * METER_COUNT > probes);
+    // A spike of one sparse meter is raised against that meter's own history
+    const uint64_t spiking_id = get_meter_id(METER_COUNT / 2);
+    const uint64_t timestamp = 1000 + STEADY_READINGS * READING_STEP_SECONDS;
+    CHECK(1 == detect_one(&detector, create_reading(spiking_id, timestamp, 10000.0, 0.0,
+            bitmask_electric_usage)));
+    CHECK(spiking_id == alerts[0].meter_id && ELECTRIC_SPIKE == alerts[0].type);
+    // Meters beyond meter_count are rejected, tracked meters still are not
+    CHECK(0 == detect_one(&detector, create_reading(12345, timestamp, 1.0, 0.0,
+            bitmask_electric_usage)));
+    CHECK(1 == detector.rejected_count);
+    CHECK(0 == detect_one(&detector, create_reading(get_meter_id(0), timestamp, 1.0, 0.0,
+            bitmask_electric_usage)));
+    CHECK(1 == detector.rejected_count);
+    CHECK(METER_COUNT + 3 == detector.reading_count - (STEADY_READINGS - 1) * METER_COUNT);
+    free_anomaly_detector(&detector);
+}
+
+static void test_usage(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, 4));
+    uint64_t timestamp = feed_steady(&detector, 7, 1000, STEADY_READINGS, 1.0, 2.0);
+    // Electric spike, reported against the mean
+    CHECK(1 == detect_one(&detector, create_reading(7, timestamp, 10.0, 2.0, both_usages)));
+    CHECK(ELECTRIC_SPIKE == alerts[0].type && 7 == alerts[0].meter_id);
+    CHECK(timestamp == alerts[0].timestamp && 10.0 == alerts[0].value);
+    CHECK_CLOSE(alerts[0].expected, 1.0, 1e-9);
+    timestamp += READING_STEP_SECONDS;
+    // The spike did not raise the baseline, the next spike is caught too
+    timestamp = feed_steady(&detector, 7, timestamp, 1, 1.0, 2.0);
+    CHECK(1 == detect_one(&detector, create_reading(7, timestamp, 10.0, 2.0, both_usages)));
+    CHECK(ELECTRIC_SPIKE == alerts[0].type);
+    timestamp += READING_STEP_SECONDS;
+    CHECK(1 == detect_one(&detector, create_reading(7, timestamp, 10.0, 2.0, both_usages)));
+    CHECK(ELECTRIC_SPIKE == alerts[0].type);
+    timestamp += READING_STEP_SECONDS;
+    timestamp = feed_steady(&detector, 7, timestamp, STEADY_READINGS, 1.0, 2.0);
+    // Electric dropout, gas spike and gas dropout
+    CHECK(1 == detect_one(&detector, create_reading(7, timestamp, 0.0, 2.0, both_usages)));
+    CHECK(ELECTRIC_DROPOUT == alerts[0].type && 0.0 == alerts[0].value);
+    timestamp += READING_STEP_SECONDS;
+    CHECK(1 == detect_one(&detector, create_reading(7, timestamp, 1.0, 30.0, both_usages)));
+    CHECK(GAS_SPIKE == alerts[0].type && 30.0 == alerts[0].value);
+    CHECK_CLOSE(alerts[0].expected, 2.0, 1e-9);
+    timestamp += READING_STEP_SECONDS;
+    CHECK(1 == detect_one(&detector, create_reading(7, timestamp, 1.0, 0.0, both_usages)));
+    CHECK(GAS_DROPOUT == alerts[0].type);
+    timestamp += READING_STEP_SECONDS;
+    // Both fields at once, one alert each
+    CHECK(2 == detect_one(&detector, create_reading(7, timestamp, 10.0, 0.0, both_usages)));
+    CHECK(ELECTRIC_SPIKE == alerts[0].type && GAS_DROPOUT == alerts[1].type);
+    timestamp += READING_STEP_SECONDS;
+    // A lasting change in usage alerts at first, then is learnt
+    size_t shift_alerts = 0;
+    for (size_t i = 0; i < 200; ++i, timestamp += READING_STEP_SECONDS)
+    {
+        const size_t count = detect_one(&detector, create_reading(7, timestamp, 2.0, 2.0,
+                both_usages));
+        CHECK(0 == count || 150 > i);
+        shift_alerts += count;
+    }
+    CHECK(0 < shift_alerts);
+    free_anomaly_detector(&detector);
+}
+
+static void test_timestamps(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, 4));
+    uint64_t timestamp = feed_steady(&detector, 3, 1000, 4, 1.0, 2.0);
+    const uint64_t last = timestamp - READING_STEP_SECONDS;
+    // A gap of exactly gap_seconds is allowed, one more second is not
+    timestamp = last + config.gap_seconds;
+    CHECK(0 == detect_one(&detector, create_reading(3, timestamp, 1.0, 2.0, both_usages)));
+    CHECK(1 == detect_one(&detector, create_reading(3, timestamp + config.gap_seconds + 1, 1.0,
+            2.0, both_usages)));
+    CHECK(TIMESTAMP_GAP == alerts[0].type);
+    CHECK((double) (timestamp + config.gap_seconds + 1) == alerts[0].value);
+    CHECK((double) timestamp == alerts[0].expected);
+    timestamp += config.gap_seconds + 1;
+    // A repeated timestamp is not a regression, an earlier one is
+    CHECK(0 == detect_one(&detector, create_reading(3, timestamp, 1.0, 2.0, both_usages)));
+    CHECK(1 == detect_one(&detector, create_reading(3, timestamp - 1, 1.0, 2.0, both_usages)));
+    CHECK(TIMESTAMP_REGRESSION == alerts[0].type);
+    CHECK((double) (timestamp - 1) == alerts[0].value && (double) timestamp == alerts[0].expected);
+    // The newest timestamp is kept, a later reading is measured from it, not the regression
+    CHECK(1 == detect_one(&detector, create_reading(3, timestamp - 2, 1.0, 2.0, both_usages)));
+    CHECK(0 == detect_one(&detector, create_reading(3, timestamp + READING_STEP_SECONDS, 1.0,
+            2.0, both_usages)));
+    // The first reading of a meter has nothing to compare with
+    CHECK(0 == detect_one(&detector, create_reading(4, 1, 1.0, 2.0, both_usages)));
+    free_anomaly_detector(&detector);
+}
+
+static void test_status_cleared(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, 4));
+    // No status bits on the first reading is no transition
+    CHECK(0 == detect_one(&detector, create_reading(5, 1000, 0.0, 0.0, 0)));
+    uint64_t timestamp = feed_steady(&detector, 5, 1060, 4, 1.0, 2.0);
+    // Raised on the reading that clears the bit, not while it stays clear
+    CHECK(1 == detect_one(&detector, create_reading(5, timestamp, 0.0, 2.0,
+            bitmask_gas_usage)));
+    CHECK(ELECTRIC_STATUS_CLEARED == alerts[0].type);
+    CHECK(0.0 == alerts[0].value && 0.0 == alerts[0].expected);
+    timestamp += READING_STEP_SECONDS;
+    CHECK(0 == detect_one(&detector, create_reading(5, timestamp, 0.0, 2.0,
+            bitmask_gas_usage)));
+    timestamp += READING_STEP_SECONDS;
+    // Set again, then the gas bit and both bits cleared
+    CHECK(0 == detect_one(&detector, create_reading(5, timestamp, 1.0, 2.0, both_usages)));
+    timestamp += READING_STEP_SECONDS;
+    CHECK(1 == detect_one(&detector, create_reading(5, timestamp, 1.0, 0.0,
+            bitmask_electric_usage)));
+    CHECK(GAS_STATUS_CLEARED == alerts[0].type);
+    timestamp += READING_STEP_SECONDS;
+    CHECK(0 == detect_one(&detector, create_reading(5, timestamp, 1.0, 2.0, both_usages)));
+    timestamp += READING_STEP_SECONDS;
+    CHECK(2 == detect_one(&detector, create_reading(5, timestamp, 1.0, 2.0, 0)));
+    CHECK(ELECTRIC_STATUS_CLEARED == alerts[0].type && GAS_STATUS_CLEARED == alerts[1].type);
+    free_anomaly_detector(&detector);
+}
+
+static void test_warmup(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, 4));
+    // Meter 1 spikes on its last warm-up reading, meter 2 on its first reading after it
+    const uint64_t timestamp = feed_steady(&detector, 1, 1000, config.warmup_readings - 1, 1.0,
+            2.0);
+    feed_steady(&detector, 2, 1000, config.warmup_readings, 1.0, 2.0);
+    CHECK(0 == detect_one(&detector, create_reading(1, timestamp, 1000.0, 2.0, both_usages)));
+    CHECK(1 == detect_one(&detector, create_reading(2, timestamp, 1000.0, 2.0, both_usages)));
+    CHECK(ELECTRIC_SPIKE == alerts[0].type && 2 == alerts[0].meter_id);
+    // Each field warms up on its own, gas first seen after the electric warm-up
+    uint64_t gas_timestamp = 1000;
+    for (uint32_t i = 0; i < config.warmup_readings; ++i, gas_timestamp += READING_STEP_SECONDS)
+        CHECK(0 == detect_one(&detector, create_reading(3, gas_timestamp, 1.0, 0.0,
+                bitmask_electric_usage)));
+    for (uint32_t i = 0; i < config.warmup_readings; ++i, gas_timestamp += READING_STEP_SECONDS)
+        CHECK(0 == detect_one(&detector, create_reading(3, gas_timestamp, 1.0,
+                (0 == i % 2) ? 2.0 : 200.0, both_usages)));
+    free_anomaly_detector(&detector);
+}
+
+/**
+ * @brief Raise one TIMESTAMP_REGRESSION alert per reading, count readings in one call.
+ */
+static void raise_regressions(anomaly_detector* detector, const size_t count,
+        uint64_t* timestamp)
+{
+    static meter_reading readings[2 * ANOMALY_ALERT_BATCH_SIZE * ANOMALY_ALERT_POOL_SIZE];
+    for (size_t i = 0; i < count; ++i)
+        readings[i] = create_reading(9, (*timestamp)++, 1.0, 2.0, both_usages);
+    detect_anomalies(detector, readings, count);
+}
+
+static void test_alert_batches(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, 4));
+    // Every later reading of meter 9 is earlier than this one
+    CHECK(0 == detect_one(&detector, create_reading(9, UINT64_C(1) << 40, 1.0, 2.0,
+            both_usages)));
+    // Across the batch boundary in one call, a full batch then the rest
+    uint64_t timestamp = 1;
+    size_t batch_sizes[2 * ANOMALY_ALERT_POOL_SIZE];
+    size_t batch_count = 0;
+    raise_regressions(&detector, ANOMALY_ALERT_BATCH_SIZE + 44, &timestamp);
+    CHECK(ANOMALY_ALERT_BATCH_SIZE + 44 == pop_alerts(&detector, batch_sizes, &batch_count));
+    CHECK(2 == batch_count && ANOMALY_ALERT_BATCH_SIZE == batch_sizes[0] && 44 == batch_sizes[1]);
+    for (size_t i = 0; i < ANOMALY_ALERT_BATCH_SIZE + 44; ++i)
+        CHECK(TIMESTAMP_REGRESSION == alerts[i].type && (double) (1 + i) == alerts[i].value);
+    // Each call publishes what it raised, a partial batch is not held back
+    raise_regressions(&detector, ANOMALY_ALERT_BATCH_SIZE - 1, &timestamp);
+    raise_regressions(&detector, 2, &timestamp);
+    CHECK(ANOMALY_ALERT_BATCH_SIZE + 1 == pop_alerts(&detector, batch_sizes, &batch_count));
+    CHECK(2 == batch_count && ANOMALY_ALERT_BATCH_SIZE - 1 == batch_sizes[0] &&
+            2 == batch_sizes[1]);
+    CHECK(0 == detector.dropped_alert_count);
+    // No consumer, the pool runs out and the rest are dropped and counted
+    const size_t pooled = ANOMALY_ALERT_BATCH_SIZE * ANOMALY_ALERT_POOL_SIZE;
+    const uint64_t alert_count = detector.alert_count;
+    raise_regressions(&detector, pooled + 1000, &timestamp);
+    CHECK(pooled + 1000 == detector.alert_count - alert_count);
+    CHECK(1000 == detector.dropped_alert_count);
+    CHECK(pooled == pop_alerts(&detector, batch_sizes, &batch_count));
+    CHECK(ANOMALY_ALERT_POOL_SIZE == batch_count);
+    // Released batches are reused
+    CHECK(1 == detect_one(&detector, create_reading(9, timestamp, 1.0, 2.0, both_usages)));
+    CHECK(1000 == detector.dropped_alert_count);
+    free_anomaly_detector(&detector);
+}
+
+static double next_uniform(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (double) (*state >> 11) / 9007199254740992.0;
+}
+
+/**
+ * @brief A noisy fleet with one of each anomaly injected, each is detected once and nothing
+ * else is.
+ */
+static void test_noisy_fleet(void)
+{
+    anomaly_config config;
+    initialise_anomaly_config(&config);
+    anomaly_detector detector;
+    CHECK(initialise_anomaly_detector(&detector, &config, METER_COUNT));
+    static meter_reading readings[METER_COUNT];
+    // Meters of each injected anomaly
+    enum { SPIKE_METER = 11, DROPOUT_METER = 222, CLEARED_METER = 333, GAP_METER = 444,
+            REGRESSION_METER = 555 };
+    uint64_t state = 88172645463325252ULL;
+    size_t alert_counts[TIMESTAMP_REGRESSION + 1] = {0};
+    size_t other_alerts = 0;
+    for (size_t step = 0; step < FLEET_STEPS; ++step)
+    {
+        size_t count = 0;
+        for (size_t meter = 0; meter < METER_COUNT; ++meter)
+        {
+            // Readings of the gap meter stop for 10 steps
+            if (GAP_METER == meter && INJECT_STEP <= step && INJECT_STEP + 10 > step)
+                continue;
+            const double scale = 0.2 + (double) (meter % 17) * 0.1;
+            meter_reading reading = create_reading(get_meter_id(meter),
+                    1000 + step * READING_STEP_SECONDS,
+                    scale * (1.0 + 0.05 * (2.0 * next_uniform(&state) - 1.0)),
+                    2.0 * scale * (1.0 + 0.05 * (2.0 * next_uniform(&state) - 1.0)),
+                    both_usages);
+            if (INJECT_STEP == step && SPIKE_METER == meter)
+                reading.snapshot.electric_usage *= 10.0;
+            else if (INJECT_STEP == step && DROPOUT_METER == meter)
+                reading.snapshot.gas_usage = 0.0;
+            else if (INJECT_STEP == step && CLEARED_METER == meter)
+                reading.snapshot.status = bitmask_gas_usage;
+            else if (INJECT_STEP == step && REGRESSION_METER == meter)
+                reading.snapshot.timestamp -= 2 * READING_STEP_SECONDS;
+            readings[count++] = reading;
+        }
+        detect_anomalies(&detector, readings, count);
+        const size_t raised = pop_alerts(&detector, NULL, NULL);
+        for (size_t i = 0; i < raised; ++i)
+        {
+            const uint64_t meter_id = alerts[i].meter_id;
+            const int is_injected =
+                    (get_meter_id(SPIKE_METER) == meter_id && ELECTRIC_SPIKE == alerts[i].type) ||
+                    (get_meter_id(DROPOUT_METER) == meter_id && GAS_DROPOUT == alerts[i].type) ||
+                    (get_meter_id(CLEARED_METER) == meter_id &&
+                            ELECTRIC_STATUS_CLEARED == alerts[i].type) ||
+                    (get_meter_id(GAP_METER) == meter_id && TIMESTAMP_GAP == alerts[i].type) ||
+                    (get_meter_id(REGRESSION_METER) == meter_id &&
+                            TIMESTAMP_REGRESSION == alerts[i].type);
+            if (is_injected)
+                ++alert_counts[alerts[i].type];
+            else
+                ++other_alerts;
+        }
+    }
+    CHECK(1 == alert_counts[ELECTRIC_SPIKE]);
+    CHECK(1 == alert_counts[GAS_DROPOUT]);
+    CHECK(1 == alert_counts[ELECTRIC_STATUS_CLEARED]);
+    CHECK(1 == alert_counts[TIMESTAMP_GAP]);
+    CHECK(1 == alert_counts[TIMESTAMP_REGRESSION]);
+    CHECK(0 == other_alerts);
+    CHECK(5 == detector.alert_count && 0 == detector.dropped_alert_count);
+    free_anomaly_detector(&detector);
+}
+
+int main(void)
+{
+    test_sparse_meter_ids();
+    test_usage();
+    test_timestamps();
+    test_status_cleared();
+    test_warmup();
+    test_alert_batches();
+    test_noisy_fleet();
+    return finish_test("test_anomaly_detector");
+}
@@ -0,0 +1,136 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "heavy_hitters.h"
+#include "energy_monitor.h"
+
+#define METER_COUNT 50000
+#define UPDATE_COUNT 1000000
+
+static double exact_weights[METER_COUNT];
+
+static uint64_t next_random(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+/**
+ * @brief Spread dense meter numbers over the 64 bit ID space, reversible by its inverse.
+ */
+static uint64_t to_meter_id(const uint64_t meter)
+{
+    return meter * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+static uint64_t to_meter(const uint64_t meter_id)
+{
+    // Multiplicative inverse of the golden ratio constant modulo 2^64
+    return meter_id * UINT64_C(0xF1DE83E19937733D);
+}
+
+/**
+ * @brief Pick a meter with a skewed, roughly Zipfian, distribution.
+ */
+static uint64_t pick_meter(uint64_t* state)
+{
+    const double uniform = (double) (next_random(state) >> 11) / 9007199254740992.0;
+    return (uint64_t) pow((double) METER_COUNT, uniform * uniform) - 1;
+}
+
+static void test_against_exact(void)
+{
+    static heavy_hitter_tracker tracker;
+    initialise_heavy_hitter_tracker(&tracker);
+    memset(exact_weights, 0, sizeof(exact_weights));
+    uint64_t state = 2463534242ULL;
+    double total_weight = 0.0;
+    for (size_t i = 0; i < UPDATE_COUNT; ++i)
+    {
+        const uint64_t meter = pick_meter(&state);
+        const double weight = 0.5 + (double) (next_random(&state) % 100) / 100.0;
+        exact_weights[meter] += weight;
+        total_weight += weight;
+        add_heavy_hitter_weight(&tracker, to_meter_id(meter), weight);
+    }
+    CHECK(to_meter(to_meter_id(12345)) == 12345);
+    CHECK_CLOSE(tracker.total_weight, total_weight, 1e-9);
+    CHECK(HEAVY_HITTER_CAPACITY == tracker.size);
+    // Every tracked weight brackets the exact weight, within the error bound
+    const double error_bound = get_heavy_hitter_error_bound(&tracker);
+    const double tolerance = 1e-9 * total_weight;
+    static heavy_hitter top[HEAVY_HITTER_CAPACITY];
+    const size_t tracked = get_top_heavy_hitters(&tracker, top, HEAVY_HITTER_CAPACITY);
+    CHECK(HEAVY_HITTER_CAPACITY == tracked);
+    for (size_t i = 0; i < tracked; ++i)
+    {
+        const double exact = exact_weights[to_meter(top[i].meter_id)];
+        CHECK(top[i].weight + tolerance >= exact);
+        CHECK(top[i].weight - top[i].error <= exact + tolerance);
+        CHECK(top[i].error <= error_bound + tolerance);
+        if (0 < i)
+            CHECK(top[i - 1].weight >= top[i].weight);
+    }
+    // Every meter heavier than total / capacity is tracked
+    size_t heavy_count = 0;
+    for (uint64_t meter = 0; meter < METER_COUNT; ++meter)
+    {
+        if (exact_weights[meter] <= total_weight / HEAVY_HITTER_CAPACITY)
+            continue;
+        ++heavy_count;
+        int is_tracked = 0;
+        for (size_t i = 0; i < tracked && !is_tracked; ++i)
+            is_tracked = (to_meter_id(meter) == top[i].meter_id);
+        CHECK(is_tracked);
+    }
+    CHECK(0 < heavy_count);
+    // The heaviest meters of a skewed stream are found in order
+    heavy_hitter top_ten[10];
+    CHECK(10 == get_top_heavy_hitters(&tracker, top_ten, 10));
+    for (size_t i = 0; i < 10; ++i)
+    {
+        size_t heavier = 0;
+        const double exact = exact_weights[to_meter(top_ten[i].meter_id)];
+        for (uint64_t meter = 0; meter < METER_COUNT; ++meter)
+            heavier += (exact_weights[meter] > exact);
+        CHECK(i == heavier);
+    }
+}
+
+static void test_exact_below_capacity(void)
+{
+    static usage_heavy_hitters hitters;
+    initialise_usage_heavy_hitters(&hitters);
+    meter_reading readings[300];
+    memset(readings, 0, sizeof(readings));
+    for (size_t i = 0; i < 300; ++i)
+    {
+        readings[i].meter_id = to_meter_id(i % 100);
+        readings[i].snapshot.electric_usage = (double) (i % 100);
+        readings[i].snapshot.gas_usage = 1.0;
+        // Gas of every third reading not flagged valid
+        readings[i].snapshot.status = (0 == i % 3) ? bitmask_electric_usage :
+                (bitmask_electric_usage | bitmask_gas_usage);
+    }
+    add_readings_to_heavy_hitters(&hitters, readings, 300);
+    CHECK(0.0 == get_heavy_hitter_error_bound(&hitters.electric_usage));
+    heavy_hitter top[3];
+    CHECK(3 == get_top_heavy_hitters(&hitters.electric_usage, top, 3));
+    CHECK(to_meter_id(99) == top[0].meter_id && 3 * 99.0 == top[0].weight);
+    CHECK(to_meter_id(97) == top[2].meter_id && 0.0 == top[2].error);
+    // Meter 0 has no electric usage, so 99 meters are tracked
+    CHECK(99 == hitters.electric_usage.size);
+    CHECK(200.0 == hitters.gas_usage.total_weight);
+}
+
+int main(void)
+{
+    test_against_exact();
+    test_exact_below_capacity();
+    return finish_test("test_heavy_hitters");
+}
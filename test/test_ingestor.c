@@ -0,0 +1,180 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "test.h"
+#include "ingestor.h"
+#include "energy_monitor.h"
+
+/**
+ * @brief Parse a document with the given electric_usage token.
+ */
+static ingest_error parse_electric_usage(const char* number, usage_snapshot* snapshot)
+{
+    char json[128];
+    const int length = snprintf(json, sizeof(json), "{\"timestamp\": 1, \"electric_usage\": %s}",
+            number);
+    return parse_usage_document(json, (size_t) length, snapshot);
+}
+
+static void test_valid_numbers(void)
+{
+    static const char* numbers[] = {"0", "-0", "0.5", "-3.1234500000", "10", "1234567.25",
+            "1.5e+10", "2E-3", "0e0", "12345678901234567890"};
+    static const double values[] = {0.0, -0.0, 0.5, -3.12345, 10.0, 1234567.25, 1.5e10, 2e-3,
+            0.0, 12345678901234567890.0};
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+    {
+        usage_snapshot snapshot;
+        CHECK(INGEST_OK == parse_electric_usage(numbers[i], &snapshot));
+        CHECK(values[i] == snapshot.electric_usage);
+    }
+}
+
+static void test_invalid_numbers(void)
+{
+    // Accepted by strtod, rejected by the JSON grammar
+    static const char* numbers[] = {"1.", "-1.", "01", "-01", "00", "00.5", "0123456789.5",
+            "-", "1e", "1e+", "1.e5", "-.5", "1.2.3", "1-2"};
+    for (size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); ++i)
+    {
+        usage_snapshot snapshot;
+        const ingest_error error = parse_electric_usage(numbers[i], &snapshot);
+        CHECK(INGEST_INVALID_NUMBER == error || INGEST_SYNTAX_ERROR == error);
+        if (INGEST_OK == error)
+            fprintf(stderr, "accepted %s\n", numbers[i]);
+    }
+    usage_snapshot snapshot;
+    const char leading_zero[] = "{\"timestamp\": 01}";
+    CHECK(INGEST_INVALID_NUMBER == parse_usage_document(leading_zero, strlen(leading_zero),
+            &snapshot));
+}
+
+static void test_meter_readings(void)
+{
+    meter_reading reading;
+    const char document[] = "{\"meter_id\": 18446744073709551615, \"timestamp\": 7, "
+            "\"electric_usage\": 0.5}";
+    CHECK(INGEST_OK == parse_meter_reading_document(document, strlen(document), &reading));
+    CHECK(UINT64_MAX == reading.meter_id);
+    CHECK(7 == reading.snapshot.timestamp && 0.5 == reading.snapshot.electric_usage);
+    // Snapshot documents skip meter_id
+    usage_snapshot snapshot;
+    CHECK(INGEST_OK == parse_usage_document(document, strlen(document), &snapshot));
+    CHECK(7 == snapshot.timestamp);
+    const char quoted[] = "{\"timestamp\": 7, \"meter_id\": \"42\"}";
+    CHECK(INGEST_OK == parse_meter_reading_document(quoted, strlen(quoted), &reading));
+    CHECK(42 == reading.meter_id);
+    const char missing[] = "{\"timestamp\": 7}";
+    CHECK(INGEST_MISSING_METER_ID == parse_meter_reading_document(missing, strlen(missing),
+            &reading));
+    CHECK(INGEST_OK == parse_usage_document(missing, strlen(missing), &snapshot));
+    const char negative[] = "{\"meter_id\": -1, \"timestamp\": 7}";
+    CHECK(INGEST_OK != parse_meter_reading_document(negative, strlen(negative), &reading));
+    const char lines[] = "{\"meter_id\": 3, \"timestamp\": 1}\n{\"timestamp\": 2}\n"
+            "{\"meter_id\": 5, \"timestamp\": 3}\n";
+    meter_reading readings[4];
+    ingest_error errors[4];
+    size_t bytes_consumed = 0;
+    CHECK(3 == parse_meter_reading_ndjson(lines, strlen(lines), readings, errors, 4,
+            &bytes_consumed));
+    CHECK(strlen(lines) == bytes_consumed);
+    CHECK(INGEST_OK == errors[0] && 3 == readings[0].meter_id);
+    CHECK(INGEST_MISSING_METER_ID == errors[1]);
+    CHECK(INGEST_OK == errors[2] && 5 == readings[2].meter_id && 3 == readings[2].snapshot.timestamp);
+}
+
+static void test_documents(void)
+{
+    static const char* texts[] = {"{\"timestamp\": 1, \"gas_usage\": 2.5}", "{\"gas_usage\": 2.5}",
+            "{\"timestamp\": 3", "{\"timestamp\": 4, \"status_flags\": \"4\"}"};
+    static const ingest_error expected[] = {INGEST_OK, INGEST_MISSING_TIMESTAMP,
+            INGEST_SYNTAX_ERROR, INGEST_OK};
+    json_document documents[4];
+    for (size_t i = 0; i < 4; ++i)
+    {
+        documents[i].json = texts[i];
+        documents[i].json_length = strlen(texts[i]);
+    }
+    usage_snapshot snapshots[4];
+    ingest_error errors[4];
+    CHECK(2 == parse_usage_documents(documents, 4, snapshots, errors));
+    for (size_t i = 0; i < 4; ++i)
+        CHECK(expected[i] == errors[i]);
+    CHECK(1 == snapshots[0].timestamp && 2.5 == snapshots[0].gas_usage);
+    CHECK(4 == snapshots[3].timestamp && 4 == snapshots[3].status);
+    CHECK(0 == parse_usage_documents(documents, 0, snapshots, errors));
+}
+
+static void test_ndjson(void)
+{
+    // Blank lines, whitespace only and carriage return lines produce no documents
+    const char lines[] = "\n{\"timestamp\": 1}\n   \n\r\n{\"timestamp\": 2}\r\n\n"
+            "{\"timestamp\": 3}\n{\"timestamp\": 4}";
+    const size_t length = strlen(lines);
+    usage_snapshot snapshots[4];
+    ingest_error errors[4];
+    size_t bytes_consumed = 0;
+    CHECK(4 == parse_usage_ndjson(lines, length, snapshots, errors, 4, &bytes_consumed));
+    CHECK(length == bytes_consumed);
+    for (size_t i = 0; i < 4; ++i)
+        CHECK(INGEST_OK == errors[i] && i + 1 == snapshots[i].timestamp);
+    // At capacity, the rest is resumed from bytes_consumed
+    size_t position = 0;
+    uint64_t next_timestamp = 1;
+    size_t calls = 0;
+    while (position < length)
+    {
+        const size_t count = parse_usage_ndjson(lines + position, length - position, snapshots,
+                errors, 1, &bytes_consumed);
+        CHECK(1 >= count && 0 < bytes_consumed);
+        if (1 == count)
+            CHECK(next_timestamp++ == snapshots[0].timestamp);
+        position += bytes_consumed;
+        ++calls;
+    }
+    CHECK(5 == next_timestamp && length == position && 4 == calls);
+    // The first call stops after the first document's newline
+    CHECK(1 == parse_usage_ndjson(lines, length, snapshots, errors, 1, &bytes_consumed));
+    CHECK(strlen("\n{\"timestamp\": 1}\n") == bytes_consumed);
+    CHECK(0 == parse_usage_ndjson(lines, length, snapshots, errors, 0, &bytes_consumed));
+    CHECK(0 == bytes_consumed);
+    CHECK(0 == parse_usage_ndjson("\n \n", 3, snapshots, errors, 4, &bytes_consumed));
+    CHECK(3 == bytes_consumed);
+}
+
+static void test_long_keys(void)
+{
+    char json[512];
+    char key[MAX_KEY_BYTES + 32];
+    memset(key, 'k', sizeof(key) - 1);
+    key[sizeof(key) - 1] = '\0';
+    usage_snapshot snapshot;
+    // Unknown keys longer than MAX_KEY_BYTES are skipped, plain or escaped
+    int length = snprintf(json, sizeof(json), "{\"%s\": 1, \"timestamp\": 5}", key);
+    CHECK(INGEST_OK == parse_usage_document(json, (size_t) length, &snapshot));
+    CHECK(5 == snapshot.timestamp);
+    length = snprintf(json, sizeof(json), "{\"\\u00e9%s\\n\": \"x\", \"timestamp\": 6}", key);
+    CHECK(INGEST_OK == parse_usage_document(json, (size_t) length, &snapshot));
+    CHECK(6 == snapshot.timestamp);
+    // Invalid long keys are still rejected
+    length = snprintf(json, sizeof(json), "{\"%s\\q\": 1, \"timestamp\": 5}", key);
+    CHECK(INGEST_INVALID_STRING == parse_usage_document(json, (size_t) length, &snapshot));
+    length = snprintf(json, sizeof(json), "{\"%s\\udc00\": 1, \"timestamp\": 5}", key);
+    CHECK(INGEST_INVALID_STRING == parse_usage_document(json, (size_t) length, &snapshot));
+    // A known key spelled with escapes still matches
+    const char escaped[] = "{\"\\u0074imestamp\": 7}";
+    CHECK(INGEST_OK == parse_usage_document(escaped, strlen(escaped), &snapshot));
+    CHECK(7 == snapshot.timestamp);
+}
+
+int main(void)
+{
+    test_valid_numbers();
+    test_invalid_numbers();
+    test_meter_readings();
+    test_documents();
+    test_ndjson();
+    test_long_keys();
+    return finish_test("test_ingestor");
+}
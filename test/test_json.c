@@ -0,0 +1,170 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "json.h"
+#include "ingestor.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+/**
+ * @brief Copy text into an exact size heap buffer, no terminator, so overreads are caught by
+ * the address sanitizer.
+ */
+static char* copy_unterminated(const char* text, const size_t length)
+{
+    char* buffer = malloc(length);
+    memcpy(buffer, text, length);
+    return buffer;
+}
+
+static void test_parse_string(void)
+{
+    // Lengths exclude the opening quote
+    char* json = copy_unterminated("abc\", 1", 7);
+    CHECK(3 == parse_string(json, 7));
+    free(json);
+    json = copy_unterminated("a\\\"bcdefghijk\"", 14);
+    CHECK(13 == parse_string(json, 14));
+    free(json);
+    json = copy_unterminated("abcdefghijklmnop", 16);
+    CHECK(JSON_STRING_UNTERMINATED == parse_string(json, 16));
+    free(json);
+    // Buffer ends inside an escape sequence
+    json = copy_unterminated("abc\\", 4);
+    CHECK(JSON_STRING_UNTERMINATED == parse_string(json, 4));
+    free(json);
+    json = copy_unterminated("abc\\\"", 5);
+    CHECK(JSON_STRING_UNTERMINATED == parse_string(json, 5));
+    free(json);
+    CHECK(JSON_STRING_UNTERMINATED == parse_string(NULL, 0));
+}
+
+static void test_unterminated_document(void)
+{
+    // Stops at the unterminated string, the sanitizer reports any overread
+    char* json = copy_unterminated("{\"abc", 5);
+    parse_json_string(json, 5);
+    free(json);
+    json = copy_unterminated("{\"a\": 1, \"b\": \"x\\", 17);
+    parse_json_string(json, 17);
+    free(json);
+    json = copy_unterminated("{\"timestamp\": 1, \"unit\": \"kWh", 29);
+    usage_snapshot snapshot;
+    CHECK(INGEST_SYNTAX_ERROR == parse_usage_document(json, 29, &snapshot));
+    free(json);
+    json = copy_unterminated("{\"timestamp\": 1, \"unit\": \"kWh\"}", 31);
+    CHECK(INGEST_OK == parse_usage_document(json, 31, &snapshot));
+    CHECK(1 == snapshot.timestamp);
+    free(json);
+}
+
+/**
+ * @brief Decode a string through an exact size copy.
+ * @return 1 (true) if decoded, the decoded bytes matching expected when given.
+ */
+static int decode(const char* text, const size_t length, const size_t buffer_length,
+        const char* expected, const size_t expected_length)
+{
+    char* json = copy_unterminated(text, length);
+    char* buffer = (0 < buffer_length) ? malloc(buffer_length) : NULL;
+    const char* decoded = NULL;
+    size_t decoded_length = 0;
+    const int is_decoded = decode_string(json, length, buffer, buffer_length, &decoded,
+            &decoded_length);
+    if (is_decoded && NULL != expected)
+        CHECK(expected_length == decoded_length && 0 == memcmp(expected, decoded, expected_length));
+    free(json);
+    free(buffer);
+    return is_decoded;
+}
+
+static void test_decode_string(void)
+{
+    // No escapes, decoded in place without a buffer
+    CHECK(decode("plain text", 10, 0, "plain text", 10));
+    CHECK(decode("\\\"\\\\\\/\\b\\f\\n\\r\\t", 16, 16, "\"\\/\b\f\n\r\t", 8));
+    CHECK(decode("a\\u0041\\u00e9\\u20AC", 19, 19, "aA\xC3\xA9\xE2\x82\xAC", 7));
+    // Surrogate pair, U+1F50C
+    CHECK(decode("\\ud83d\\udd0c", 12, 12, "\xF0\x9F\x94\x8C", 4));
+    // Lone, reversed and unpaired surrogates
+    CHECK(!decode("\\udd0c", 6, 6, NULL, 0));
+    CHECK(!decode("\\ud83d", 6, 6, NULL, 0));
+    CHECK(!decode("\\ud83dx\\udd0c", 13, 13, NULL, 0));
+    CHECK(!decode("\\ud83d\\u0041", 12, 12, NULL, 0));
+    CHECK(!decode("\\udd0c\\ud83d", 12, 12, NULL, 0));
+    // Invalid escapes, bad hex digits and an escape cut short
+    CHECK(!decode("\\x", 2, 2, NULL, 0));
+    CHECK(!decode("\\u00g1", 6, 6, NULL, 0));
+    CHECK(!decode("\\u004", 5, 5, NULL, 0));
+    CHECK(!decode("ab\\", 3, 3, NULL, 0));
+    // Output buffer too small, for the prefix, a plain byte and a multibyte code point
+    CHECK(!decode("abcd\\n", 6, 3, NULL, 0));
+    CHECK(!decode("\\nabcd", 6, 3, NULL, 0));
+    CHECK(!decode("ab\\u20AC", 8, 4, NULL, 0));
+    CHECK(decode("ab\\u20AC", 8, 5, "ab\xE2\x82\xAC", 5));
+    CHECK(!decode("a\\n", 3, 0, NULL, 0));
+    // Raw control characters must be escaped, in either the word or the tail loop
+    CHECK(!decode("tab\there", 8, 8, NULL, 0));
+    CHECK(!decode("abcdefgh\x01", 9, 9, NULL, 0));
+    CHECK(!decode("abcdefghijklmno\x1f", 16, 16, NULL, 0));
+    CHECK(decode("abcdefgh \x7f", 10, 10, "abcdefgh \x7f", 10));
+    // The ingestor rejects them in values and keys
+    usage_snapshot snapshot;
+    const char value[] = "{\"timestamp\": 1, \"unit\": \"k\tWh\"}";
+    CHECK(INGEST_INVALID_STRING == parse_usage_document(value, strlen(value), &snapshot));
+    const char key[] = "{\"timestamp\": 1, \"u\nit\": 1}";
+    CHECK(INGEST_INVALID_STRING == parse_usage_document(key, strlen(key), &snapshot));
+}
+
+static int is_valid(const char* text, const size_t length)
+{
+    char* json = copy_unterminated(text, length);
+    const int is_valid_text = is_valid_utf8(json, length);
+    free(json);
+    return is_valid_text;
+}
+
+static void test_is_valid_utf8(void)
+{
+    CHECK(is_valid("", 0));
+    CHECK(is_valid("\xC2\x80 \xDF\xBF \xE0\xA0\x80 \xEF\xBF\xBF", 14));
+    CHECK(is_valid("\xF0\x90\x80\x80\xF4\x8F\xBF\xBF", 8));
+    // Overlong encodings of '/', U+07FF and U+FFFF
+    CHECK(!is_valid("\xC0\xAF", 2));
+    CHECK(!is_valid("\xC1\xBF", 2));
+    CHECK(!is_valid("\xE0\x9F\xBF", 3));
+    CHECK(!is_valid("\xF0\x8F\xBF\xBF", 4));
+    // Encoded surrogates U+D800 and U+DFFF
+    CHECK(!is_valid("\xED\xA0\x80", 3));
+    CHECK(!is_valid("\xED\xBF\xBF", 3));
+    CHECK(is_valid("\xED\x9F\xBF", 3));
+    // Above U+10FFFF, and leads that never start a sequence
+    CHECK(!is_valid("\xF4\x90\x80\x80", 4));
+    CHECK(!is_valid("\xF5\x80\x80\x80", 4));
+    CHECK(!is_valid("\xFF", 1));
+    CHECK(!is_valid("\x80", 1));
+    // Bad continuation bytes
+    CHECK(!is_valid("\xE2\x28\xA1", 3));
+    CHECK(!is_valid("\xF0\x90\x28\xBC", 4));
+    // Truncated at the end of the input
+    CHECK(!is_valid("abc\xE2\x82", 5));
+    CHECK(!is_valid("abc\xF0\x9F\x94", 6));
+    // Sequences straddling the 8 byte word boundary, complete and truncated
+    CHECK(is_valid("abcdefg\xE2\x82\xAC", 10));
+    CHECK(is_valid("abcdef\xF0\x9F\x94\x8C" "abcdefgh", 18));
+    CHECK(!is_valid("abcdefg\xE2\x82", 9));
+    CHECK(!is_valid("abcdefgh\xE2", 9));
+    CHECK(!is_valid("abcdefghabcdefg\xF0\x9F\x94", 18));
+}
+
+int main(void)
+{
+    set_log_level(ERROR);
+    test_parse_string();
+    test_unterminated_document();
+    test_decode_string();
+    test_is_valid_utf8();
+    return finish_test("test_json");
+}
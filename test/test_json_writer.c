@@ -0,0 +1,388 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "json_writer.h"
+#include "json.h"
+#include "log.h"
+
+// Records of the large document, far more than all the chunks hold
+#define RECORD_COUNT 20000
+// Distinct key strings of the large document, more than the key arena holds
+#define KEY_COUNT 200
+#define RECORD_BYTES 128
+
+/**
+ * @brief Reads everything written to a pipe, on its own thread.
+ */
+typedef struct
+{
+    int fd;
+    size_t read_bytes;
+    long pause_nanoseconds;
+    char* data;
+    size_t length;
+    size_t capacity;
+} pipe_reader;
+
+/**
+ * @brief Captured output of a writer, a pipe and the thread reading it.
+ */
+typedef struct
+{
+    int fds[2];
+    pthread_t thread;
+    pipe_reader reader;
+} capture;
+
+static void* read_pipe(void* argument)
+{
+    pipe_reader* reader = argument;
+    // Interrupts are meant for the writing thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    for (;;)
+    {
+        if (reader->capacity < reader->length + reader->read_bytes + 1)
+        {
+            reader->capacity = 2 * (reader->length + reader->read_bytes + 1);
+            reader->data = realloc(reader->data, reader->capacity);
+            if (NULL == reader->data)
+                return NULL;
+        }
+        const ssize_t count = read(reader->fd, reader->data + reader->length, reader->read_bytes);
+        if (0 > count && EINTR == errno)
+            continue;
+        if (0 >= count)
+            break;
+        reader->length += (size_t) count;
+        if (0 < reader->pause_nanoseconds)
+        {
+            struct timespec pause = {0, reader->pause_nanoseconds};
+            nanosleep(&pause, NULL);
+        }
+    }
+    reader->data[reader->length] = '\0';
+    return NULL;
+}
+
+/**
+ * @brief Start capturing, the writer writes to capture->fds[1].
+ * @param read_bytes bytes per read, small reads with a pause keep the pipe full.
+ * @param send_bytes 0 for a pipe, otherwise a socket pair with this send buffer. A pipe
+ * fills and drains in whole pages, a small socket buffer does not, so writes interrupted
+ * part way stop inside a chunk.
+ */
+static void start_capture(capture* output, const size_t read_bytes, const long pause_nanoseconds,
+        const int send_bytes)
+{
+    memset(output, 0, sizeof(*output));
+    if (0 == send_bytes)
+        CHECK(0 == pipe(output->fds));
+    else
+    {
+        CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, output->fds));
+        CHECK(0 == setsockopt(output->fds[1], SOL_SOCKET, SO_SNDBUF, &send_bytes,
+                sizeof(send_bytes)));
+    }
+    output->reader.fd = output->fds[0];
+    output->reader.read_bytes = read_bytes;
+    output->reader.pause_nanoseconds = pause_nanoseconds;
+    CHECK(0 == pthread_create(&output->thread, NULL, read_pipe, &output->reader));
+}
+
+/**
+ * @brief Close the write end and wait for the reader.
+ * @return the output, NUL terminated, owned by the caller.
+ */
+static char* finish_capture(capture* output)
+{
+    close(output->fds[1]);
+    pthread_join(output->thread, NULL);
+    close(output->fds[0]);
+    CHECK(NULL != output->reader.data);
+    return output->reader.data;
+}
+
+/**
+ * @brief Write a tree through a pipe as a single document.
+ * @return 1 (true) if the output is expected.
+ */
+static int is_written_as(json_writer* writer, const json_object* object, const char* expected)
+{
+    capture output;
+    start_capture(&output, 4096, 0, 0);
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(write_json_object(writer, object) && flush_json_writer(writer));
+    char* text = finish_capture(&output);
+    const int is_expected = NULL != text && 0 == strcmp(expected, text);
+    if (!is_expected)
+        fprintf(stderr, "expected %s\nwritten  %s\n", expected, (NULL == text) ? "" : text);
+    free(text);
+    return is_expected;
+}
+
+static void test_escaping(json_writer* writer)
+{
+    // Quotes, backslashes, short escapes and \u00XX control characters, in keys and values.
+    // DEL and UTF-8 are copied as they are.
+    const json_item items[] = {
+        {"plain", 5, "text", 4, 0, STRING},
+        {"q\"b\\s/", 6, "a\"b\\c/d", 7, 0, STRING},
+        {"k\n\t", 3, "\b\f\n\r\t", 5, 0, STRING},
+        {"\x01\x1f", 2, "x\x00y\x1f\x7f", 5, 0, STRING},
+        {"caf\xC3\xA9", 5, "\xE2\x82\xAC", 3, 0, STRING},
+        {"empty", 5, "", 0, 0, STRING},
+        {"integer", 7, "-42", 3, 0, INTEGER},
+        {"float", 5, "1.5e-3", 6, 0, FLOAT},
+        {"boolean", 7, "true", 4, 0, BOOLEAN},
+        {"null", 4, NULL, 0, 0, NULL_VALUE}
+    };
+    const size_t count = sizeof(items) / sizeof(items[0]);
+    // A root ITEM is written as an object of its items
+    const json_object root = {NULL, ITEM, (void*) items, count, count};
+    CHECK(is_written_as(writer, &root, "{\"plain\": \"text\", \"q\\\"b\\\\s/\": \"a\\\"b\\\\c/d\", "
+            "\"k\\n\\t\": \"\\b\\f\\n\\r\\t\", \"\\u0001\\u001f\": \"x\\u0000y\\u001f\x7f\", "
+            "\"caf\xC3\xA9\": \"\xE2\x82\xAC\", \"empty\": \"\", \"integer\": -42, "
+            "\"float\": 1.5e-3, \"boolean\": true, \"null\": null}"));
+    // Written again, the keys now come from the cache
+    CHECK(is_written_as(writer, &root, "{\"plain\": \"text\", \"q\\\"b\\\\s/\": \"a\\\"b\\\\c/d\", "
+            "\"k\\n\\t\": \"\\b\\f\\n\\r\\t\", \"\\u0001\\u001f\": \"x\\u0000y\\u001f\x7f\", "
+            "\"caf\xC3\xA9\": \"\xE2\x82\xAC\", \"empty\": \"\", \"integer\": -42, "
+            "\"float\": 1.5e-3, \"boolean\": true, \"null\": null}"));
+}
+
+static void test_nested(json_writer* writer)
+{
+    const json_item values[] = {
+        {NULL, 0, "1", 1, 1, INTEGER},
+        {NULL, 0, "two", 3, 1, STRING}
+    };
+    const json_item members[] = {{"id", 2, "7", 1, 0, INTEGER}};
+    json_object elements[] = {
+        {NULL, ITEM, (void*) values, 2, 2},
+        {NULL, ARRAY, NULL, 0, 0},
+        {NULL, ITEM, (void*) members, 1, 1}
+    };
+    json_object inner[] = {{NULL, ITEM, (void*) members, 1, 1}};
+    json_object children[] = {
+        {"list", ARRAY, elements, 3, 3},
+        {"inner", OBJECT, inner, 1, 1},
+        {"empty", OBJECT, NULL, 0, 0},
+        {NULL, ITEM, (void*) members, 1, 1}
+    };
+    const json_object root = {NULL, OBJECT, children, 4, 4};
+    // ITEM children splice their items into the container, values in an array
+    CHECK(is_written_as(writer, &root, "{\"list\": [1, \"two\", [], 7], \"inner\": {\"id\": 7}, "
+            "\"empty\": {}, \"id\": 7}"));
+    const json_object list = {NULL, ARRAY, elements, 3, 3};
+    CHECK(is_written_as(writer, &list, "[1, \"two\", [], 7]"));
+}
+
+static void test_streamed_arrays(json_writer* writer)
+{
+    const json_item members[] = {{"id", 2, "7", 1, 0, INTEGER}};
+    const json_object record = {NULL, ITEM, (void*) members, 1, 1};
+    capture output;
+    start_capture(&output, 4096, 0, 0);
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(write_json_array_begin(writer) && write_json_object(writer, &record));
+    CHECK(write_json_array_begin(writer) && write_json_array_end(writer));
+    CHECK(write_json_array_begin(writer) && write_json_object(writer, &record) &&
+            write_json_object(writer, &record) && write_json_array_end(writer));
+    CHECK(write_json_object(writer, &record) && write_json_array_end(writer));
+    CHECK(write_json_newline(writer) && write_json_array_begin(writer) &&
+            write_json_array_end(writer) && write_json_newline(writer));
+    CHECK(flush_json_writer(writer));
+    char* text = finish_capture(&output);
+    CHECK(NULL != text && 0 == strcmp("[{\"id\": 7}, [], [{\"id\": 7}, {\"id\": 7}], "
+            "{\"id\": 7}]\n[]\n", text));
+    free(text);
+}
+
+static void test_key_cache(json_writer* writer)
+{
+    // Key storage reused for another key of the same length, at the same address
+    char key[8] = "alpha";
+    const json_item first[] = {{key, 5, "1", 1, 0, INTEGER}};
+    const json_object first_root = {NULL, ITEM, (void*) first, 1, 1};
+    capture output;
+    start_capture(&output, 4096, 0, 0);
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(write_json_object(writer, &first_root));
+    memcpy(key, "bravo", 5);
+    CHECK(write_json_object(writer, &first_root));
+    // Enough distinct keys to fill the arena, the cache starts over and the first key with it
+    static char keys[KEY_COUNT][16];
+    size_t resets = 0;
+    for (size_t i = 0; i < KEY_COUNT; ++i)
+    {
+        const int length = snprintf(keys[i], sizeof(keys[i]), "key\t%03zu_field", i);
+        const json_item item[] = {{keys[i], (size_t) length, "0", 1, 0, INTEGER}};
+        const json_object root = {NULL, ITEM, (void*) item, 1, 1};
+        const size_t arena_length = writer->key_arena_length;
+        CHECK(write_json_object(writer, &root));
+        resets += (writer->key_arena_length < arena_length);
+    }
+    CHECK(0 < resets);
+    CHECK(write_json_object(writer, &first_root) && flush_json_writer(writer));
+    char* text = finish_capture(&output);
+    char* expected = malloc(KEY_COUNT * 32 + 64);
+    size_t length = (size_t) sprintf(expected, "{\"alpha\": 1}{\"bravo\": 1}");
+    for (size_t i = 0; i < KEY_COUNT; ++i)
+        length += (size_t) sprintf(expected + length, "{\"key\\t%03zu_field\": 0}", i);
+    sprintf(expected + length, "{\"bravo\": 1}");
+    CHECK(NULL != text && NULL != expected && 0 == strcmp(expected, text));
+    free(expected);
+    free(text);
+}
+
+static void handle_interrupt(int signal_number)
+{
+    (void) signal_number;
+}
+
+typedef struct
+{
+    pthread_t target;
+    volatile int is_done;
+} interrupter;
+
+/**
+ * @brief Signal the writing thread until it is done, so blocked writes return part written.
+ */
+static void* interrupt_writes(void* argument)
+{
+    interrupter* source = argument;
+    const struct timespec pause = {0, 200000};
+    while (!source->is_done)
+    {
+        pthread_kill(source->target, SIGUSR1);
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+static void test_large_document(json_writer* writer)
+{
+    static char keys[KEY_COUNT][16];
+    for (size_t i = 0; i < KEY_COUNT; ++i)
+        snprintf(keys[i], sizeof(keys[i]), "field_%03zu", i);
+    char* expected = malloc(RECORD_COUNT * RECORD_BYTES);
+    CHECK(NULL != expected);
+    if (NULL == expected)
+        return;
+    // Interrupted writes to a socket that is kept full return part written, no SA_RESTART
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_interrupt;
+    sigemptyset(&action.sa_mask);
+    CHECK(0 == sigaction(SIGUSR1, &action, NULL));
+    capture output;
+    start_capture(&output, 512, 20000, 5000);
+    interrupter source = {pthread_self(), 0};
+    pthread_t interrupt_thread;
+    CHECK(0 == pthread_create(&interrupt_thread, NULL, interrupt_writes, &source));
+    initialise_json_writer(writer, output.fds[1]);
+    size_t length = (size_t) sprintf(expected, "[");
+    CHECK(write_json_array_begin(writer));
+    for (size_t i = 0; i < RECORD_COUNT; ++i)
+    {
+        char value[32];
+        const int value_length = snprintf(value, sizeof(value), "%zu", i * 7919);
+        const char* first_key = keys[i % KEY_COUNT];
+        const char* second_key = keys[(i * 31 + 7) % KEY_COUNT];
+        const json_item items[] = {
+            {first_key, strlen(first_key), value, (size_t) value_length, 0, INTEGER},
+            {second_key, strlen(second_key), "a \"quoted\" value", 16, 0, STRING}
+        };
+        const json_object record = {NULL, ITEM, (void*) items, 2, 2};
+        CHECK(write_json_object(writer, &record));
+        length += (size_t) sprintf(expected + length, "%s{\"%s\": %s, \"%s\": "
+                "\"a \\\"quoted\\\" value\"}", (0 == i) ? "" : ", ", first_key, value, second_key);
+    }
+    CHECK(write_json_array_end(writer) && write_json_newline(writer));
+    CHECK(flush_json_writer(writer));
+    source.is_done = 1;
+    pthread_join(interrupt_thread, NULL);
+    sprintf(expected + length, "]\n");
+    char* text = finish_capture(&output);
+    CHECK(NULL != text && JSON_WRITER_CHUNKS * JSON_WRITER_CHUNK_BYTES * 10 < strlen(text));
+    CHECK(NULL != text && 0 == strcmp(expected, text));
+    signal(SIGUSR1, SIG_DFL);
+    free(expected);
+    free(text);
+}
+
+static void test_sticky_failure(json_writer* writer)
+{
+    const json_item members[] = {{"id", 2, "7", 1, 0, INTEGER}};
+    const json_object record = {NULL, ITEM, (void*) members, 1, 1};
+    // The reader has gone, the flush fails and so does every later call
+    int fds[2];
+    CHECK(0 == pipe(fds));
+    close(fds[0]);
+    initialise_json_writer(writer, fds[1]);
+    CHECK(write_json_object(writer, &record));
+    CHECK(!flush_json_writer(writer));
+    CHECK(writer->is_failed);
+    CHECK(!write_json_object(writer, &record));
+    CHECK(!write_json_array_begin(writer));
+    CHECK(!write_json_array_end(writer));
+    CHECK(!write_json_newline(writer));
+    CHECK(!flush_json_writer(writer));
+    close(fds[1]);
+    // Invalid trees fail the writer too, until it is initialised again
+    const json_item invalid_value[] = {{"id", 2, NULL, 0, 0, INTEGER}};
+    const json_object invalid = {NULL, ITEM, (void*) invalid_value, 1, 1};
+    json_object unnamed_children[] = {{NULL, OBJECT, NULL, 0, 0}};
+    const json_object unnamed = {NULL, OBJECT, unnamed_children, 1, 1};
+    capture output;
+    start_capture(&output, 4096, 0, 0);
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(!write_json_array_end(writer));
+    CHECK(!write_json_object(writer, &record));
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(!write_json_object(writer, &invalid));
+    CHECK(!flush_json_writer(writer));
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(!write_json_object(writer, &unnamed));
+    initialise_json_writer(writer, output.fds[1]);
+    CHECK(write_json_object(writer, &record) && flush_json_writer(writer));
+    char* text = finish_capture(&output);
+    CHECK(NULL != text && 0 == strcmp("{\"id\": 7}", text));
+    free(text);
+}
+
+int main(void)
+{
+    set_log_level(ERROR);
+    // A closed pipe fails the write instead of ending the test
+    signal(SIGPIPE, SIG_IGN);
+    json_writer* writer = malloc(sizeof(json_writer));
+    if (NULL == writer)
+    {
+        fprintf(stderr, "JSON writer allocation failed.\n");
+        return EXIT_FAILURE;
+    }
+    test_escaping(writer);
+    test_nested(writer);
+    test_streamed_arrays(writer);
+    test_key_cache(writer);
+    test_large_document(writer);
+    test_sticky_failure(writer);
+    free(writer);
+    return finish_test("test_json_writer");
+}
@@ -0,0 +1,250 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "load_generator.h"
+#include "ingestor.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+#define READING_COUNT 20000
+#define METER_COUNT 50
+#define PATH_CHARACTERS 512
+
+/**
+ * @brief Read a whole file into a heap buffer.
+ * @return the buffer, NULL if the file could not be read.
+ */
+static char* read_file(const char* path, size_t* length)
+{
+    *length = 0;
+    FILE* file = fopen(path, "rb");
+    if (NULL == file)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    const long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* data = malloc((0 < size) ? (size_t) size : 1);
+    if (NULL != data && 0 < size && (size_t) size != fread(data, 1, (size_t) size, file))
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    *length = (NULL == data || 0 > size) ? 0 : (size_t) size;
+    return data;
+}
+
+/**
+ * @brief Generate a stream into a file.
+ * @return 1 (true) if successful.
+ */
+static int generate_file(const generator_config* config, const char* path, generator_stats* stats)
+{
+    const int fd = open_generator_output(path);
+    if (0 > fd)
+        return 0;
+    const int is_successful = generate_load(config, fd, stats);
+    close(fd);
+    return is_successful;
+}
+
+/**
+ * @brief Compare two files byte for byte.
+ */
+static int is_same_file(const char* path, const char* other_path)
+{
+    size_t length = 0;
+    size_t other_length = 0;
+    char* data = read_file(path, &length);
+    char* other_data = read_file(other_path, &other_length);
+    const int is_same = NULL != data && NULL != other_data && length == other_length &&
+            0 == memcmp(data, other_data, length);
+    free(data);
+    free(other_data);
+    return is_same;
+}
+
+/**
+ * @brief Parse an NDJSON capture through the ingestor.
+ * @param readings output readings, room for READING_COUNT.
+ * @param errors output result codes, room for READING_COUNT.
+ * @return number of documents, one per line.
+ */
+static size_t ingest_file(const char* path, meter_reading* readings, ingest_error* errors)
+{
+    size_t length = 0;
+    char* data = read_file(path, &length);
+    CHECK(NULL != data);
+    size_t bytes_consumed = 0;
+    const size_t count = (NULL == data) ? 0 : parse_meter_reading_ndjson(data, length, readings,
+            errors, READING_COUNT, &bytes_consumed);
+    CHECK(length == bytes_consumed);
+    free(data);
+    return count;
+}
+
+static void test_reproducible(const char* directory)
+{
+    char path[PATH_CHARACTERS];
+    char same_path[PATH_CHARACTERS];
+    char other_path[PATH_CHARACTERS];
+    snprintf(path, sizeof(path), "%s/first.ndjson", directory);
+    snprintf(same_path, sizeof(same_path), "%s/same.ndjson", directory);
+    snprintf(other_path, sizeof(other_path), "%s/other.ndjson", directory);
+    generator_config config;
+    initialise_generator_config(&config);
+    config.reading_count = READING_COUNT;
+    config.meter_count = METER_COUNT;
+    config.malformed_rate = 0.01;
+    config.out_of_order_rate = 0.01;
+    generator_stats stats;
+    generator_stats same_stats;
+    CHECK(generate_file(&config, path, &stats));
+    CHECK(generate_file(&config, same_path, &same_stats));
+    CHECK(is_same_file(path, same_path));
+    CHECK(stats.bytes == same_stats.bytes && stats.malformed == same_stats.malformed);
+    CHECK(READING_COUNT == stats.readings);
+    // Another seed, another stream
+    config.seed = 2;
+    CHECK(generate_file(&config, other_path, &stats));
+    CHECK(!is_same_file(path, other_path));
+    // Binary records, the same again
+    config.format = FORMAT_BINARY;
+    CHECK(generate_file(&config, path, &stats));
+    CHECK(generate_file(&config, same_path, &same_stats));
+    CHECK(is_same_file(path, same_path));
+    CHECK(READING_COUNT * sizeof(meter_reading) == stats.bytes);
+}
+
+static void test_stats(const char* directory)
+{
+    static meter_reading readings[READING_COUNT];
+    static ingest_error errors[READING_COUNT];
+    char path[PATH_CHARACTERS];
+    snprintf(path, sizeof(path), "%s/stats.ndjson", directory);
+    generator_config config;
+    initialise_generator_config(&config);
+    config.reading_count = READING_COUNT;
+    config.meter_count = METER_COUNT;
+    // Malformed lines only, each fails to ingest
+    config.malformed_rate = 0.02;
+    config.out_of_order_rate = 0.0;
+    generator_stats stats;
+    CHECK(generate_file(&config, path, &stats));
+    CHECK(READING_COUNT == ingest_file(path, readings, errors));
+    size_t malformed = 0;
+    for (size_t i = 0; i < READING_COUNT; ++i)
+        malformed += (INGEST_OK != errors[i]);
+    CHECK(0 < stats.malformed && stats.malformed == malformed);
+    CHECK(0 == stats.out_of_order);
+    // Out of order readings only, one meter so every reading has its own timestamp
+    config.meter_count = 1;
+    config.malformed_rate = 0.0;
+    config.out_of_order_rate = 0.02;
+    CHECK(generate_file(&config, path, &stats));
+    CHECK(READING_COUNT == ingest_file(path, readings, errors));
+    size_t out_of_order = 0;
+    uint64_t newest = 0;
+    uint64_t timestamp_sum = 0;
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        CHECK(INGEST_OK == errors[i]);
+        const uint64_t timestamp = readings[i].snapshot.timestamp;
+        out_of_order += (timestamp < newest);
+        newest = (timestamp > newest) ? timestamp : newest;
+        timestamp_sum += (timestamp - config.start_timestamp) / config.interval_seconds;
+    }
+    CHECK(0 < stats.out_of_order && stats.out_of_order == out_of_order);
+    CHECK(0 == stats.malformed);
+    // Every reading is written exactly once, held back or not
+    CHECK((uint64_t) READING_COUNT * (READING_COUNT - 1) / 2 == timestamp_sum);
+}
+
+static void test_replay(const char* directory)
+{
+    static meter_reading readings[READING_COUNT];
+    static ingest_error errors[READING_COUNT];
+    static meter_reading replayed[READING_COUNT];
+    static ingest_error replayed_errors[READING_COUNT];
+    char capture_path[PATH_CHARACTERS];
+    char replay_path[PATH_CHARACTERS];
+    snprintf(capture_path, sizeof(capture_path), "%s/capture.ndjson", directory);
+    snprintf(replay_path, sizeof(replay_path), "%s/replay.ndjson", directory);
+    generator_config config;
+    initialise_generator_config(&config);
+    config.reading_count = READING_COUNT;
+    config.meter_count = METER_COUNT;
+    config.malformed_rate = 0.01;
+    config.out_of_order_rate = 0.01;
+    generator_stats stats;
+    CHECK(generate_file(&config, capture_path, &stats));
+    // Replayed as fast as possible, the same bytes and counts
+    const int fd = open_generator_output(replay_path);
+    CHECK(0 <= fd);
+    generator_stats replay_stats;
+    CHECK(replay_capture(capture_path, FORMAT_NDJSON, 0.0, fd, &replay_stats));
+    close(fd);
+    CHECK(is_same_file(capture_path, replay_path));
+    CHECK(stats.bytes == replay_stats.bytes);
+    CHECK(stats.malformed == replay_stats.malformed);
+    CHECK(READING_COUNT - stats.malformed == replay_stats.readings);
+    CHECK(0 < replay_stats.out_of_order && replay_stats.out_of_order <= stats.out_of_order);
+    // Both ingest to the same readings, every well formed one a reading of a known meter
+    CHECK(READING_COUNT == ingest_file(capture_path, readings, errors));
+    CHECK(READING_COUNT == ingest_file(replay_path, replayed, replayed_errors));
+    size_t ingested = 0;
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        CHECK(errors[i] == replayed_errors[i]);
+        if (INGEST_OK != errors[i])
+            continue;
+        ++ingested;
+        CHECK(0 == memcmp(readings + i, replayed + i, sizeof(meter_reading)));
+        CHECK(METER_COUNT > readings[i].meter_id);
+        const int usage_bits = bitmask_electric_usage | bitmask_gas_usage;
+        CHECK(usage_bits == (readings[i].snapshot.status & usage_bits));
+        CHECK(0.0 < readings[i].snapshot.electric_usage && 0.0 < readings[i].snapshot.gas_cost);
+    }
+    CHECK(replay_stats.readings == ingested);
+    CHECK(!replay_capture("/nonexistent/capture.ndjson", FORMAT_NDJSON, 0.0, fd, &replay_stats));
+}
+
+static void test_closed_socket(void)
+{
+    // The peer has gone, the generator fails instead of being killed by SIGPIPE
+    int sockets[2];
+    CHECK(0 == socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+    close(sockets[1]);
+    generator_config config;
+    initialise_generator_config(&config);
+    config.reading_count = READING_COUNT;
+    generator_stats stats;
+    CHECK(!generate_load(&config, sockets[0], &stats));
+    close(sockets[0]);
+}
+
+int main(void)
+{
+    set_log_level(ERROR);
+    char directory[] = "/tmp/test_load_generator_XXXXXX";
+    if (NULL == mkdtemp(directory))
+    {
+        fprintf(stderr, "Unable to create a temporary directory.\n");
+        return EXIT_FAILURE;
+    }
+    test_reproducible(directory);
+    test_stats(directory);
+    test_replay(directory);
+    test_closed_socket();
+    char command[PATH_CHARACTERS + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    CHECK(0 == system(command));
+    return finish_test("test_load_generator");
+}
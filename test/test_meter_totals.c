@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "meter_totals.h"
+#include "segment_store.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+#define READING_COUNT 3000
+#define METER_COUNT 50
+// Readings per segment, the store rolls several times
+#define SEGMENT_READINGS 700
+// Readings replayed per read
+#define REPLAY_CAPACITY 128
+
+static meter_reading readings[READING_COUNT];
+
+/**
+ * @brief Create readings of METER_COUNT meters, with timestamps out of order.
+ */
+static void create_readings(void)
+{
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        memset(readings + i, 0, sizeof(meter_reading));
+        readings[i].meter_id = 1000 + i % METER_COUNT;
+        readings[i].snapshot.timestamp = 5000 + (i * 7919) % READING_COUNT;
+        readings[i].snapshot.electric_usage = 0.5;
+        readings[i].snapshot.status = bitmask_electric_usage;
+    }
+}
+
+/**
+ * @brief Fold the readings of a store after a position into totals, as a restart would.
+ * @return number of readings replayed, STORE_QUERY_FAILED if the store could not be read.
+ */
+static size_t replay_store(segment_store* store, meter_totals* totals, store_position* position)
+{
+    static meter_reading replayed[REPLAY_CAPACITY];
+    size_t replayed_count = 0;
+    size_t count = 0;
+    while (0 < (count = read_readings_from_position(store, position, replayed, REPLAY_CAPACITY)))
+    {
+        if (STORE_QUERY_FAILED == count)
+            return STORE_QUERY_FAILED;
+        CHECK(add_readings_to_meter_totals(totals, replayed, count));
+        replayed_count += count;
+    }
+    return replayed_count;
+}
+
+static void test_checkpoint_position(const char* directory, const char* path)
+{
+    segment_store store;
+    CHECK(open_segment_store(&store, directory, SEGMENT_READINGS * sizeof(meter_reading)));
+    meter_totals totals;
+    CHECK(initialise_meter_totals(&totals, METER_COUNT));
+    // Fold the first half, appended and flushed to the store first
+    CHECK(append_readings(&store, readings, READING_COUNT / 2) && flush_segment_store(&store));
+    CHECK(add_readings_to_meter_totals(&totals, readings, READING_COUNT / 2));
+    store_position position;
+    CHECK(get_segment_store_position(&store, &position));
+    CHECK(READING_COUNT / 2 / SEGMENT_READINGS == position.sequence);
+    CHECK(READING_COUNT / 2 % SEGMENT_READINGS == position.record_count);
+    set_meter_totals_position(&totals, &position);
+    checkpoint_writer writer;
+    CHECK(initialise_checkpoint_writer(&writer, path, 0));
+    CHECK(start_checkpoint(&writer, &totals));
+    CHECK(finish_checkpoint(&writer));
+    // Readings after the checkpoint, older than some already folded, are still replayed
+    CHECK(append_readings(&store, readings + READING_COUNT / 2, READING_COUNT / 2));
+    // Rolls flushed the earlier segments, the readings of the active one are still buffered
+    // so not part of the position
+    CHECK(get_segment_store_position(&store, &position));
+    CHECK(READING_COUNT / SEGMENT_READINGS == position.sequence && 0 == position.record_count);
+    CHECK(flush_segment_store(&store) && get_segment_store_position(&store, &position));
+    CHECK(READING_COUNT / SEGMENT_READINGS == position.sequence);
+    CHECK(READING_COUNT % SEGMENT_READINGS == position.record_count);
+    CHECK(add_readings_to_meter_totals(&totals, readings + READING_COUNT / 2, READING_COUNT / 2));
+    close_segment_store(&store);
+    // Restart, load the checkpoint and replay the store from its position, across segments
+    CHECK(open_segment_store(&store, directory, SEGMENT_READINGS * sizeof(meter_reading)));
+    meter_totals loaded;
+    CHECK(load_meter_totals(&loaded, path));
+    store_position replay_position = loaded.header->position;
+    CHECK(READING_COUNT / 2 / SEGMENT_READINGS == replay_position.sequence);
+    CHECK(READING_COUNT / 2 % SEGMENT_READINGS == replay_position.record_count);
+    CHECK(READING_COUNT / 2 == replay_store(&store, &loaded, &replay_position));
+    CHECK(get_segment_store_position(&store, &position));
+    CHECK(position.sequence == replay_position.sequence);
+    CHECK(position.record_count == replay_position.record_count);
+    for (uint64_t meter_id = 1000; meter_id < 1000 + METER_COUNT; ++meter_id)
+    {
+        const meter_total* expected = find_meter_total(&totals, meter_id);
+        const meter_total* actual = find_meter_total(&loaded, meter_id);
+        CHECK(NULL != expected && NULL != actual);
+        if (NULL == expected || NULL == actual)
+            continue;
+        CHECK(READING_COUNT / METER_COUNT == actual->reading_count);
+        CHECK(expected->electric_usage == actual->electric_usage);
+    }
+    // Replay from the start reads every reading in the order appended
+    static meter_reading stored[READING_COUNT];
+    replay_position.sequence = 0;
+    replay_position.record_count = 0;
+    CHECK(READING_COUNT == read_readings_from_position(&store, &replay_position, stored,
+            READING_COUNT));
+    CHECK(0 == memcmp(readings, stored, sizeof(stored)));
+    CHECK(0 == read_readings_from_position(&store, &replay_position, stored, READING_COUNT));
+    // Positions that are not in the store
+    replay_position.sequence = READING_COUNT;
+    replay_position.record_count = 0;
+    CHECK(STORE_QUERY_FAILED == read_readings_from_position(&store, &replay_position, stored,
+            READING_COUNT));
+    replay_position.sequence = 0;
+    replay_position.record_count = SEGMENT_READINGS + 1;
+    CHECK(STORE_QUERY_FAILED == read_readings_from_position(&store, &replay_position, stored,
+            READING_COUNT));
+    free_meter_totals(&loaded);
+    free_meter_totals(&totals);
+    close_segment_store(&store);
+}
+
+/**
+ * @brief Overwrite the capacity and size of a checkpoint header.
+ */
+static void corrupt_header(const char* path, const uint64_t capacity, const uint64_t size)
+{
+    const int fd = open(path, O_WRONLY);
+    CHECK(0 <= fd);
+    CHECK(sizeof(capacity) == pwrite(fd, &capacity, sizeof(capacity),
+            offsetof(meter_totals_header, capacity)));
+    CHECK(sizeof(size) == pwrite(fd, &size, sizeof(size), offsetof(meter_totals_header, size)));
+    close(fd);
+}
+
+static void test_invalid_checkpoints(const char* path)
+{
+    meter_totals totals;
+    CHECK(initialise_meter_totals(&totals, METER_COUNT));
+    CHECK(add_readings_to_meter_totals(&totals, readings, READING_COUNT));
+    checkpoint_writer writer;
+    CHECK(initialise_checkpoint_writer(&writer, path, 0));
+    CHECK(start_checkpoint(&writer, &totals));
+    CHECK(finish_checkpoint(&writer));
+    const uint64_t capacity = totals.header->capacity;
+    free_meter_totals(&totals);
+    meter_totals loaded;
+    CHECK(load_meter_totals(&loaded, path));
+    free_meter_totals(&loaded);
+    // A full table has no empty slot, a lookup of a missing meter would never end
+    corrupt_header(path, capacity, capacity);
+    CHECK(!load_meter_totals(&loaded, path));
+    corrupt_header(path, capacity, capacity * METER_TOTALS_LOAD_NUMERATOR /
+            METER_TOTALS_LOAD_DENOMINATOR + 1);
+    CHECK(!load_meter_totals(&loaded, path));
+    corrupt_header(path, capacity, capacity * METER_TOTALS_LOAD_NUMERATOR /
+            METER_TOTALS_LOAD_DENOMINATOR);
+    CHECK(load_meter_totals(&loaded, path));
+    free_meter_totals(&loaded);
+    // Capacities that wrap the region size, or leave no slots
+    corrupt_header(path, UINT64_MAX / sizeof(meter_total) + 1, 0);
+    CHECK(!load_meter_totals(&loaded, path));
+    corrupt_header(path, 0, 0);
+    CHECK(!load_meter_totals(&loaded, path));
+}
+
+int main(void)
+{
+    set_log_level(ERROR);
+    char directory[] = "/tmp/test_meter_totals_XXXXXX";
+    if (NULL == mkdtemp(directory))
+    {
+        fprintf(stderr, "Unable to create a temporary directory.\n");
+        return EXIT_FAILURE;
+    }
+    char path[MAX_PATH_CHARACTERS];
+    snprintf(path, sizeof(path), "%s/totals.checkpoint", directory);
+    create_readings();
+    test_checkpoint_position(directory, path);
+    test_invalid_checkpoints(path);
+    char command[MAX_PATH_CHARACTERS + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    CHECK(0 == system(command));
+    return finish_test("test_meter_totals");
+}
@@ -0,0 +1,70 @@
+#include <math.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "packed_snapshot.h"
+#include "energy_monitor.h"
+
+#define BASE_TIMESTAMP UINT64_C(1717372800)
+
+static usage_snapshot create_snapshot(const uint64_t timestamp, const double electric_usage,
+        const double gas_usage)
+{
+    usage_snapshot snapshot = {timestamp, electric_usage, electric_usage * 0.25, gas_usage,
+            gas_usage * 0.07, 15};
+    return snapshot;
+}
+
+static void test_round_trip(void)
+{
+    const usage_snapshot snapshots[3] = {create_snapshot(BASE_TIMESTAMP, 1.0, 2.5),
+            create_snapshot(BASE_TIMESTAMP + 1800, -0.000001, 1234.567891),
+            create_snapshot(BASE_TIMESTAMP + PACKED_SNAPSHOT_MAX_OFFSET, PACKED_SNAPSHOT_MAX_VALUE,
+                    -PACKED_SNAPSHOT_MAX_VALUE)};
+    packed_usage_snapshot packed[3];
+    pack_error error = PACK_VALUE_OUT_OF_RANGE;
+    CHECK(3 == pack_snapshots(snapshots, 3, BASE_TIMESTAMP, packed, &error));
+    CHECK(PACK_OK == error);
+    usage_snapshot unpacked[3];
+    unpack_snapshots(packed, 3, BASE_TIMESTAMP, unpacked);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        CHECK(snapshots[i].timestamp == unpacked[i].timestamp);
+        CHECK(snapshots[i].status == unpacked[i].status);
+        CHECK(fabs(snapshots[i].electric_usage - unpacked[i].electric_usage) <= 5e-7);
+        CHECK(fabs(snapshots[i].electric_cost - unpacked[i].electric_cost) <= 5e-7);
+        CHECK(fabs(snapshots[i].gas_usage - unpacked[i].gas_usage) <= 5e-7);
+        CHECK(fabs(snapshots[i].gas_cost - unpacked[i].gas_cost) <= 5e-7);
+    }
+}
+
+static void test_out_of_range(void)
+{
+    packed_usage_snapshot packed[3];
+    pack_error error = PACK_OK;
+    // A timestamp past the block needs a new base
+    const usage_snapshot late[2] = {create_snapshot(BASE_TIMESTAMP, 1.0, 1.0),
+            create_snapshot(BASE_TIMESTAMP + PACKED_SNAPSHOT_MAX_OFFSET + 1, 1.0, 1.0)};
+    CHECK(1 == pack_snapshots(late, 2, BASE_TIMESTAMP, packed, &error));
+    CHECK(PACK_TIMESTAMP_OUT_OF_RANGE == error);
+    CHECK(PACK_TIMESTAMP_OUT_OF_RANGE == pack_snapshot(late, BASE_TIMESTAMP + 1, packed));
+    // A value out of range is reported apart from the timestamp, no base helps
+    const usage_snapshot large[3] = {create_snapshot(BASE_TIMESTAMP, 1.0, 1.0),
+            create_snapshot(BASE_TIMESTAMP + 1, 5000.0, 1.0),
+            create_snapshot(BASE_TIMESTAMP + 2, 1.0, 1.0)};
+    CHECK(1 == pack_snapshots(large, 3, BASE_TIMESTAMP, packed, &error));
+    CHECK(PACK_VALUE_OUT_OF_RANGE == error);
+    CHECK(PACK_VALUE_OUT_OF_RANGE == pack_snapshot(large + 1, BASE_TIMESTAMP + 1, packed));
+    const usage_snapshot not_a_number = create_snapshot(BASE_TIMESTAMP, 1.0, NAN);
+    CHECK(PACK_VALUE_OUT_OF_RANGE == pack_snapshot(&not_a_number, BASE_TIMESTAMP, packed));
+    const usage_snapshot just_over = create_snapshot(BASE_TIMESTAMP, 1.0,
+            PACKED_SNAPSHOT_MAX_VALUE + 0.000001);
+    CHECK(PACK_VALUE_OUT_OF_RANGE == pack_snapshot(&just_over, BASE_TIMESTAMP, packed));
+}
+
+int main(void)
+{
+    test_round_trip();
+    test_out_of_range();
+    return finish_test("test_packed_snapshot");
+}
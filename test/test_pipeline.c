@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "pipeline.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+// Seconds before a hung pipeline is reported by SIGALRM
+#define PIPELINE_TIMEOUT_SECONDS 60
+// Lines per input of the backpressure test, several times what the chunk and batch pools hold
+#define BACKPRESSURE_LINES UINT64_C(200000)
+#define SLOW_SINK_NANOSECONDS (2 * 1000 * 1000)
+
+typedef struct
+{
+    uint64_t snapshots;
+    uint64_t timestamp_sum;
+    uint64_t meter_id_sum;
+} sink_totals;
+
+static void count_snapshots(const snapshot_batch* batch, void* context)
+{
+    sink_totals* totals = context;
+    uint64_t timestamp_sum = 0;
+    for (size_t i = 0; i < batch->count; ++i)
+        timestamp_sum += batch->snapshots[i].timestamp;
+    __atomic_add_fetch(&totals->snapshots, batch->count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totals->timestamp_sum, timestamp_sum, __ATOMIC_RELAXED);
+}
+
+static void count_readings(const meter_reading_batch* batch, void* context)
+{
+    sink_totals* totals = context;
+    uint64_t timestamp_sum = 0;
+    uint64_t meter_id_sum = 0;
+    for (size_t i = 0; i < batch->count; ++i)
+    {
+        timestamp_sum += batch->readings[i].snapshot.timestamp;
+        meter_id_sum += batch->readings[i].meter_id;
+    }
+    __atomic_add_fetch(&totals->snapshots, batch->count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totals->timestamp_sum, timestamp_sum, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&totals->meter_id_sum, meter_id_sum, __ATOMIC_RELAXED);
+}
+
+typedef struct
+{
+    int output_fds[MAX_STAGE_THREADS];
+    size_t input_count;
+    size_t lines;
+} input_writer;
+
+/**
+ * @brief Write the inputs to their pipes, one after another, once every reader is waiting.
+ * Readers take their first chunk before their input has data, as they would on a live feed.
+ */
+static void* write_inputs(void* argument)
+{
+    input_writer* writer = argument;
+    const struct timespec delay = {0, 100 * 1000 * 1000};
+    nanosleep(&delay, NULL);
+    for (size_t i = 0; i < writer->input_count; ++i)
+    {
+        FILE* file = fdopen(writer->output_fds[i], "w");
+        for (size_t j = 0; j < writer->lines; ++j)
+            fprintf(file, "{\"meter_id\": %zu, \"timestamp\": %llu, \"electric_usage\": 0.25, "
+                    "\"gas_usage\": 1.5}\n", j % 10, (unsigned long long) (i * writer->lines + j));
+        fclose(file);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Run a pipeline over input_count piped inputs, each a few chunks long.
+ * @param is_meter_reading 1 (true) to consume meter readings, 0 to consume snapshots.
+ */
+static void test_inputs(const size_t input_count, const size_t parser_count,
+        const size_t sink_count, const int is_meter_reading)
+{
+    input_writer writer;
+    writer.input_count = input_count;
+    writer.lines = 3 * PIPELINE_CHUNK_BYTES / 64;
+    int input_fds[MAX_STAGE_THREADS];
+    uint64_t expected_sum = 0;
+    uint64_t expected_meter_id_sum = 0;
+    for (size_t i = 0; i < input_count; ++i)
+    {
+        int fds[2];
+        CHECK(0 == pipe(fds));
+        input_fds[i] = fds[0];
+        writer.output_fds[i] = fds[1];
+        for (size_t j = 0; j < writer.lines; ++j)
+        {
+            expected_sum += i * writer.lines + j;
+            expected_meter_id_sum += j % 10;
+        }
+    }
+    pthread_t writer_thread;
+    CHECK(0 == pthread_create(&writer_thread, NULL, write_inputs, &writer));
+    sink_totals totals = {0, 0, 0};
+    const pipeline_config config = {input_fds, input_count, parser_count, sink_count,
+            is_meter_reading ? NULL : count_snapshots, &totals,
+            is_meter_reading ? count_readings : NULL};
+    pipeline_stats stats;
+    CHECK(run_pipeline(&config, &stats));
+    pthread_join(writer_thread, NULL);
+    CHECK(input_count * writer.lines == totals.snapshots);
+    CHECK(expected_sum == totals.timestamp_sum);
+    // Snapshot consumers skip meter_id
+    CHECK((is_meter_reading ? expected_meter_id_sum : 0) == totals.meter_id_sum);
+    CHECK(0 == stats.parse_errors);
+    CHECK(totals.snapshots == stats.sink.records);
+    for (size_t i = 0; i < input_count; ++i)
+        close(input_fds[i]);
+}
+
+/**
+ * @brief Sink slower than the readers and parsers, each batch takes SLOW_SINK_NANOSECONDS.
+ */
+static void count_snapshots_slowly(const snapshot_batch* batch, void* context)
+{
+    const struct timespec delay = {0, SLOW_SINK_NANOSECONDS};
+    nanosleep(&delay, NULL);
+    count_snapshots(batch, context);
+}
+
+/**
+ * @brief A slow sink holds every batch, parsers then hold every chunk, and the readers of a
+ * file, which never waits on its input, must stall on the bounded pools.
+ */
+static void test_backpressure(void)
+{
+    char path[] = "/tmp/test_pipeline_XXXXXX";
+    const int output_fd = mkstemp(path);
+    CHECK(0 <= output_fd);
+    FILE* file = fdopen(output_fd, "w");
+    for (uint64_t i = 0; i < BACKPRESSURE_LINES; ++i)
+        fprintf(file, "{\"timestamp\": %llu, \"electric_usage\": 0.25, \"gas_usage\": 1.5}\n",
+                (unsigned long long) i);
+    fclose(file);
+    int input_fds[2];
+    input_fds[0] = open(path, O_RDONLY);
+    input_fds[1] = open(path, O_RDONLY);
+    unlink(path);
+    CHECK(0 <= input_fds[0] && 0 <= input_fds[1]);
+    sink_totals totals = {0, 0, 0};
+    const pipeline_config config = {input_fds, 2, 1, 1, count_snapshots_slowly, &totals, NULL};
+    pipeline_stats stats;
+    CHECK(run_pipeline(&config, &stats));
+    CHECK(2 * BACKPRESSURE_LINES == totals.snapshots);
+    CHECK(BACKPRESSURE_LINES * (BACKPRESSURE_LINES - 1) == totals.timestamp_sum);
+    // More input than the pools hold, so readers and parsers waited on free chunks and batches
+    CHECK(0 < stats.reader.stalls);
+    CHECK(0 < stats.parser.stalls);
+    // Each wait outlasts a sink batch, far longer than the spin, so the waiters blocked
+    CHECK(0 < stats.reader.blocks && 0 < stats.parser.blocks);
+    CHECK(PIPELINE_POOL_SIZE >= stats.batch_queue.max_occupancy);
+    CHECK(PIPELINE_POOL_SIZE + 2 >= stats.chunk_queue.max_occupancy);
+    close(input_fds[0]);
+    close(input_fds[1]);
+}
+
+int main(void)
+{
+    set_log_level(ERROR);
+    // A deadlock fails the test instead of hanging it
+    alarm(PIPELINE_TIMEOUT_SECONDS);
+    test_inputs(1, 1, 1, 0);
+    test_inputs(4, 2, 2, 0);
+    test_inputs(4, 2, 2, 1);
+    // As many readers as chunks in the base pool, each holding one while waiting for another
+    test_inputs(MAX_STAGE_THREADS, 1, 1, 0);
+    test_inputs(MAX_STAGE_THREADS, 4, 3, 1);
+    test_backpressure();
+    // Both or neither consumer is invalid
+    const int input_fd = 0;
+    pipeline_config invalid = {&input_fd, 1, 1, 1, count_snapshots, NULL, count_readings};
+    pipeline_stats stats;
+    CHECK(!run_pipeline(&invalid, &stats));
+    invalid.consumer = NULL;
+    invalid.reading_consumer = NULL;
+    CHECK(!run_pipeline(&invalid, &stats));
+    return finish_test("test_pipeline");
+}
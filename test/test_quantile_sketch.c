@@ -0,0 +1,182 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "quantile_sketch.h"
+
+#define VALUE_COUNT 200000
+#define THREAD_COUNT 4
+
+static double values[VALUE_COUNT];
+
+static double next_uniform(uint64_t* state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (double) (*state >> 11) / 9007199254740992.0;
+}
+
+/**
+ * @brief Fill values with a log-uniform spread over a factor of e^log_span, every zero_every
+ * value zero.
+ */
+static void create_values(const double log_span, const size_t zero_every)
+{
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < VALUE_COUNT; ++i)
+        values[i] = (0 == i % zero_every) ? 0.0 : 0.01 * exp(log_span * next_uniform(&state));
+}
+
+static int compare_values(const void* left, const void* right)
+{
+    const double left_value = *(const double*) left;
+    const double right_value = *(const double*) right;
+    return (left_value > right_value) - (left_value < right_value);
+}
+
+static void test_accuracy(void)
+{
+    // A factor of e^5, about 148, fits the bucket window, so every quantile is within accuracy
+    create_values(5.0, 1000);
+    quantile_sketch sketch;
+    initialise_quantile_sketch(&sketch);
+    for (size_t i = 0; i < VALUE_COUNT; ++i)
+        add_to_quantile_sketch(&sketch, values[i]);
+    qsort(values, VALUE_COUNT, sizeof(double), compare_values);
+    const double quantiles[] = {0.0, 0.0005, 0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99,
+            0.999, 1.0};
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+    {
+        const double exact = values[(size_t) (quantiles[i] * (VALUE_COUNT - 1))];
+        const double estimate = get_quantile(&sketch, quantiles[i]);
+        if (0.0 == exact)
+            CHECK(0.0 == estimate);
+        else
+            CHECK(fabs(estimate - exact) <= QUANTILE_SKETCH_ACCURACY * exact * (1.0 + 1e-9));
+    }
+    CHECK(VALUE_COUNT == sketch.count);
+    CHECK(VALUE_COUNT / 1000 == sketch.zero_count);
+    CHECK(values[VALUE_COUNT - 1] == sketch.max);
+    quantile_sketch empty;
+    initialise_quantile_sketch(&empty);
+    CHECK(0.0 == get_quantile(&empty, 0.5));
+}
+
+/**
+ * @brief Check p50 and p95 of a sketch of the first count values against the exact ones.
+ */
+static void check_quantiles(const size_t count)
+{
+    quantile_sketch sketch;
+    initialise_quantile_sketch(&sketch);
+    for (size_t i = 0; i < count; ++i)
+        add_to_quantile_sketch(&sketch, values[i]);
+    qsort(values, count, sizeof(double), compare_values);
+    const double quantiles[] = {0.0, 0.5, 0.95, 1.0};
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i)
+    {
+        const double exact = values[(size_t) (quantiles[i] * (double) (count - 1))];
+        const double estimate = get_quantile(&sketch, quantiles[i]);
+        CHECK(fabs(estimate - exact) <= QUANTILE_SKETCH_ACCURACY * exact * (1.0 + 1e-9));
+    }
+}
+
+static void test_outlier(void)
+{
+    // One reading far above the rest must not collapse the buckets of the others
+    uint64_t state = 88172645463325252ULL;
+    for (size_t i = 0; i < 10000; ++i)
+        values[i] = 1.0 + next_uniform(&state);
+    check_quantiles(10000);
+    values[10000] = 1000.0;
+    check_quantiles(10001);
+    // Nor one at the far end of the documented range
+    values[10001] = 5e8;
+    check_quantiles(10002);
+}
+
+static void test_bimodal(void)
+{
+    // Standby readings with a few peaks, p50 is standby and p95 is peak
+    for (size_t i = 0; i < 10000; ++i)
+        values[i] = (0 == i % 10) ? 5.0 : 0.02;
+    check_quantiles(10000);
+    // Down to the smallest value sketched, below the peaks
+    for (size_t i = 0; i < 10000; ++i)
+        values[i] = (0 == i % 10) ? 5.0 : 2.0 * QUANTILE_SKETCH_MIN_VALUE;
+    check_quantiles(10000);
+}
+
+typedef struct
+{
+    size_t first;
+    quantile_sketch sketch;
+} sketch_thread;
+
+static void* add_part(void* argument)
+{
+    sketch_thread* part = argument;
+    initialise_quantile_sketch(&part->sketch);
+    // Interleaved blocks, so every thread sees low and high values in a different order
+    for (size_t i = part->first * 1000; i < VALUE_COUNT; i += THREAD_COUNT * 1000)
+        for (size_t j = i; j < i + 1000 && j < VALUE_COUNT; ++j)
+            add_to_quantile_sketch(&part->sketch, values[j]);
+    return NULL;
+}
+
+static void check_equal_sketches(const quantile_sketch* merged, const quantile_sketch* single)
+{
+    CHECK(merged->count == single->count);
+    CHECK(merged->zero_count == single->zero_count);
+    CHECK(merged->min == single->min);
+    CHECK(merged->max == single->max);
+    CHECK_CLOSE(merged->sum, single->sum, 1e-12);
+    CHECK(merged->offset == single->offset);
+    CHECK(0 == memcmp(merged->counts, single->counts, sizeof(merged->counts)));
+    for (size_t i = 0; i <= 1000; ++i)
+        CHECK(get_quantile(merged, i / 1000.0) == get_quantile(single, i / 1000.0));
+}
+
+/**
+ * @brief Sketches built by threads over parts of the values, merged, equal a single sketch.
+ * @param log_span spread of the values, wide spans collapse low buckets.
+ */
+static void test_merge(const double log_span)
+{
+    create_values(log_span, 97);
+    quantile_sketch single;
+    initialise_quantile_sketch(&single);
+    for (size_t i = 0; i < VALUE_COUNT; ++i)
+        add_to_quantile_sketch(&single, values[i]);
+    sketch_thread parts[THREAD_COUNT];
+    pthread_t threads[THREAD_COUNT];
+    for (size_t i = 0; i < THREAD_COUNT; ++i)
+    {
+        parts[i].first = i;
+        CHECK(0 == pthread_create(threads + i, NULL, add_part, parts + i));
+    }
+    quantile_sketch merged;
+    initialise_quantile_sketch(&merged);
+    // Merged in reverse order of the threads, the order must not matter either
+    for (size_t i = THREAD_COUNT; 0 < i; --i)
+    {
+        pthread_join(threads[i - 1], NULL);
+        merge_quantile_sketch(&merged, &parts[i - 1].sketch);
+    }
+    check_equal_sketches(&merged, &single);
+}
+
+int main(void)
+{
+    test_accuracy();
+    test_outlier();
+    test_bimodal();
+    test_merge(4.0);
+    // Far wider than the window, the lowest bucket collapses in every sketch
+    test_merge(50.0);
+    return finish_test("test_quantile_sketch");
+}
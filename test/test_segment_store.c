@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "segment_store.h"
+#include "energy_monitor.h"
+#include "log.h"
+
+#define SEGMENT_READINGS STORE_INDEX_INTERVAL
+// Query test, four blocks per segment and three meters interleaved
+#define QUERY_SEGMENT_BLOCKS 4
+#define QUERY_READINGS (10 * STORE_INDEX_INTERVAL)
+#define QUERY_METERS 3
+#define QUERY_BASE_TIMESTAMP 10000
+
+static meter_reading readings[STORE_WRITE_BUFFER_READINGS];
+static meter_reading found[2 * STORE_WRITE_BUFFER_READINGS];
+
+static void create_readings(const uint64_t first_timestamp, const size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        memset(readings + i, 0, sizeof(meter_reading));
+        readings[i].meter_id = 7;
+        readings[i].snapshot.timestamp = first_timestamp + i;
+    }
+}
+
+static size_t count_readings(segment_store* store)
+{
+    return query_readings(store, 7, 0, UINT64_MAX, found, 2 * STORE_WRITE_BUFFER_READINGS);
+}
+
+/**
+ * @brief Limit the size of files written, writes past it fail with EFBIG.
+ */
+static void set_file_size_limit(const rlim_t bytes)
+{
+    struct rlimit limit;
+    getrlimit(RLIMIT_FSIZE, &limit);
+    limit.rlim_cur = bytes;
+    CHECK(0 == setrlimit(RLIMIT_FSIZE, &limit));
+}
+
+static void test_failed_write(const char* directory)
+{
+    struct rlimit original;
+    getrlimit(RLIMIT_FSIZE, &original);
+    segment_store store;
+    CHECK(open_segment_store(&store, directory, STORE_DEFAULT_SEGMENT_BYTES));
+    create_readings(1000, 1000);
+    CHECK(append_readings(&store, readings, 1000) && flush_segment_store(&store));
+    // Room for 100 and a half more readings, the next flush writes a partial reading and fails
+    set_file_size_limit(1000 * sizeof(meter_reading) + 201 * sizeof(meter_reading) / 2);
+    create_readings(5000, STORE_WRITE_BUFFER_READINGS);
+    CHECK(!append_readings(&store, readings, STORE_WRITE_BUFFER_READINGS));
+    set_file_size_limit(original.rlim_cur);
+    // Only the readings written before the failed flush remain, and are all readable
+    CHECK(1000 == count_readings(&store));
+    CHECK(1000 == found[0].snapshot.timestamp && 1999 == found[999].snapshot.timestamp);
+    CHECK(0 == query_readings(&store, 7, 5000, UINT64_MAX, found, 1));
+    create_readings(9000, 10);
+    CHECK(append_readings(&store, readings, 10));
+    CHECK(1010 == count_readings(&store));
+    CHECK(9009 == found[1009].snapshot.timestamp);
+    close_segment_store(&store);
+    CHECK(open_segment_store(&store, directory, STORE_DEFAULT_SEGMENT_BYTES));
+    CHECK(1010 == count_readings(&store));
+    close_segment_store(&store);
+}
+
+static void test_failed_roll(const char* directory)
+{
+    const size_t segment_bytes = SEGMENT_READINGS * sizeof(meter_reading);
+    segment_store store;
+    CHECK(open_segment_store(&store, directory, segment_bytes));
+    // A directory in place of the next segment file makes the roll fail
+    char path[MAX_PATH_CHARACTERS];
+    snprintf(path, sizeof(path), "%s/segment_%020llu.dat", directory, 1ULL);
+    CHECK(0 == mkdir(path, 0755));
+    create_readings(1, SEGMENT_READINGS + 1);
+    CHECK(!append_readings(&store, readings, SEGMENT_READINGS + 1));
+    CHECK(store.is_failed);
+    CHECK(!append_readings(&store, readings, 1));
+    CHECK(!flush_segment_store(&store));
+    close_segment_store(&store);
+    CHECK(0 == rmdir(path));
+    // Reopening recovers the sealed segment
+    CHECK(open_segment_store(&store, directory, segment_bytes));
+    CHECK(SEGMENT_READINGS == count_readings(&store));
+    CHECK(append_readings(&store, readings + SEGMENT_READINGS, 1));
+    CHECK(SEGMENT_READINGS + 1 == count_readings(&store));
+    close_segment_store(&store);
+}
+
+static meter_reading stored[QUERY_READINGS];
+
+/**
+ * @brief Readings of QUERY_METERS meters, timestamps shuffled within groups of 8 and the last
+ * block opening with late readings as old as the first.
+ */
+static void create_query_readings(void)
+{
+    for (size_t i = 0; i < QUERY_READINGS; ++i)
+    {
+        memset(stored + i, 0, sizeof(meter_reading));
+        stored[i].meter_id = 1 + i % QUERY_METERS;
+        stored[i].snapshot.timestamp = QUERY_BASE_TIMESTAMP + (i ^ 5);
+        stored[i].snapshot.electric_usage = (double) i;
+    }
+    for (size_t i = QUERY_READINGS - STORE_INDEX_INTERVAL; i < QUERY_READINGS - 
+            STORE_INDEX_INTERVAL + 8; ++i)
+        stored[i].snapshot.timestamp = QUERY_BASE_TIMESTAMP + i % 8;
+}
+
+/**
+ * @brief Check a query against a scan of the readings appended, in the order stored.
+ */
+static void check_query(segment_store* store, const uint64_t meter_id,
+        const uint64_t from_timestamp, const uint64_t to_timestamp)
+{
+    size_t expected = 0;
+    const size_t count = query_readings(store, meter_id, from_timestamp, to_timestamp, found,
+            2 * STORE_WRITE_BUFFER_READINGS);
+    for (size_t i = 0; i < QUERY_READINGS; ++i)
+    {
+        if (meter_id != stored[i].meter_id || from_timestamp > stored[i].snapshot.timestamp ||
+                to_timestamp < stored[i].snapshot.timestamp)
+            continue;
+        CHECK(expected < count && stored[i].snapshot.electric_usage ==
+                found[expected].snapshot.electric_usage);
+        ++expected;
+    }
+    CHECK(expected == count);
+}
+
+static void check_queries(segment_store* store)
+{
+    for (uint64_t meter_id = 1; meter_id <= QUERY_METERS; ++meter_id)
+    {
+        check_query(store, meter_id, 0, UINT64_MAX);
+        check_query(store, meter_id, QUERY_BASE_TIMESTAMP + 300, QUERY_BASE_TIMESTAMP + 700);
+        // Late readings in the last segment match with those of the first block
+        check_query(store, meter_id, QUERY_BASE_TIMESTAMP, QUERY_BASE_TIMESTAMP + 7);
+        check_query(store, meter_id, QUERY_BASE_TIMESTAMP + QUERY_READINGS - 3, UINT64_MAX);
+    }
+    CHECK(0 == query_readings(store, QUERY_METERS + 1, 0, UINT64_MAX, found, 1));
+    CHECK(0 == query_readings(store, 1, QUERY_BASE_TIMESTAMP + QUERY_READINGS, UINT64_MAX,
+            found, 1));
+    // Counted beyond capacity
+    CHECK(QUERY_READINGS / QUERY_METERS + 1 == query_readings(store, 1, 0, UINT64_MAX, found, 1));
+}
+
+static void get_segment_path(const char* directory, const uint64_t sequence,
+        const char* suffix, char* path)
+{
+    snprintf(path, MAX_PATH_CHARACTERS, "%s/segment_%020llu%s", directory,
+            (unsigned long long) sequence, suffix);
+}
+
+static void create_file(const char* path)
+{
+    const int fd = open(path, O_CREAT | O_WRONLY, 0644);
+    CHECK(0 <= fd);
+    CHECK(1 == write(fd, "x", 1));
+    close(fd);
+}
+
+static void test_queries(const char* directory)
+{
+    const size_t segment_bytes = QUERY_SEGMENT_BLOCKS * STORE_INDEX_INTERVAL *
+            sizeof(meter_reading);
+    segment_store store;
+    CHECK(open_segment_store(&store, directory, segment_bytes));
+    create_query_readings();
+    // Appended in uneven batches, across buffer flushes and segment rolls
+    CHECK(append_readings(&store, stored, 100));
+    CHECK(append_readings(&store, stored + 100, QUERY_READINGS - 100));
+    CHECK(3 == store.segment_count);
+    check_queries(&store);
+    close_segment_store(&store);
+    // Files that only resemble data files are ignored
+    char path[MAX_PATH_CHARACTERS];
+    get_segment_path(directory, 7, ".data", path);
+    create_file(path);
+    get_segment_path(directory, 8, ".dat.tmp", path);
+    create_file(path);
+    CHECK(open_segment_store(&store, directory, segment_bytes));
+    CHECK(3 == store.segment_count && 2 == store.segments[2].sequence);
+    // Sealed segment indexes are mapped, the active segment index rebuilt on the heap
+    CHECK(NULL != store.segments[0].mapping && NULL != store.segments[1].mapping);
+    CHECK(NULL == store.segments[2].mapping);
+    CHECK(QUERY_READINGS - 2 * QUERY_SEGMENT_BLOCKS * STORE_INDEX_INTERVAL ==
+            store.segments[2].record_count);
+    check_queries(&store);
+    // Segments outside the range are not opened, so a missing one only fails queries over it
+    char moved_path[MAX_PATH_CHARACTERS];
+    get_segment_path(directory, 1, ".dat", path);
+    get_segment_path(directory, 1, ".moved", moved_path);
+    CHECK(0 == rename(path, moved_path));
+    check_query(&store, 2, QUERY_BASE_TIMESTAMP + 300, QUERY_BASE_TIMESTAMP + 700);
+    CHECK(STORE_QUERY_FAILED == query_readings(&store, 2, QUERY_BASE_TIMESTAMP + 1100,
+            QUERY_BASE_TIMESTAMP + 1200, found, 1));
+    CHECK(0 == rename(moved_path, path));
+    // Blocks outside the range are not read, readings planted in block 2 are never seen
+    meter_reading planted[STORE_INDEX_INTERVAL];
+    memcpy(planted, stored, sizeof(planted));
+    get_segment_path(directory, 0, ".dat", path);
+    const int fd = open(path, O_WRONLY);
+    CHECK(0 <= fd);
+    CHECK((ssize_t) sizeof(planted) == pwrite(fd, planted, sizeof(planted),
+            2 * sizeof(planted)));
+    close(fd);
+    check_query(&store, 1, QUERY_BASE_TIMESTAMP, QUERY_BASE_TIMESTAMP + 300);
+    close_segment_store(&store);
+}
+
+static void test_partial_record(const char* directory)
+{
+    segment_store store;
+    CHECK(open_segment_store(&store, directory, STORE_DEFAULT_SEGMENT_BYTES));
+    create_readings(1, 100);
+    CHECK(append_readings(&store, readings, 100));
+    close_segment_store(&store);
+    // A crash mid-write leaves part of a reading at the end of the active segment
+    char path[MAX_PATH_CHARACTERS];
+    get_segment_path(directory, 0, ".dat", path);
+    const int fd = open(path, O_WRONLY | O_APPEND);
+    CHECK(0 <= fd);
+    CHECK((ssize_t) sizeof(meter_reading) / 2 == write(fd, readings, sizeof(meter_reading) / 2));
+    close(fd);
+    CHECK(open_segment_store(&store, directory, STORE_DEFAULT_SEGMENT_BYTES));
+    struct stat file_status;
+    CHECK(0 == stat(path, &file_status));
+    CHECK(100 * sizeof(meter_reading) == (size_t) file_status.st_size);
+    CHECK(100 == count_readings(&store));
+    // Appends continue after the last whole reading
+    create_readings(101, 1);
+    CHECK(append_readings(&store, readings, 1));
+    CHECK(101 == count_readings(&store) && 101 == found[100].snapshot.timestamp);
+    close_segment_store(&store);
+}
+
+/**
+ * @brief A query flushes first, a flush that fails fails the query.
+ */
+static void test_failed_query(const char* directory)
+{
+    struct rlimit original;
+    getrlimit(RLIMIT_FSIZE, &original);
+    segment_store store;
+    CHECK(open_segment_store(&store, directory, STORE_DEFAULT_SEGMENT_BYTES));
+    set_file_size_limit(0);
+    create_readings(1, 10);
+    CHECK(append_readings(&store, readings, 10));
+    CHECK(STORE_QUERY_FAILED == count_readings(&store));
+    set_file_size_limit(original.rlim_cur);
+    close_segment_store(&store);
+}
+
+static void remove_directory(const char* directory)
+{
+    char command[MAX_PATH_CHARACTERS + 16];
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    CHECK(0 == system(command));
+}
+
+int main(void)
+{
+    set_log_level(ERROR);
+    // Writes past the file size limit fail with EFBIG instead of raising SIGXFSZ
+    signal(SIGXFSZ, SIG_IGN);
+    char write_directory[] = "/tmp/test_segment_store_XXXXXX";
+    char roll_directory[] = "/tmp/test_segment_store_XXXXXX";
+    char query_directory[] = "/tmp/test_segment_store_XXXXXX";
+    char partial_directory[] = "/tmp/test_segment_store_XXXXXX";
+    char failed_directory[] = "/tmp/test_segment_store_XXXXXX";
+    if (NULL == mkdtemp(write_directory) || NULL == mkdtemp(roll_directory) ||
+            NULL == mkdtemp(query_directory) || NULL == mkdtemp(partial_directory) ||
+            NULL == mkdtemp(failed_directory))
+    {
+        fprintf(stderr, "Unable to create a temporary directory.\n");
+        return EXIT_FAILURE;
+    }
+    test_failed_write(write_directory);
+    test_failed_roll(roll_directory);
+    test_queries(query_directory);
+    test_partial_record(partial_directory);
+    test_failed_query(failed_directory);
+    remove_directory(write_directory);
+    remove_directory(roll_directory);
+    remove_directory(query_directory);
+    remove_directory(partial_directory);
+    remove_directory(failed_directory);
+    return finish_test("test_segment_store");
+}
@@ -0,0 +1,182 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test.h"
+#include "tariff.h"
+#include "energy_monitor.h"
+
+// Local midnight of 2024-06-03 in a UTC+1 tariff
+#define LOCAL_MIDNIGHT (UINT64_C(1717372800) - 3600)
+#define READING_COUNT 5000
+#define READING_STEP_SECONDS 97
+
+static const double electric_unit_rate[TARIFF_BAND_COUNT] = {0.15, 0.30};
+static const double gas_unit_rate[TARIFF_BAND_COUNT] = {0.05, 0.07};
+
+static void initialise_test_tariff(tariff* tariff_table)
+{
+    initialise_tariff(tariff_table, electric_unit_rate, gas_unit_rate, 0.50, 0.30, 3600);
+    CHECK(set_tariff_band(tariff_table, PEAK, 16 * 3600, 19 * 3600));
+    // Wraps past midnight
+    CHECK(set_tariff_band(tariff_table, PEAK, 22 * 3600, 6 * 3600));
+    CHECK(!set_tariff_band(tariff_table, TARIFF_BAND_COUNT, 0, 3600));
+    CHECK(!set_tariff_band(tariff_table, PEAK, 0, TARIFF_SECONDS_PER_DAY + 1));
+}
+
+static usage_snapshot create_snapshot(const uint64_t timestamp, const double electric_usage,
+        const double gas_usage, const uint8_t status)
+{
+    usage_snapshot snapshot = {timestamp, electric_usage, -1.0, gas_usage, -1.0, status};
+    return snapshot;
+}
+
+static void test_reference(const tariff* tariff_table)
+{
+    // Band lookup, including both sides of the wrapped band
+    CHECK(PEAK == tariff_table->slot_band[get_tariff_slot(tariff_table, LOCAL_MIDNIGHT + 23 * 3600)]);
+    CHECK(PEAK == tariff_table->slot_band[get_tariff_slot(tariff_table, LOCAL_MIDNIGHT + 5 * 3600 + 1799)]);
+    CHECK(OFF_PEAK == tariff_table->slot_band[get_tariff_slot(tariff_table, LOCAL_MIDNIGHT + 6 * 3600)]);
+    CHECK(OFF_PEAK == tariff_table->slot_band[get_tariff_slot(tariff_table, LOCAL_MIDNIGHT + 12 * 3600)]);
+    CHECK(PEAK == tariff_table->slot_band[get_tariff_slot(tariff_table, LOCAL_MIDNIGHT + 17 * 3600)]);
+    CHECK(OFF_PEAK == tariff_table->slot_band[get_tariff_slot(tariff_table, LOCAL_MIDNIGHT + 19 * 3600)]);
+    // Peak and off peak prices
+    usage_snapshot snapshot = create_snapshot(LOCAL_MIDNIGHT + 17 * 3600, 2.0, 4.0, 15);
+    price_snapshot(tariff_table, &snapshot);
+    CHECK(2.0 * 0.30 == snapshot.electric_cost);
+    CHECK(4.0 * 0.07 == snapshot.gas_cost);
+    CHECK(15 == snapshot.status);
+    snapshot = create_snapshot(LOCAL_MIDNIGHT + 12 * 3600, 2.0, 4.0, 15);
+    price_snapshot(tariff_table, &snapshot);
+    CHECK(2.0 * 0.15 == snapshot.electric_cost);
+    CHECK(4.0 * 0.05 == snapshot.gas_cost);
+    // Cleared usage bits clear the cost and its bit, stale cost bits are cleared too
+    snapshot = create_snapshot(LOCAL_MIDNIGHT + 12 * 3600, 2.0, 4.0,
+            (uint8_t) (bitmask_gas_usage | bitmask_electric_cost));
+    price_snapshot(tariff_table, &snapshot);
+    CHECK(0.0 == snapshot.electric_cost);
+    CHECK(4.0 * 0.05 == snapshot.gas_cost);
+    CHECK((bitmask_gas_usage | bitmask_gas_cost) == snapshot.status);
+    // Usage not flagged valid is never read into the cost, even when NaN or infinite
+    snapshot = create_snapshot(LOCAL_MIDNIGHT + 12 * 3600, NAN, INFINITY, 0);
+    price_snapshot(tariff_table, &snapshot);
+    CHECK(0.0 == snapshot.electric_cost && 0.0 == snapshot.gas_cost);
+    tariff_totals totals;
+    compute_tariff_totals(tariff_table, &snapshot, 1, &totals);
+    CHECK(0.0 == totals.electric_energy_cost && 0.0 == totals.gas_energy_cost);
+}
+
+static void create_readings(usage_snapshot* snapshots)
+{
+    // Start just before a local midnight so the readings cross several day boundaries
+    uint64_t state = 12345;
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        state = state * UINT64_C(6364136223846793005) + 1442695040888963407;
+        const double electric_usage = (double) (state >> 40) / 16777216.0;
+        const double gas_usage = (double) ((state >> 16) & 0xFFFFFF) / 16777216.0;
+        snapshots[i] = create_snapshot(LOCAL_MIDNIGHT - 600 + i * READING_STEP_SECONDS,
+                electric_usage, gas_usage, (uint8_t) (i % 16));
+    }
+}
+
+static void test_price_snapshots(const tariff* tariff_table, const usage_snapshot* readings)
+{
+    usage_snapshot* batched = malloc(READING_COUNT * sizeof(usage_snapshot));
+    memcpy(batched, readings, READING_COUNT * sizeof(usage_snapshot));
+    price_snapshots(tariff_table, batched, READING_COUNT);
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        usage_snapshot reference = readings[i];
+        price_snapshot(tariff_table, &reference);
+        CHECK(reference.electric_cost == batched[i].electric_cost);
+        CHECK(reference.gas_cost == batched[i].gas_cost);
+        CHECK(reference.status == batched[i].status);
+    }
+    free(batched);
+}
+
+static void test_price_usage(const tariff* tariff_table, const usage_snapshot* readings)
+{
+    uint64_t* timestamps = malloc(READING_COUNT * sizeof(uint64_t));
+    double* usage = malloc(4 * READING_COUNT * sizeof(double));
+    double* electric_usage = usage;
+    double* gas_usage = usage + READING_COUNT;
+    double* electric_cost = usage + 2 * READING_COUNT;
+    double* gas_cost = usage + 3 * READING_COUNT;
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        timestamps[i] = readings[i].timestamp;
+        electric_usage[i] = readings[i].electric_usage;
+        gas_usage[i] = readings[i].gas_usage;
+    }
+    // An odd count covers a partial block
+    price_usage(tariff_table, timestamps, electric_usage, gas_usage, electric_cost, gas_cost,
+            READING_COUNT - 1);
+    for (size_t i = 0; i < READING_COUNT - 1; ++i)
+    {
+        // price_usage applies no status, compare with every usage flagged valid
+        usage_snapshot reference = readings[i];
+        reference.status = 15;
+        price_snapshot(tariff_table, &reference);
+        CHECK(reference.electric_cost == electric_cost[i]);
+        CHECK(reference.gas_cost == gas_cost[i]);
+    }
+    free(timestamps);
+    free(usage);
+}
+
+static void test_compute_tariff_totals(const tariff* tariff_table, const usage_snapshot* readings)
+{
+    double electric_cost = 0.0;
+    double gas_cost = 0.0;
+    uint64_t days = 0;
+    uint64_t previous_day = UINT64_MAX;
+    for (size_t i = 0; i < READING_COUNT; ++i)
+    {
+        usage_snapshot reference = readings[i];
+        price_snapshot(tariff_table, &reference);
+        electric_cost += reference.electric_cost;
+        gas_cost += reference.gas_cost;
+        const uint64_t day = get_tariff_day(tariff_table, reference.timestamp);
+        days += (day != previous_day);
+        previous_day = day;
+    }
+    tariff_totals totals;
+    compute_tariff_totals(tariff_table, readings, READING_COUNT, &totals);
+    CHECK_CLOSE(totals.electric_energy_cost, electric_cost, 1e-12);
+    CHECK_CLOSE(totals.gas_energy_cost, gas_cost, 1e-12);
+    CHECK(days == totals.days);
+    // 5000 readings 97 seconds apart from 10 minutes before midnight cover 7 local days
+    CHECK(7 == totals.days);
+    CHECK(0.50 * 7 == totals.electric_standing_cost);
+    CHECK(0.30 * 7 == totals.gas_standing_cost);
+    // One second either side of a local midnight is two days
+    const usage_snapshot boundary[2] = {create_snapshot(LOCAL_MIDNIGHT - 1, 1.0, 1.0, 15),
+            create_snapshot(LOCAL_MIDNIGHT, 1.0, 1.0, 15)};
+    compute_tariff_totals(tariff_table, boundary, 2, &totals);
+    CHECK(2 == totals.days);
+    compute_tariff_totals(tariff_table, boundary, 0, &totals);
+    CHECK(0 == totals.days && 0.0 == totals.electric_standing_cost);
+    // Days without readings between the first and last reading are still charged
+    const usage_snapshot sparse[2] = {create_snapshot(LOCAL_MIDNIGHT + 3 * 86400 + 60, 1.0, 1.0, 15),
+            create_snapshot(LOCAL_MIDNIGHT + 60, 1.0, 1.0, 15)};
+    compute_tariff_totals(tariff_table, sparse, 2, &totals);
+    CHECK(4 == totals.days);
+    CHECK(0.50 * 4 == totals.electric_standing_cost);
+    CHECK(0.30 * 4 == totals.gas_standing_cost);
+}
+
+int main(void)
+{
+    tariff tariff_table;
+    initialise_test_tariff(&tariff_table);
+    test_reference(&tariff_table);
+    usage_snapshot* readings = malloc(READING_COUNT * sizeof(usage_snapshot));
+    create_readings(readings);
+    test_price_snapshots(&tariff_table, readings);
+    test_price_usage(&tariff_table, readings);
+    test_compute_tariff_totals(&tariff_table, readings);
+    free(readings);
+    return finish_test("test_tariff");
+}